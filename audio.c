@@ -0,0 +1,129 @@
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+
+#include "audio.h"
+#include "player.h"
+
+/* Formats a receiver can decode itself, sent as IEC 61937 by the sink */
+static const gchar *compressed_types[] = { "audio/x-ac3", "audio/x-eac3", "audio/x-dts", NULL };
+
+
+gboolean audio_is_compressed (const gchar *type) {
+  return g_strv_contains ((const gchar * const *) compressed_types, type);
+}
+
+/* Stop autoplugging at compressed audio the sink accepts as is */
+static gboolean autoplug_continue_cb (GstElement *source, GstPad *pad, GstCaps *caps, CustomData *data) {
+  const gchar *type = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+  GstPad *sinkpad;
+  GstCaps *sink_caps;
+  gboolean supported;
+
+  if (!audio_is_compressed (type))
+    return TRUE;
+
+  sinkpad = gst_element_get_static_pad (data->asink, "sink");
+  sink_caps = gst_pad_query_caps (sinkpad, NULL);
+  supported = gst_caps_can_intersect (caps, sink_caps);
+  gst_caps_unref (sink_caps);
+  gst_object_unref (sinkpad);
+
+  if (supported)
+    g_print ("Audio passthrough for '%s'\n", type);
+  return !supported;
+}
+
+/* Put the converters back so a later decoded track still fits */
+static void restore_converters (CustomData *data) {
+  if (!gst_element_link_many (data->audio_queue, data->aconvert, data->resample, data->asink, NULL))
+    g_printerr ("Could not restore the audio converters.\n");
+}
+
+gboolean audio_link_compressed (CustomData *data, GstPad *pad) {
+  GstPad *sinkpad = gst_element_get_static_pad (data->audio_queue, "sink");
+  gboolean linked = gst_pad_is_linked (sinkpad);
+
+  /* An earlier audio track owns the branch and data may flow already, leave it alone */
+  if (linked) {
+    g_print ("Audio branch already linked, ignoring the additional track.\n");
+    gst_object_unref (sinkpad);
+    return FALSE;
+  }
+
+  /* Nothing flows on the audio branch yet, rewire it around the converters */
+  gst_element_unlink_many (data->audio_queue, data->aconvert, data->resample, data->asink, NULL);
+  if (!gst_element_link (data->audio_queue, data->asink)) {
+    g_printerr ("Audio sink refused the passthrough link.\n");
+    restore_converters (data);
+    gst_object_unref (sinkpad);
+    return FALSE;
+  }
+
+  linked = GST_PAD_LINK_SUCCESSFUL (gst_pad_link (pad, sinkpad));
+  if (!linked) {
+    gst_element_unlink (data->audio_queue, data->asink);
+    restore_converters (data);
+  }
+  gst_object_unref (sinkpad);
+  return linked;
+}
+
+/* Once the sink has caps the converters are configured, tell whether they do any work */
+static GstPadProbeReturn caps_probe_cb (GstPad *pad, GstPadProbeInfo *info, CustomData *data) {
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstPad *convert_pad;
+  GstCaps *in_caps, *out_caps;
+  gchar *in, *out;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+
+  convert_pad = gst_element_get_static_pad (data->aconvert, "sink");
+  in_caps = gst_pad_get_current_caps (convert_pad);
+  gst_object_unref (convert_pad);
+  gst_event_parse_caps (event, &out_caps);
+
+  if (in_caps == NULL) {
+    /* Compressed passthrough, the converters are out of the branch */
+  } else if (gst_base_transform_is_passthrough (GST_BASE_TRANSFORM (data->aconvert)) &&
+      gst_base_transform_is_passthrough (GST_BASE_TRANSFORM (data->resample))) {
+    g_print ("Audio path: passthrough, the sink takes the decoded format\n");
+  } else {
+    in = gst_caps_to_string (in_caps);
+    out = gst_caps_to_string (out_caps);
+    g_print ("Audio path: converting %s -> %s\n", in, out);
+    g_free (in);
+    g_free (out);
+  }
+  if (in_caps != NULL)
+    gst_caps_unref (in_caps);
+  return GST_PAD_PROBE_OK;
+}
+
+gboolean audio_setup (CustomData *data, const AudioConfig *config) {
+  GstPad *pad;
+
+  if (config->resample_method != NULL) {
+    GParamSpec *pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (data->resample), "resample-method");
+    GEnumClass *methods = pspec ? g_type_class_ref (pspec->value_type) : NULL;
+    gboolean known = methods != NULL && g_enum_get_value_by_nick (methods, config->resample_method) != NULL;
+
+    if (methods != NULL)
+      g_type_class_unref (methods);
+    if (!known) {
+      g_printerr ("Unknown resample method '%s'.\n", config->resample_method);
+      return FALSE;
+    }
+    gst_util_set_object_arg (G_OBJECT (data->resample), "resample-method", config->resample_method);
+  }
+  if (config->resample_quality >= 0)
+    g_object_set (data->resample, "quality", CLAMP (config->resample_quality, 0, 10), NULL);
+
+  if (config->passthrough && data->source != NULL)
+    g_signal_connect (data->source, "autoplug-continue", G_CALLBACK (autoplug_continue_cb), data);
+
+  pad = gst_element_get_static_pad (data->asink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, (GstPadProbeCallback) caps_probe_cb, data, NULL);
+  gst_object_unref (pad);
+  return TRUE;
+}
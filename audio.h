@@ -0,0 +1,23 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+typedef struct _AudioConfig {
+  const gchar *resample_method; /* audioresample method nick, NULL for its default */
+  gint resample_quality;        /* 0 (fastest) to 10 (best), -1 for the default */
+  gboolean passthrough;         /* send AC3/E-AC3/DTS undecoded when the sink takes them */
+} AudioConfig;
+
+/* Configure the resampler and report whether the branch converts or passes through */
+gboolean audio_setup (CustomData *data, const AudioConfig *config);
+
+/* Streaming thread: caps uridecodebin may expose undecoded with passthrough on */
+gboolean audio_is_compressed (const gchar *type);
+/* Streaming thread: link an undecoded audio pad straight from audio_queue to the sink,
+ * FALSE without touching the branch when another track already feeds it */
+gboolean audio_link_compressed (CustomData *data, GstPad *pad);
+
+#endif
@@ -0,0 +1,291 @@
+#include <gst/gst.h>
+
+#include "avsync.h"
+#include "player.h"
+
+#define AVSYNC_REPORT_INTERVAL (5 * G_USEC_PER_SEC)
+/* Less is not reliable enough to call it a drift */
+#define AVSYNC_MIN_FIT 10
+#define LATE_THRESHOLD_MS 5.0
+#define DRIFT_THRESHOLD_MS_PER_MIN 1.0
+
+
+static void init_stream (SyncStream *stream, AvSync *sync, const gchar *name) {
+  stream->sync = sync;
+  stream->name = name;
+  gst_segment_init (&stream->segment, GST_FORMAT_UNDEFINED);
+}
+
+AvSync *avsync_new (gint64 offset_ns) {
+  AvSync *sync = g_new0 (AvSync, 1);
+
+  init_stream (&sync->video, sync, "video");
+  init_stream (&sync->audio, sync, "audio");
+  sync->ui_offset = offset_ns;
+  return sync;
+}
+
+void avsync_free (AvSync *sync) {
+  if (sync == NULL)
+    return;
+  if (sync->clock != NULL)
+    gst_object_unref (sync->clock);
+  g_free (sync);
+}
+
+/* A buffer is due at its running time plus the latency and the sink's ts-offset */
+static GstPadProbeReturn sink_probe_cb (GstPad *pad, GstPadProbeInfo *info, SyncStream *stream) {
+  GstClockTime running_time, now;
+  GstBuffer *buffer;
+  GstClock *clock;
+  gint64 due, early;
+
+  if (!(info->type & GST_PAD_PROBE_TYPE_BUFFER)) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+      gst_event_copy_segment (event, &stream->segment);
+    else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+      atomic_store (&stream->sync->flushed, TRUE);
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  if (!GST_BUFFER_PTS_IS_VALID (buffer) || stream->segment.format != GST_FORMAT_TIME)
+    return GST_PAD_PROBE_OK;
+  running_time = gst_segment_to_running_time (&stream->segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+  clock = gst_element_get_clock (stream->sink);
+  if (clock == NULL || !GST_CLOCK_TIME_IS_VALID (running_time)) {
+    if (clock != NULL)
+      gst_object_unref (clock);
+    return GST_PAD_PROBE_OK;
+  }
+  now = gst_clock_get_time (clock) - gst_element_get_base_time (stream->sink);
+  gst_object_unref (clock);
+
+  due = (gint64) (running_time + atomic_load (&stream->sync->pipeline_latency)) + atomic_load (&stream->ts_offset);
+  early = due - (gint64) now;
+  atomic_fetch_add (&stream->headroom_sum_us, early / GST_USECOND);
+  if (early < 0) {
+    /* Shown as soon as it arrives, this much after the other stream expects it */
+    atomic_fetch_add (&stream->late_sum_us, -early / GST_USECOND);
+    atomic_fetch_add (&stream->late, 1);
+  }
+  atomic_fetch_add (&stream->samples, 1);
+  return GST_PAD_PROBE_OK;
+}
+
+static void attach_stream (SyncStream *stream, GstElement *queue, GstElement *sink) {
+  GstPad *pad = gst_element_get_static_pad (sink, "sink");
+
+  stream->queue = queue;
+  stream->sink = sink;
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+      (GstPadProbeCallback) sink_probe_cb, stream, NULL);
+  gst_object_unref (pad);
+}
+
+void avsync_attach (AvSync *sync, CustomData *data) {
+  attach_stream (&sync->video, data->video_queue, data->videosink);
+  attach_stream (&sync->audio, data->audio_queue, data->asink);
+  avsync_set_offset (sync, sync->ui_offset);
+}
+
+/* Sink bins such as glsinkbin do not proxy ts-offset, the sink inside has it */
+static GstElement *find_ts_offset_owner (GstElement *element) {
+  GstIterator *it;
+  GValue value = G_VALUE_INIT;
+  GstElement *owner = NULL;
+  gboolean done = FALSE;
+
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), "ts-offset"))
+    return gst_object_ref (element);
+  if (!GST_IS_BIN (element))
+    return NULL;
+
+  it = gst_bin_iterate_recurse (GST_BIN (element));
+  while (!done && owner == NULL) {
+    switch (gst_iterator_next (it, &value)) {
+      case GST_ITERATOR_OK:
+        if (g_object_class_find_property (G_OBJECT_GET_CLASS (g_value_get_object (&value)), "ts-offset"))
+          owner = GST_ELEMENT (g_value_dup_object (&value));
+        g_value_reset (&value);
+        break;
+      case GST_ITERATOR_RESYNC:
+        gst_iterator_resync (it);
+        break;
+      default:
+        done = TRUE;
+        break;
+    }
+  }
+  g_value_unset (&value);
+  gst_iterator_free (it);
+  return owner;
+}
+
+static void set_ts_offset (SyncStream *stream, gint64 offset) {
+  GstElement *owner = find_ts_offset_owner (stream->sink);
+
+  if (owner == NULL) {
+    if (offset != 0)
+      g_printerr ("The %s sink has no ts-offset, cannot correct A/V sync.\n", stream->name);
+    return;
+  }
+  g_object_set (owner, "ts-offset", offset, NULL);
+  atomic_store (&stream->ts_offset, offset);
+  gst_object_unref (owner);
+}
+
+void avsync_set_offset (AvSync *sync, gint64 offset_ns) {
+  if (sync == NULL)
+    return;
+
+  /* Only ever delay a stream, a negative ts-offset would make its buffers late */
+  set_ts_offset (&sync->audio, MAX (offset_ns, 0));
+  set_ts_offset (&sync->video, MAX (-offset_ns, 0));
+  g_print ("\nA/V correction %+.1f ms\n", offset_ns / (gdouble) GST_MSECOND);
+}
+
+void avsync_update_latency (AvSync *sync, GstElement *pipeline) {
+  GstQuery *query;
+  GstClockTime min_latency;
+
+  if (sync == NULL)
+    return;
+
+  query = gst_query_new_latency ();
+  if (gst_element_query (pipeline, query)) {
+    gst_query_parse_latency (query, NULL, &min_latency, NULL);
+    atomic_store (&sync->pipeline_latency, min_latency);
+  }
+  gst_query_unref (query);
+}
+
+/* Least squares slope of y over t, per minute */
+static gdouble fit_slope (const gdouble *t, const gdouble *y, guint n) {
+  gdouble st = 0, sy = 0, stt = 0, sty = 0, denominator;
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    st += t[i];
+    sy += y[i];
+    stt += t[i] * t[i];
+    sty += t[i] * y[i];
+  }
+  denominator = n * stt - st * st;
+  return denominator > 0 ? (n * sty - st * sy) / denominator * 60 : 0;
+}
+
+/* Pipeline clock against the system clock, the audio device clock when the audio sink provides it */
+static gdouble clock_drift_ppm (AvSync *sync, GstElement *pipeline, gint64 now) {
+  GstClock *clock = gst_element_get_clock (pipeline);
+  gint64 elapsed_clock, elapsed_system;
+
+  if (clock == NULL)
+    return 0;
+  if (clock != sync->clock) {
+    if (sync->clock != NULL)
+      gst_object_unref (sync->clock);
+    sync->clock = clock;
+    sync->clock_start = gst_clock_get_time (clock);
+    sync->monotonic_start = now;
+    return 0;
+  }
+  elapsed_clock = gst_clock_get_time (clock) - sync->clock_start;
+  elapsed_system = (now - sync->monotonic_start) * GST_USECOND;
+  gst_object_unref (clock);
+  return elapsed_system > 0 ? (elapsed_clock - elapsed_system) / (gdouble) elapsed_system * 1e6 : 0;
+}
+
+static gdouble queue_level_ms (SyncStream *stream) {
+  guint64 level = 0;
+
+  g_object_get (stream->queue, "current-level-time", &level, NULL);
+  return level / (gdouble) GST_MSECOND;
+}
+
+typedef struct _SyncWindow {
+  guint64 samples;
+  guint64 late;
+  gdouble late_ms;              /* average over all buffers */
+  gdouble headroom_ms;
+} SyncWindow;
+
+static gboolean take_window (SyncStream *stream, SyncWindow *window) {
+  gint64 headroom_us = atomic_exchange (&stream->headroom_sum_us, 0);
+  guint64 late_us = atomic_exchange (&stream->late_sum_us, 0);
+
+  window->late = atomic_exchange (&stream->late, 0);
+  window->samples = atomic_exchange (&stream->samples, 0);
+  if (window->samples == 0)
+    return FALSE;
+  window->late_ms = late_us / (gdouble) window->samples / 1000.0;
+  window->headroom_ms = headroom_us / (gdouble) window->samples / 1000.0;
+  return TRUE;
+}
+
+void avsync_tick (AvSync *sync, GstElement *pipeline) {
+  gint64 now = g_get_monotonic_time ();
+  SyncWindow video, audio;
+  gdouble offset_ms, ppm, offset_drift = 0, headroom_drift = 0;
+  gboolean has_video, has_audio, fitted;
+  guint pos;
+
+  if (sync == NULL || now - sync->last_sample < G_USEC_PER_SEC)
+    return;
+  sync->last_sample = now;
+
+  if (atomic_exchange (&sync->flushed, FALSE))
+    sync->n_history = sync->history_pos = 0;
+  ppm = clock_drift_ppm (sync, pipeline, now);
+  has_video = take_window (&sync->video, &video);
+  has_audio = take_window (&sync->audio, &audio);
+  if (!has_video || !has_audio)
+    return;
+
+  /* Positive when the picture is behind the sound */
+  offset_ms = (atomic_load (&sync->video.ts_offset) - atomic_load (&sync->audio.ts_offset)) / (gdouble) GST_MSECOND +
+      video.late_ms - audio.late_ms;
+
+  if (sync->n_history == 0)
+    sync->start_time = now;
+  pos = sync->history_pos;
+  sync->history_t[pos] = (now - sync->start_time) / (gdouble) G_USEC_PER_SEC;
+  sync->history_offset[pos] = offset_ms;
+  sync->history_headroom[pos] = audio.headroom_ms;
+  sync->history_pos = (pos + 1) % AVSYNC_HISTORY;
+  sync->n_history = MIN (sync->n_history + 1, AVSYNC_HISTORY);
+
+  if (now - sync->last_report < AVSYNC_REPORT_INTERVAL)
+    return;
+  sync->last_report = now;
+
+  /* Order does not matter for the fit, the whole ring is used once full */
+  fitted = sync->n_history >= AVSYNC_MIN_FIT;
+  if (fitted) {
+    offset_drift = fit_slope (sync->history_t, sync->history_offset, sync->n_history);
+    headroom_drift = fit_slope (sync->history_t, sync->history_headroom, sync->n_history);
+  }
+
+  g_print ("\nA/V offset %+.1f ms", offset_ms);
+  if (fitted)
+    g_print (" (drift %+.2f ms/min)", offset_drift);
+  g_print (", late video %.1f ms (%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT "), audio %.1f ms (%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT ")\n",
+      video.late_ms, video.late, video.samples, audio.late_ms, audio.late, audio.samples);
+  g_print ("  queues video %.0f ms, audio %.0f ms; audio sink headroom %.0f ms", queue_level_ms (&sync->video),
+      queue_level_ms (&sync->audio), audio.headroom_ms);
+  if (fitted)
+    g_print (" (%+.2f ms/min)", headroom_drift);
+  g_print ("; clock %s %+.0f ppm\n", sync->clock ? GST_OBJECT_NAME (sync->clock) : "none", ppm);
+
+  /* Point at the part of the pipeline the offset comes from */
+  if (video.late_ms > LATE_THRESHOLD_MS)
+    g_print ("  video reaches its sink late: decoding or conversion cannot keep up%s\n",
+        queue_level_ms (&sync->video) < 1 ? ", the video queue runs empty" : "");
+  if (audio.late_ms > LATE_THRESHOLD_MS)
+    g_print ("  audio reaches its sink late%s\n", queue_level_ms (&sync->audio) < 1 ? ", the audio queue runs empty" : "");
+  if (fitted && ABS (headroom_drift) > DRIFT_THRESHOLD_MS_PER_MIN)
+    g_print ("  the audio device consumes samples at another rate than the pipeline clock\n");
+  else if (fitted && ABS (offset_drift) > DRIFT_THRESHOLD_MS_PER_MIN && video.late_ms <= LATE_THRESHOLD_MS)
+    g_print ("  the stream timestamps drift apart\n");
+}
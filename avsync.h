@@ -0,0 +1,62 @@
+#ifndef AVSYNC_H
+#define AVSYNC_H
+
+#include <stdatomic.h>
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+typedef struct _AvSync AvSync;
+
+/* Seconds of one-per-second samples the drift is fitted over */
+#define AVSYNC_HISTORY 60
+
+typedef struct _SyncStream {
+  AvSync *sync;
+  const gchar *name;
+  GstElement *sink;
+  GstElement *queue;
+  GstSegment segment;           /* sink probe thread only */
+  _Atomic gint64 ts_offset;     /* applied to the sink, ns */
+
+  /* From the sink streaming thread, reset every window */
+  _Atomic gint64 headroom_sum_us;  /* how early buffers reach the sink */
+  atomic_uint_fast64_t late_sum_us;  /* how much later than due they are shown */
+  atomic_uint_fast64_t late;
+  atomic_uint_fast64_t samples;
+} SyncStream;
+
+struct _AvSync {
+  SyncStream video;
+  SyncStream audio;
+  atomic_uint_fast64_t pipeline_latency;  /* set by the control thread */
+  atomic_bool flushed;          /* a seek broke the history */
+  gint64 ui_offset;             /* UI thread only, last correction requested */
+
+  /* Control thread only */
+  gint64 start_time;
+  gint64 last_sample;
+  gint64 last_report;
+  guint n_history;
+  guint history_pos;
+  gdouble history_t[AVSYNC_HISTORY];        /* s */
+  gdouble history_offset[AVSYNC_HISTORY];   /* ms */
+  gdouble history_headroom[AVSYNC_HISTORY]; /* audio, ms */
+  GstClock *clock;
+  GstClockTime clock_start;
+  gint64 monotonic_start;
+};
+
+/* offset_ns > 0 renders audio later, < 0 renders video later */
+AvSync *avsync_new (gint64 offset_ns);
+void avsync_free (AvSync *sync);
+
+/* Watch both sinks and apply the initial correction */
+void avsync_attach (AvSync *sync, CustomData *data);
+/* Control thread: change the correction on the fly */
+void avsync_set_offset (AvSync *sync, gint64 offset_ns);
+/* Control thread: the sinks render buffers this much after their running time */
+void avsync_update_latency (AvSync *sync, GstElement *pipeline);
+/* Control thread: sample once a second, print the offset, its drift and their likely cause */
+void avsync_tick (AvSync *sync, GstElement *pipeline);
+
+#endif
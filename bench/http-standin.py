@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""Local HTTP stand-in for testing --stream.
+
+Serves the files of a directory with Range support and logs every request
+with its byte range, so it is easy to check that seeks inside the cached
+range do not reach the server:
+
+    bench/http-standin.py DIR [PORT] [KBPS]
+    ./open-pipe-media-player --cache-size=64 http://127.0.0.1:8000/clip.mkv
+
+KBPS throttles the response rate to provoke BUFFERING messages.
+"""
+import os
+import re
+import sys
+import time
+from http.server import SimpleHTTPRequestHandler, ThreadingHTTPServer
+
+RATE_KBPS = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+CHUNK = 16 * 1024
+
+
+class RangeHandler(SimpleHTTPRequestHandler):
+    def do_GET(self):
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            self.send_error(404)
+            return
+        size = os.path.getsize(path)
+        start, end = 0, size - 1
+        match = re.match(r"bytes=(\d*)-(\d*)", self.headers.get("Range", ""))
+        if match:
+            if match.group(1):
+                start = int(match.group(1))
+            if match.group(2):
+                end = min(int(match.group(2)), size - 1)
+            self.send_response(206)
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, size))
+        else:
+            self.send_response(200)
+        sys.stderr.write("GET %s bytes %d-%d\n" % (self.path, start, end))
+        self.send_header("Accept-Ranges", "bytes")
+        self.send_header("Content-Length", str(end - start + 1))
+        self.send_header("Content-Type", self.guess_type(path))
+        self.end_headers()
+
+        with open(path, "rb") as f:
+            f.seek(start)
+            remaining = end - start + 1
+            while remaining > 0:
+                data = f.read(min(CHUNK, remaining))
+                if not data:
+                    break
+                try:
+                    self.wfile.write(data)
+                except (BrokenPipeError, ConnectionResetError):
+                    return
+                remaining -= len(data)
+                if RATE_KBPS:
+                    time.sleep(len(data) / (RATE_KBPS * 1024.0))
+
+    def log_message(self, fmt, *args):
+        pass
+
+
+if __name__ == "__main__":
+    os.chdir(sys.argv[1] if len(sys.argv) > 1 else ".")
+    port = int(sys.argv[2]) if len(sys.argv) > 2 else 8000
+    ThreadingHTTPServer(("127.0.0.1", port), RangeHandler).serve_forever()
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Live sender on loopback to try --live against.
+#
+#   live-standin.sh rtp  [PORT]   H.264 over RTP with RTCP, play rtp://127.0.0.1:PORT?encoding-name=H264
+#   live-standin.sh udp  [PORT]   MPEG-TS over UDP, play udp://127.0.0.1:PORT
+#   live-standin.sh rtsp [PORT]   RTSP server (needs gst-rtsp-server's test-launch),
+#                                 play rtsp://127.0.0.1:PORT/test
+#
+# The RTP sender's RTCP sender reports carry its NTP clock, on the same host the player
+# then measures glass-to-glass latency against the real capture time.
+set -eu
+
+MODE=${1:-rtp}
+PORT=${2:-5004}
+
+SOURCE="videotestsrc is-live=true pattern=ball ! video/x-raw,width=1280,height=720,framerate=30/1 ! timeoverlay"
+ENCODE="x264enc tune=zerolatency speed-preset=ultrafast key-int-max=30 bitrate=4000"
+
+case "$MODE" in
+    rtp)
+        exec gst-launch-1.0 -q $SOURCE ! $ENCODE ! rtph264pay config-interval=-1 \
+            ! "rtpsink uri=rtp://127.0.0.1:$PORT"
+        ;;
+    udp)
+        exec gst-launch-1.0 -q $SOURCE ! $ENCODE ! mpegtsmux alignment=7 \
+            ! udpsink host=127.0.0.1 port="$PORT"
+        ;;
+    rtsp)
+        exec test-launch --port="$PORT" "( $SOURCE ! $ENCODE ! rtph264pay name=pay0 pt=96 config-interval=-1 )"
+        ;;
+    *)
+        echo "Unknown mode $MODE, use rtp, udp or rtsp" >&2
+        exit 1
+        ;;
+esac
@@ -0,0 +1,76 @@
+#!/bin/sh
+# Generate the benchmark corpus (once) and run the headless benchmark over it.
+#
+#   run-benchmark.sh PLAYER CORPUS_DIR RESULTS
+#
+# BENCH_SECONDS    clip length (default 10)
+# BENCH_ARGS       extra player options, e.g. "--hwaccel=off --convert-threads=4",
+#                  "--mmap" compares the mapped file source against a filesrc baseline
+# BENCH_BASELINE   previous RESULTS file, fail when video fps drops more than
+# BENCH_TOLERANCE  percent (default 10)
+set -eu
+
+PLAYER=$1
+CORPUS=$2
+RESULTS=$3
+SECONDS_PER_CLIP=${BENCH_SECONDS:-10}
+TOLERANCE=${BENCH_TOLERANCE:-10}
+
+mkdir -p "$CORPUS"
+
+have () {
+    gst-inspect-1.0 --exists "$1"
+}
+
+# make_clip NAME WIDTH HEIGHT ENCODER...
+make_clip () {
+    name=$1 width=$2 height=$3
+    shift 3
+    out="$CORPUS/$name.mkv"
+    [ -f "$out" ] && return 0
+    echo "Generating $out"
+    # Every clip carries audio and video so both branches preroll
+    gst-launch-1.0 -q \
+        videotestsrc num-buffers=$((SECONDS_PER_CLIP * 30)) pattern=smpte \
+        ! video/x-raw,width="$width",height="$height",framerate=30/1 \
+        ! "$@" ! queue ! mux. \
+        audiotestsrc num-buffers=$((SECONDS_PER_CLIP * 48000 / 1024)) samplesperbuffer=1024 \
+        ! audio/x-raw,rate=48000 ! opusenc ! queue ! mux. \
+        matroskamux name=mux ! filesink location="$out.tmp"
+    mv "$out.tmp" "$out"
+}
+
+for size in 640x360 1280x720 1920x1080 3840x2160; do
+    width=${size%x*}
+    height=${size#*x}
+    if have x264enc; then
+        make_clip "h264-$size" "$width" "$height" x264enc speed-preset=ultrafast ! h264parse
+    fi
+    if have vp8enc; then
+        make_clip "vp8-$size" "$width" "$height" vp8enc deadline=1 cpu-used=16
+    fi
+    if have vp9enc && [ "$width" -le 1920 ]; then
+        make_clip "vp9-$size" "$width" "$height" vp9enc deadline=1 cpu-used=8
+    fi
+done
+
+: > "$RESULTS"
+for clip in "$CORPUS"/*.mkv; do
+    # shellcheck disable=SC2086
+    "$PLAYER" --benchmark ${BENCH_ARGS:-} "$clip" | tee -a "$RESULTS"
+done
+
+[ -n "${BENCH_BASELINE:-}" ] || exit 0
+
+fps () {
+    sed -n 's/.*"uri":"\([^"]*\)".*"video":{[^}]*"fps":\([0-9.]*\).*/\1 \2/p' "$1"
+}
+
+fps "$BENCH_BASELINE" | while read -r uri baseline; do
+    current=$(fps "$RESULTS" | awk -v u="$uri" '$1 == u { print $2 }')
+    [ -n "$current" ] || continue
+    if awk -v c="$current" -v b="$baseline" -v t="$TOLERANCE" 'BEGIN { exit !(c < b * (100 - t) / 100) }'; then
+        echo "REGRESSION: $uri $current fps (baseline $baseline fps)"
+        exit 1
+    fi
+done
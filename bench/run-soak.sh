@@ -0,0 +1,39 @@
+#!/bin/sh
+# Play one generated clip in a loop for hours in bounded memory mode and fail when
+# the resident memory keeps growing.
+#
+#   run-soak.sh PLAYER CORPUS_DIR RESULTS
+#
+# SOAK_HOURS       length of the run (default 4)
+# SOAK_LIMIT_MB    --memory-limit of the run (default 512)
+# SOAK_TOLERANCE   RSS growth in MB allowed between the start and the end (default 16)
+# SOAK_ARGS        extra player options, e.g. "--queue-memory=32 --mmap"
+set -eu
+
+PLAYER=$1
+CORPUS=$2
+RESULTS=$3
+HOURS=${SOAK_HOURS:-4}
+
+mkdir -p "$CORPUS"
+clip="$CORPUS/soak-1080p.mkv"
+if [ ! -f "$clip" ]; then
+    echo "Generating $clip"
+    # Short on purpose, every loop goes through EOS, a flushing seek and renegotiation
+    gst-launch-1.0 -q \
+        videotestsrc num-buffers=900 pattern=ball \
+        ! video/x-raw,width=1920,height=1080,framerate=30/1 \
+        ! x264enc speed-preset=ultrafast key-int-max=30 ! h264parse ! queue ! mux. \
+        audiotestsrc num-buffers=$((30 * 48000 / 1024)) samplesperbuffer=1024 \
+        ! audio/x-raw,rate=48000 ! opusenc ! queue ! mux. \
+        matroskamux name=mux ! filesink location="$clip.tmp"
+    mv "$clip.tmp" "$clip"
+fi
+
+# The player exits non-zero when the memory use was not flat, a pipe would hide that
+status=0
+# shellcheck disable=SC2086
+"$PLAYER" --soak=$((HOURS * 3600)) --soak-tolerance="${SOAK_TOLERANCE:-16}" \
+    --memory-limit="${SOAK_LIMIT_MB:-512}" ${SOAK_ARGS:-} "$clip" > "$RESULTS" || status=$?
+grep '^{' "$RESULTS" || true
+exit $status
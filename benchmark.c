@@ -0,0 +1,270 @@
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+#include <gst/gst.h>
+
+#include "benchmark.h"
+#include "player.h"
+
+/* Larger than any queue level, so enter times are never overwritten before use */
+#define LATENCY_RING_SIZE 1024
+#define TICK_MS 1000
+#define SOAK_SAMPLE_INTERVAL (10 * G_USEC_PER_SEC)
+
+/* Element reading the uri, filesrc or mmapsrc for local files */
+static const gchar *source_factory_name (GstElement *uridecodebin) {
+  GstElement *source = NULL;
+  const gchar *name = "unknown";
+
+  if (uridecodebin != NULL)
+    g_object_get (uridecodebin, "source", &source, NULL);
+  if (source != NULL) {
+    /* Factories are never unloaded */
+    name = GST_OBJECT_NAME (gst_element_get_factory (source));
+    gst_object_unref (source);
+  }
+  return name;
+}
+
+/* queue and convert elements are 1:1, so buffers leave a branch in the order they entered */
+typedef struct _BranchStats {
+  const gchar *name;
+  gint64 enter_times[LATENCY_RING_SIZE];
+  atomic_uint enter_index;
+
+  /* Sink streaming thread only, read after EOS */
+  guint exit_index;
+  guint64 frames;
+  gint64 latency_sum;
+  gint64 latency_max;
+  guint64 latency_count;
+} BranchStats;
+
+typedef struct _Benchmark {
+  CustomData data;
+  GMainLoop *loop;
+  BranchStats video;
+  BranchStats audio;
+  _Atomic gint64 first_frame_time;
+  gboolean failed;
+
+  const SoakConfig *soak;
+  gint64 soak_end;
+  guint loops;
+  GArray *rss_samples;          /* KB, one every SOAK_SAMPLE_INTERVAL */
+  gint64 last_sample;
+} Benchmark;
+
+
+static GstPadProbeReturn enter_probe_cb (GstPad *pad, GstPadProbeInfo *info, BranchStats *branch) {
+  guint index = atomic_load_explicit (&branch->enter_index, memory_order_relaxed);
+
+  branch->enter_times[index % LATENCY_RING_SIZE] = g_get_monotonic_time ();
+  atomic_store_explicit (&branch->enter_index, index + 1, memory_order_release);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn exit_probe_cb (GstPad *pad, GstPadProbeInfo *info, BranchStats *branch) {
+  gint64 now = g_get_monotonic_time ();
+  guint entered = atomic_load_explicit (&branch->enter_index, memory_order_acquire);
+
+  branch->frames++;
+  if (branch->exit_index < entered) {
+    gint64 latency = now - branch->enter_times[branch->exit_index % LATENCY_RING_SIZE];
+    branch->latency_sum += latency;
+    branch->latency_max = MAX (branch->latency_max, latency);
+    branch->latency_count++;
+    branch->exit_index++;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn first_frame_probe_cb (GstPad *pad, GstPadProbeInfo *info, Benchmark *bench) {
+  gint64 unset = 0;
+
+  atomic_compare_exchange_strong (&bench->first_frame_time, &unset, g_get_monotonic_time ());
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static void attach_branch (BranchStats *branch, const gchar *name, GstElement *queue, GstElement *sink) {
+  GstPad *pad;
+
+  branch->name = name;
+  atomic_init (&branch->enter_index, 0);
+
+  pad = gst_element_get_static_pad (queue, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) enter_probe_cb, branch, NULL);
+  gst_object_unref (pad);
+
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) exit_probe_cb, branch, NULL);
+  gst_object_unref (pad);
+}
+
+static gboolean bus_cb (GstBus *bus, GstMessage *msg, Benchmark *bench) {
+  GError *err;
+  gchar *debug_info;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_ERROR:
+      gst_message_parse_error (msg, &err, &debug_info);
+      g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+      g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+      g_clear_error (&err);
+      g_free (debug_info);
+      bench->failed = TRUE;
+      g_main_loop_quit (bench->loop);
+      break;
+    case GST_MESSAGE_EOS:
+      if (bench->soak->seconds > 0 && g_get_monotonic_time () < bench->soak_end) {
+        bench->loops++;
+        if (gst_element_seek_simple (bench->data.pipeline, GST_FORMAT_TIME,
+            GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT, 0))
+          break;
+        g_printerr ("Could not loop the soak clip.\n");
+        bench->failed = TRUE;
+      }
+      g_main_loop_quit (bench->loop);
+      break;
+    default:
+      break;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/* No control thread here, the memory ceiling and the soak samples run on the main loop */
+static gboolean tick_cb (Benchmark *bench) {
+  gint64 now = g_get_monotonic_time ();
+
+  memlimit_tick (bench->data.memlimit);
+  if (bench->soak->seconds > 0 && now - bench->last_sample >= SOAK_SAMPLE_INTERVAL) {
+    guint64 rss_kb = memlimit_rss_kb ();
+    g_array_append_val (bench->rss_samples, rss_kb);
+    bench->last_sample = now;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+static void append_branch (GString *str, BranchStats *branch, gdouble wall_s) {
+  g_string_append_printf (str, ",\"%s\":{\"frames\":%" G_GUINT64_FORMAT ",", branch->name, branch->frames);
+  metrics_append_double (str, "fps", wall_s > 0 ? branch->frames / wall_s : 0, 2);
+  g_string_append (str, ",");
+  metrics_append_double (str, "latency_avg_ms", branch->latency_count ? branch->latency_sum / 1000.0 / branch->latency_count : 0, 2);
+  g_string_append (str, ",");
+  metrics_append_double (str, "latency_max_ms", branch->latency_max / 1000.0, 2);
+  g_string_append (str, "}");
+}
+
+static gdouble mean_kb (GArray *samples, guint from, guint to) {
+  gdouble sum = 0;
+  guint i;
+
+  for (i = from; i < to; i++)
+    sum += g_array_index (samples, guint64, i);
+  return to > from ? sum / (to - from) : 0;
+}
+
+/* The first quarter is warm-up (pools, caches, heap arenas), after that the second
+ * and the last quarter must be about the same, growth in between is a leak */
+static gboolean append_soak (GString *str, Benchmark *bench) {
+  GArray *samples = bench->rss_samples;
+  guint quarter = samples->len / 4;
+  gdouble start_kb, end_kb;
+  gboolean flat;
+
+  if (bench->soak->seconds == 0)
+    return TRUE;
+
+  start_kb = mean_kb (samples, quarter, 2 * quarter);
+  end_kb = mean_kb (samples, samples->len - quarter, samples->len);
+  /* Too short to tell */
+  flat = quarter == 0 || end_kb - start_kb <= bench->soak->tolerance_mb * 1024.0;
+
+  g_string_append_printf (str, ",\"soak\":{\"loops\":%u,\"samples\":%u,", bench->loops, samples->len);
+  metrics_append_double (str, "rss_start_kb", start_kb, 2);
+  g_string_append (str, ",");
+  metrics_append_double (str, "rss_end_kb", end_kb, 2);
+  g_string_append_printf (str, ",\"flat\":%s}", flat ? "true" : "false");
+  if (!flat)
+    g_printerr ("Memory grew by %.0f KB over the soak run.\n", end_kb - start_kb);
+  return flat;
+}
+
+int benchmark_run (const gchar *uri, const PipelineConfig *config, Tracing *tracing, const SoakConfig *soak) {
+  Benchmark bench = { 0 };
+  GstBus *bus;
+  GstPad *pad;
+  struct rusage usage;
+  gint64 start_time, end_time, first_frame_time;
+  gdouble wall_s;
+  gchar *escaped_uri;
+  const gchar *input;
+  GString *result;
+  guint tick_source;
+  gboolean flat;
+
+  if (!pipeline_build (&bench.data, uri, config))
+    return -1;
+
+  tracing_attach (tracing, &bench.data);
+  attach_branch (&bench.video, "video", bench.data.video_queue, bench.data.videosink);
+  attach_branch (&bench.audio, "audio", bench.data.audio_queue, bench.data.asink);
+  pad = gst_element_get_static_pad (bench.data.videosink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) first_frame_probe_cb, &bench, NULL);
+  gst_object_unref (pad);
+
+  bench.loop = g_main_loop_new (NULL, FALSE);
+  bus = gst_element_get_bus (bench.data.pipeline);
+  gst_bus_add_watch (bus, (GstBusFunc) bus_cb, &bench);
+  bench.soak = soak;
+  bench.rss_samples = g_array_new (FALSE, FALSE, sizeof (guint64));
+  tick_source = g_timeout_add (TICK_MS, (GSourceFunc) tick_cb, &bench);
+
+  start_time = g_get_monotonic_time ();
+  bench.soak_end = start_time + (gint64) soak->seconds * G_USEC_PER_SEC;
+  if (gst_element_set_state (bench.data.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    g_printerr ("Unable to set the pipeline to the playing state.\n");
+    bench.failed = TRUE;
+  } else {
+    g_main_loop_run (bench.loop);
+  }
+  end_time = g_get_monotonic_time ();
+  g_source_remove (tick_source);
+
+  input = source_factory_name (bench.data.source);
+  gst_element_set_state (bench.data.pipeline, GST_STATE_NULL);
+  gst_bus_remove_watch (bus);
+  gst_object_unref (bus);
+  g_main_loop_unref (bench.loop);
+
+  getrusage (RUSAGE_SELF, &usage);
+  wall_s = (end_time - start_time) / (gdouble) G_USEC_PER_SEC;
+  first_frame_time = atomic_load (&bench.first_frame_time);
+  escaped_uri = g_strescape (uri, NULL);
+
+  result = g_string_new (NULL);
+  g_string_append_printf (result, "{\"uri\":\"%s\",\"status\":\"%s\",", escaped_uri, bench.failed ? "error" : "ok");
+  metrics_append_double (result, "wall_ms", wall_s * 1000, 2);
+  g_string_append (result, ",");
+  metrics_append_double (result, "first_frame_ms", first_frame_time ? (first_frame_time - start_time) / 1000.0 : -1, 2);
+  g_string_append_printf (result, ",\"peak_rss_kb\":%ld,\"input\":\"%s\"", usage.ru_maxrss, input);
+  append_branch (result, &bench.video, wall_s);
+  append_branch (result, &bench.audio, wall_s);
+  record_append_json (bench.data.record, result, wall_s);
+  memlimit_append_json (bench.data.memlimit, result);
+  flat = append_soak (result, &bench);
+  g_string_append (result, "}");
+  g_print ("%s\n", result->str);
+
+  g_string_free (result, TRUE);
+  g_free (escaped_uri);
+  gst_object_unref (bench.data.pipeline);
+  tracing_dump (tracing);
+  if (bench.data.buffering != NULL)
+    buffering_free (bench.data.buffering);
+  wall_free (bench.data.wall);
+  record_free (bench.data.record);
+  memlimit_free (bench.data.memlimit);
+  g_array_unref (bench.rss_samples);
+  return bench.failed || !flat ? 1 : 0;
+}
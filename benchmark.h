@@ -0,0 +1,19 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <gst/gst.h>
+
+#include "pipeline.h"
+#include "tracing.h"
+
+/* Loop the clip instead of stopping at EOS and check that the memory use stays flat */
+typedef struct _SoakConfig {
+  guint seconds;                /* 0 for a single pass */
+  guint tolerance_mb;           /* RSS growth from the start to the end of the run */
+} SoakConfig;
+
+/* Play uri to EOS through the headless chain and print one JSON result line,
+ * returns the process exit code. The trace, if any, is written at the end */
+int benchmark_run (const gchar *uri, const PipelineConfig *config, Tracing *tracing, const SoakConfig *soak);
+
+#endif
@@ -0,0 +1,181 @@
+#include <string.h>
+
+#include <gst/gst.h>
+
+#include "branches.h"
+
+static void load_spec (GKeyFile *keyfile, const gchar *group, BranchSpec *spec) {
+  spec->elements = g_key_file_get_string (keyfile, group, "elements", NULL);
+  spec->queue = g_key_file_get_string_list (keyfile, group, "queue", NULL, NULL);
+  if (spec->elements != NULL) {
+    g_strstrip (spec->elements);
+    if (*spec->elements == '\0')
+      g_clear_pointer (&spec->elements, g_free);
+  }
+}
+
+Branches *branches_load (const gchar *path, gboolean optional) {
+  GKeyFile *keyfile = g_key_file_new ();
+  GError *error = NULL;
+  Branches *branches;
+
+  if (!g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, &error)) {
+    if (!optional || !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_printerr ("Could not load the pipeline config %s: %s, using the built-in branches.\n", path, error->message);
+    g_error_free (error);
+    g_key_file_free (keyfile);
+    return NULL;
+  }
+
+  branches = g_new0 (Branches, 1);
+  branches->path = g_strdup (path);
+  load_spec (keyfile, "video", &branches->video);
+  load_spec (keyfile, "audio", &branches->audio);
+  g_key_file_free (keyfile);
+  g_print ("Pipeline config %s loaded\n", path);
+  return branches;
+}
+
+void branches_free (Branches *branches) {
+  if (branches == NULL)
+    return;
+  g_free (branches->path);
+  g_free (branches->video.elements);
+  g_strfreev (branches->video.queue);
+  g_free (branches->audio.elements);
+  g_strfreev (branches->audio.queue);
+  g_free (branches);
+}
+
+/* Whether what the pad can handle overlaps the caps */
+static gboolean pad_accepts (GstPad *pad, GstCaps *caps) {
+  GstCaps *pad_caps = gst_pad_query_caps (pad, NULL);
+  gboolean accepts = gst_caps_can_intersect (pad_caps, caps);
+
+  gst_caps_unref (pad_caps);
+  return accepts;
+}
+
+GstElement *branches_make (const BranchSpec *spec, const gchar *media_caps, GstElement *sink) {
+  GError *error = NULL;
+  GstElement *bin;
+  GstPad *bin_sink = NULL, *bin_src = NULL, *sink_pad = NULL;
+  GstCaps *caps, *src_caps;
+  const gchar *problem = NULL;
+
+  bin = gst_parse_bin_from_description (spec->elements, TRUE, &error);
+  if (bin == NULL || error != NULL) {
+    g_printerr ("Invalid branch '%s': %s\n", spec->elements, error ? error->message : "no elements");
+    g_clear_error (&error);
+    if (bin != NULL)
+      gst_object_unref (gst_object_ref_sink (bin));
+    return NULL;
+  }
+
+  /* Unlinked pads became ghost pads, exactly one of each direction is expected */
+  bin_sink = gst_element_get_static_pad (bin, "sink");
+  bin_src = gst_element_get_static_pad (bin, "src");
+  sink_pad = gst_element_get_static_pad (sink, "sink");
+  caps = gst_caps_from_string (media_caps);
+  if (bin_sink == NULL || bin_src == NULL) {
+    problem = "it needs one unlinked sink and one unlinked src pad";
+  } else if (!pad_accepts (bin_sink, caps)) {
+    problem = "it does not take the decoded stream";
+  } else {
+    src_caps = gst_pad_query_caps (bin_src, NULL);
+    if (!pad_accepts (sink_pad, src_caps))
+      problem = "the sink does not take its output";
+    gst_caps_unref (src_caps);
+  }
+  gst_caps_unref (caps);
+  g_clear_object (&bin_sink);
+  g_clear_object (&bin_src);
+  gst_object_unref (sink_pad);
+
+  if (problem != NULL) {
+    g_printerr ("Ignoring branch '%s': %s.\n", spec->elements, problem);
+    gst_object_unref (gst_object_ref_sink (bin));
+    return NULL;
+  }
+  g_print ("Using branch '%s'\n", spec->elements);
+  return bin;
+}
+
+static gint match_factory (const GValue *value, const gchar *factory_name) {
+  GstElementFactory *factory = gst_element_get_factory (GST_ELEMENT (g_value_get_object (value)));
+
+  return factory != NULL && g_strcmp0 (GST_OBJECT_NAME (factory), factory_name) == 0 ? 0 : 1;
+}
+
+GstElement *branches_find (GstElement *bin, const gchar *factory_name) {
+  GstIterator *it = gst_bin_iterate_recurse (GST_BIN (bin));
+  GValue value = G_VALUE_INIT;
+  GstElement *element = NULL;
+
+  if (gst_iterator_find_custom (it, (GCompareFunc) match_factory, &value, (gpointer) factory_name)) {
+    /* The bin keeps it alive */
+    element = GST_ELEMENT (g_value_get_object (&value));
+    g_value_unset (&value);
+  }
+  gst_iterator_free (it);
+  return element;
+}
+
+/* A negative size would wrap around to a huge limit, reject what the property cannot hold */
+static gboolean valid_size (GParamSpec *pspec, const gchar *value) {
+  guint64 size, max;
+
+  if (G_IS_PARAM_SPEC_UINT (pspec))
+    max = G_PARAM_SPEC_UINT (pspec)->maximum;
+  else if (G_IS_PARAM_SPEC_UINT64 (pspec))
+    max = G_PARAM_SPEC_UINT64 (pspec)->maximum;
+  else
+    return TRUE;
+  return g_ascii_string_to_unsigned (value, 10, 0, max, &size, NULL);
+}
+
+/* Which buffering limit the property is, 0 for the other queue properties */
+static QueueLimits limit_of (GParamSpec *pspec) {
+  if (g_strcmp0 (pspec->name, "max-size-time") == 0)
+    return QUEUE_LIMIT_TIME;
+  if (g_strcmp0 (pspec->name, "max-size-buffers") == 0)
+    return QUEUE_LIMIT_BUFFERS;
+  if (g_strcmp0 (pspec->name, "max-size-bytes") == 0)
+    return QUEUE_LIMIT_BYTES;
+  return 0;
+}
+
+QueueLimits branches_configure_queue (const BranchSpec *spec, GstElement *queue) {
+  guint buffers, bytes, new_buffers, new_bytes;
+  guint64 time, new_time;
+  QueueLimits limits = 0;
+  gchar **pair;
+
+  if (spec->queue == NULL)
+    return 0;
+
+  g_object_get (queue, "max-size-buffers", &buffers, "max-size-bytes", &bytes, "max-size-time", &time, NULL);
+  for (pair = spec->queue; *pair != NULL; pair++) {
+    gchar **kv = g_strsplit (g_strstrip (*pair), "=", 2);
+    GParamSpec *pspec = NULL;
+
+    if (kv[0] != NULL && kv[1] != NULL)
+      pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (queue), g_strstrip (kv[0]));
+    if (pspec == NULL || !valid_size (pspec, g_strstrip (kv[1]))) {
+      g_printerr ("Ignoring queue setting '%s' for %s.\n", *pair, GST_ELEMENT_NAME (queue));
+    } else {
+      gst_util_set_object_arg (G_OBJECT (queue), kv[0], kv[1]);
+      limits |= limit_of (pspec);
+    }
+    g_strfreev (kv);
+  }
+
+  /* 0 lifts one limit, lifting all three lets the queue grow without bound */
+  g_object_get (queue, "max-size-buffers", &new_buffers, "max-size-bytes", &new_bytes, "max-size-time", &new_time, NULL);
+  if (new_buffers == 0 && new_bytes == 0 && new_time == 0) {
+    g_printerr ("Ignoring the queue settings for %s, they leave it unbounded.\n", GST_ELEMENT_NAME (queue));
+    g_object_set (queue, "max-size-buffers", buffers, "max-size-bytes", bytes, "max-size-time", time, NULL);
+    return 0;
+  }
+  return limits;
+}
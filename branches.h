@@ -0,0 +1,34 @@
+#ifndef BRANCHES_H
+#define BRANCHES_H
+
+#include <gst/gst.h>
+
+#include "buffering.h"
+
+/* One [video] or [audio] group of the pipeline config file */
+typedef struct _BranchSpec {
+  gchar *elements;              /* gst-launch syntax between the queue and the sink, NULL for the built-in chain */
+  gchar **queue;                /* property=value pairs for the branch queue, NULL to keep its sizing */
+} BranchSpec;
+
+typedef struct _Branches {
+  gchar *path;
+  BranchSpec video;
+  BranchSpec audio;
+} Branches;
+
+/* NULL when the file is missing or unreadable, reported unless optional */
+Branches *branches_load (const gchar *path, gboolean optional);
+void branches_free (Branches *branches);
+
+/* Parse the elements into a bin, NULL when they do not parse, take other than
+ * media_caps or cannot feed the sink */
+GstElement *branches_make (const BranchSpec *spec, const gchar *media_caps, GstElement *sink);
+/* First element of the bin created by factory_name, not referenced */
+GstElement *branches_find (GstElement *bin, const gchar *factory_name);
+/* Apply the queue properties, invalid ones and negative sizes are reported and skipped,
+ * settings that leave the queue without any size limit are undone. Returns the size
+ * limits that were set */
+QueueLimits branches_configure_queue (const BranchSpec *spec, GstElement *queue);
+
+#endif
@@ -0,0 +1,229 @@
+#include <math.h>
+#include <stdatomic.h>
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/audio/audio.h>
+
+#include "buffering.h"
+#include "player.h"
+
+/* No resize faster than this, and shrink only after this long without underrun */
+#define RESIZE_HOLDOFF_US (2 * G_USEC_PER_SEC)
+#define SHRINK_QUIET_US (10 * G_USEC_PER_SEC)
+
+/* Queued duration per preset: starting point and adaptive ceiling */
+typedef struct _PresetLimits {
+  GstClockTime video_target;
+  GstClockTime audio_target;
+  GstClockTime max_target;
+} PresetLimits;
+
+static const PresetLimits preset_limits[] = {
+  [BUFFERING_DEFAULT] = { 0, 0, 0 },
+  [BUFFERING_AUTO] = { 1 * GST_SECOND, 1 * GST_SECOND, 4 * GST_SECOND },
+  [BUFFERING_LOW_LATENCY] = { 100 * GST_MSECOND, 60 * GST_MSECOND, 500 * GST_MSECOND },
+  [BUFFERING_HIGH_THROUGHPUT] = { 3 * GST_SECOND, 3 * GST_SECOND, 10 * GST_SECOND },
+};
+
+typedef struct _CapsUpdate {
+  QueuePolicy *policy;
+  guint64 unit_bytes;
+  gdouble frame_rate;
+} CapsUpdate;
+
+
+gboolean buffering_preset_from_string (const gchar *str, BufferingPreset *preset) {
+  if (g_strcmp0 (str, "default") == 0) {
+    *preset = BUFFERING_DEFAULT;
+  } else if (g_strcmp0 (str, "auto") == 0) {
+    *preset = BUFFERING_AUTO;
+  } else if (g_strcmp0 (str, "low-latency") == 0) {
+    *preset = BUFFERING_LOW_LATENCY;
+  } else if (g_strcmp0 (str, "high-throughput") == 0) {
+    *preset = BUFFERING_HIGH_THROUGHPUT;
+  } else {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Bound the queue by time, and by the bytes and buffers that time means for these caps.
+ * Limits from the pipeline config are kept as they are, only the memory cap lowers them */
+static void apply_limits (QueuePolicy *policy) {
+  gdouble seconds = policy->target / (gdouble) GST_SECOND;
+  GstClockTime time = policy->target;
+  guint buffers = 0;
+  guint64 bytes;
+
+  if (policy->unit_bytes == 0)
+    return;
+
+  if (policy->is_video) {
+    buffers = MAX ((guint) ceil (seconds * policy->frame_rate) + 1, 2);
+    bytes = buffers * policy->unit_bytes;
+  } else {
+    /* Audio buffer sizes vary, so only cap bytes with some headroom */
+    bytes = (guint64) (policy->unit_bytes * seconds * 1.25);
+  }
+  if (policy->kept & QUEUE_LIMIT_TIME)
+    time = policy->kept_time;
+  if (policy->kept & QUEUE_LIMIT_BUFFERS)
+    buffers = policy->kept_buffers;
+  if (policy->kept & QUEUE_LIMIT_BYTES)
+    bytes = policy->kept_bytes;
+  /* 0 bytes is no limit, the cap still applies */
+  if (policy->byte_cap > 0)
+    bytes = bytes > 0 ? MIN (bytes, policy->byte_cap) : policy->byte_cap;
+
+  g_object_set (policy->queue, "max-size-time", time, "max-size-buffers", buffers,
+      "max-size-bytes", (guint) MIN (bytes, G_MAXUINT), NULL);
+  g_print ("%s queue: %" GST_TIME_FORMAT ", %u buffers, %" G_GUINT64_FORMAT " KB\n", policy->name,
+      GST_TIME_ARGS (time), buffers, bytes / 1024);
+}
+
+static gboolean apply_caps_update (CapsUpdate *update) {
+  QueuePolicy *policy = update->policy;
+
+  policy->unit_bytes = update->unit_bytes;
+  policy->frame_rate = update->frame_rate;
+  apply_limits (policy);
+  return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn caps_probe_cb (GstPad *pad, GstPadProbeInfo *info, QueuePolicy *policy) {
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  CapsUpdate *update;
+  GstCaps *caps;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+
+  gst_event_parse_caps (event, &caps);
+  update = g_new0 (CapsUpdate, 1);
+  update->policy = policy;
+
+  if (policy->is_video) {
+    GstVideoInfo vinfo;
+    if (gst_video_info_from_caps (&vinfo, caps)) {
+      update->unit_bytes = GST_VIDEO_INFO_SIZE (&vinfo);
+      update->frame_rate = GST_VIDEO_INFO_FPS_N (&vinfo) > 0 ?
+          GST_VIDEO_INFO_FPS_N (&vinfo) / (gdouble) GST_VIDEO_INFO_FPS_D (&vinfo) : 30.0;
+    }
+  } else {
+    GstAudioInfo ainfo;
+    if (gst_audio_info_from_caps (&ainfo, caps))
+      update->unit_bytes = (guint64) GST_AUDIO_INFO_RATE (&ainfo) * GST_AUDIO_INFO_BPF (&ainfo);
+  }
+
+  if (update->unit_bytes == 0) {
+    g_free (update);
+    return GST_PAD_PROBE_OK;
+  }
+  control_invoke (policy->owner->data, (GSourceFunc) apply_caps_update, update, g_free);
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean handle_underrun (QueuePolicy *policy) {
+  gint64 now = g_get_monotonic_time ();
+
+  policy->last_underrun = now;
+  if (now - policy->last_resize < RESIZE_HOLDOFF_US || policy->target >= policy->max_target)
+    return G_SOURCE_REMOVE;
+
+  policy->target = MIN (policy->target * 3 / 2, policy->max_target);
+  policy->last_resize = now;
+  apply_limits (policy);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean handle_overrun (QueuePolicy *policy) {
+  gint64 now = g_get_monotonic_time ();
+
+  /* Full and never starving lately: hand back memory and latency */
+  if (policy->target <= policy->base_target || now - policy->last_underrun < SHRINK_QUIET_US ||
+      now - policy->last_resize < SHRINK_QUIET_US)
+    return G_SOURCE_REMOVE;
+
+  policy->target = MAX (policy->target * 4 / 5, policy->base_target);
+  policy->last_resize = now;
+  apply_limits (policy);
+  return G_SOURCE_REMOVE;
+}
+
+static void underrun_cb (GstElement *queue, QueuePolicy *policy) {
+  /* Draining at startup, EOS or while paused is not starvation */
+  if (!atomic_load (&policy->owner->data->playing))
+    return;
+  control_invoke (policy->owner->data, (GSourceFunc) handle_underrun, policy, NULL);
+}
+
+static void overrun_cb (GstElement *queue, QueuePolicy *policy) {
+  control_invoke (policy->owner->data, (GSourceFunc) handle_overrun, policy, NULL);
+}
+
+static void attach_queue (Buffering *buffering, QueuePolicy *policy, const gchar *name,
+    GstElement *queue, gboolean is_video) {
+  const PresetLimits *limits = &preset_limits[buffering->preset];
+  GstPad *pad;
+
+  policy->owner = buffering;
+  policy->name = name;
+  policy->queue = queue;
+  policy->is_video = is_video;
+  policy->base_target = is_video ? limits->video_target : limits->audio_target;
+  policy->target = policy->base_target;
+  policy->max_target = MAX (limits->max_target, policy->base_target);
+
+  pad = gst_element_get_static_pad (queue, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, (GstPadProbeCallback) caps_probe_cb, policy, NULL);
+  gst_object_unref (pad);
+
+  if (buffering->adaptive) {
+    g_signal_connect (queue, "underrun", G_CALLBACK (underrun_cb), policy);
+    g_signal_connect (queue, "overrun", G_CALLBACK (overrun_cb), policy);
+  }
+}
+
+Buffering *buffering_new (BufferingPreset preset, gboolean adaptive) {
+  Buffering *buffering = g_new0 (Buffering, 1);
+
+  buffering->preset = preset;
+  buffering->adaptive = adaptive;
+  return buffering;
+}
+
+void buffering_free (Buffering *buffering) {
+  g_free (buffering);
+}
+
+void buffering_attach (Buffering *buffering, CustomData *data) {
+  if (buffering->preset == BUFFERING_DEFAULT)
+    return;
+
+  buffering->data = data;
+  attach_queue (buffering, &buffering->video, "video", data->video_queue, TRUE);
+  attach_queue (buffering, &buffering->audio, "audio", data->audio_queue, FALSE);
+}
+
+void buffering_keep_limits (Buffering *buffering, GstElement *queue, QueueLimits limits) {
+  QueuePolicy *policy;
+
+  if (buffering == NULL || buffering->preset == BUFFERING_DEFAULT)
+    return;
+
+  policy = queue == buffering->video.queue ? &buffering->video : &buffering->audio;
+  policy->kept = limits;
+  g_object_get (queue, "max-size-time", &policy->kept_time, "max-size-buffers", &policy->kept_buffers,
+      "max-size-bytes", &policy->kept_bytes, NULL);
+}
+
+void buffering_cap_bytes (Buffering *buffering, guint64 video_bytes, guint64 audio_bytes) {
+  if (buffering == NULL || buffering->preset == BUFFERING_DEFAULT)
+    return;
+
+  buffering->video.byte_cap = video_bytes;
+  buffering->audio.byte_cap = audio_bytes;
+  apply_limits (&buffering->video);
+  apply_limits (&buffering->audio);
+}
@@ -0,0 +1,65 @@
+#ifndef BUFFERING_H
+#define BUFFERING_H
+
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+typedef enum {
+  BUFFERING_DEFAULT,            /* leave the queue element defaults alone */
+  BUFFERING_AUTO,
+  BUFFERING_LOW_LATENCY,
+  BUFFERING_HIGH_THROUGHPUT
+} BufferingPreset;
+
+typedef struct _Buffering Buffering;
+
+/* Queue limits set explicitly by the pipeline config, the preset leaves them alone */
+typedef enum {
+  QUEUE_LIMIT_TIME = 1 << 0,
+  QUEUE_LIMIT_BUFFERS = 1 << 1,
+  QUEUE_LIMIT_BYTES = 1 << 2
+} QueueLimits;
+
+/* Limits of one branch queue, only touched from the control thread */
+typedef struct _QueuePolicy {
+  Buffering *owner;
+  const gchar *name;
+  GstElement *queue;
+  gboolean is_video;
+  guint64 unit_bytes;           /* video: bytes per frame, audio: bytes per second */
+  gdouble frame_rate;
+  GstClockTime target;
+  GstClockTime base_target;
+  GstClockTime max_target;
+  gint64 last_underrun;
+  gint64 last_resize;
+  guint64 byte_cap;             /* 0 or a ceiling from the bounded memory mode */
+  QueueLimits kept;             /* explicit limits, applied instead of the computed ones */
+  GstClockTime kept_time;
+  guint kept_buffers;
+  guint kept_bytes;
+} QueuePolicy;
+
+struct _Buffering {
+  BufferingPreset preset;
+  gboolean adaptive;
+  CustomData *data;
+  QueuePolicy video;
+  QueuePolicy audio;
+};
+
+gboolean buffering_preset_from_string (const gchar *str, BufferingPreset *preset);
+
+Buffering *buffering_new (BufferingPreset preset, gboolean adaptive);
+void buffering_free (Buffering *buffering);
+
+/* Size audio_queue/video_queue from their negotiated caps, and when adaptive
+ * grow them on underruns and shrink them back after a quiet period */
+void buffering_attach (Buffering *buffering, CustomData *data);
+/* Keep the current values of these limits of the queue whenever it is resized */
+void buffering_keep_limits (Buffering *buffering, GstElement *queue, QueueLimits limits);
+/* Control thread: never size a queue above these bytes, 0 lifts the cap */
+void buffering_cap_bytes (Buffering *buffering, guint64 video_bytes, guint64 audio_bytes);
+
+#endif
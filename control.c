@@ -0,0 +1,417 @@
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+
+#include "player.h"
+#include "streaming.h"
+#include "seek.h"
+#include "playlist.h"
+#include "wall.h"
+#include "live.h"
+#include "tracks.h"
+#include "overload.h"
+#include "avsync.h"
+#include "memlimit.h"
+
+/* Position is only refreshed while PLAYING, at most this often */
+#define POSITION_REFRESH_MS 250
+
+typedef struct _CommandSource {
+  GSource source;
+  CustomData *data;
+} CommandSource;
+
+static void handle_message (CustomData *data, GstMessage *msg);
+
+
+void control_queue_init (ControlQueue *queue) {
+  atomic_init (&queue->head, 0);
+  atomic_init (&queue->tail, 0);
+}
+
+gboolean control_queue_push (ControlQueue *queue, const ControlCommand *cmd) {
+  guint tail = atomic_load_explicit (&queue->tail, memory_order_relaxed);
+  guint head = atomic_load_explicit (&queue->head, memory_order_acquire);
+
+  if (tail - head == CONTROL_QUEUE_SIZE)
+    return FALSE;
+
+  queue->slots[tail & (CONTROL_QUEUE_SIZE - 1)] = *cmd;
+  atomic_store_explicit (&queue->tail, tail + 1, memory_order_release);
+  return TRUE;
+}
+
+gboolean control_queue_pop (ControlQueue *queue, ControlCommand *cmd) {
+  guint head = atomic_load_explicit (&queue->head, memory_order_relaxed);
+  guint tail = atomic_load_explicit (&queue->tail, memory_order_acquire);
+
+  if (head == tail)
+    return FALSE;
+
+  *cmd = queue->slots[head & (CONTROL_QUEUE_SIZE - 1)];
+  atomic_store_explicit (&queue->head, head + 1, memory_order_release);
+  return TRUE;
+}
+
+gboolean control_queue_is_empty (ControlQueue *queue) {
+  return atomic_load_explicit (&queue->head, memory_order_relaxed) ==
+      atomic_load_explicit (&queue->tail, memory_order_acquire);
+}
+
+
+/* Ask the UI thread to leave gtk_main(), the UI never waits on the pipeline */
+static gboolean ui_quit (gpointer user_data) {
+  gtk_main_quit ();
+  return G_SOURCE_REMOVE;
+}
+
+static void request_terminate (CustomData *data) {
+  if (!atomic_exchange (&data->terminate, TRUE))
+    g_main_context_invoke (NULL, ui_quit, NULL);
+}
+
+static gboolean refresh_position (CustomData *data) {
+  gint64 current = -1;
+  gint64 duration = atomic_load (&data->duration);
+
+  if (!gst_element_query_position (data->pipeline, GST_FORMAT_TIME, &current)) {
+    g_printerr ("Could not query current position.\n");
+  }
+  atomic_store (&data->position, current);
+
+  if (!GST_CLOCK_TIME_IS_VALID (duration)) {
+    if (gst_element_query_duration (data->pipeline, GST_FORMAT_TIME, &duration)) {
+      atomic_store (&data->duration, duration);
+    } else {
+      g_printerr ("Could not query current duration.\n");
+    }
+  }
+
+  g_print ("Position %" GST_TIME_FORMAT " / %" GST_TIME_FORMAT "\r", GST_TIME_ARGS (current), GST_TIME_ARGS (duration));
+  streaming_report_ranges (data);
+  live_report (data->live);
+  avsync_tick (data->avsync, data->pipeline);
+  overload_tick (data->overload);
+  memlimit_tick (data->memlimit);
+  seek_publish_position (data, current, duration);
+  return G_SOURCE_CONTINUE;
+}
+
+/* Run the position timer only while PLAYING so an idle player does not wake up */
+static void update_position_timer (CustomData *data) {
+  gboolean playing = atomic_load (&data->playing);
+
+  if (playing && data->position_source == NULL) {
+    data->position_source = g_timeout_source_new (POSITION_REFRESH_MS);
+    g_source_set_callback (data->position_source, (GSourceFunc) refresh_position, data, NULL);
+    g_source_attach (data->position_source, data->control_context);
+  } else if (!playing && data->position_source != NULL) {
+    g_source_destroy (data->position_source);
+    g_source_unref (data->position_source);
+    data->position_source = NULL;
+  }
+}
+
+static void set_pipeline_state (CustomData *data, GstState state) {
+  GstStateChangeReturn ret;
+
+  data->target_state = state;
+  /* Resumed by streaming_handle_buffering() once the cache is refilled */
+  if (state == GST_STATE_PLAYING && data->buffering_paused)
+    return;
+
+  ret = gst_element_set_state (data->pipeline, state);
+  if (ret == GST_STATE_CHANGE_FAILURE) {
+    g_printerr ("Unable to set the pipeline to the %s state.\n", gst_element_state_get_name (state));
+    request_terminate (data);
+  } else if (ret == GST_STATE_CHANGE_NO_PREROLL) {
+    data->is_live = TRUE;
+  }
+}
+
+/* Let videoscale fixate to the largest size that fits the widget, keeping the aspect ratio */
+static void apply_widget_size (CustomData *data, gint width, gint height) {
+  GstCaps *caps;
+
+  if (data->vscale_filter == NULL || width <= 0 || height <= 0)
+    return;
+
+  caps = gst_caps_new_simple ("video/x-raw",
+      "width", GST_TYPE_INT_RANGE, 1, width,
+      "height", GST_TYPE_INT_RANGE, 1, height, NULL);
+  g_object_set (data->vscale_filter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+}
+
+static void handle_command (CustomData *data, const ControlCommand *cmd) {
+  switch (cmd->type) {
+    case CONTROL_CMD_PLAY:
+      set_pipeline_state (data, GST_STATE_PLAYING);
+      break;
+    case CONTROL_CMD_PAUSE:
+      set_pipeline_state (data, GST_STATE_PAUSED);
+      break;
+    case CONTROL_CMD_STOP:
+      set_pipeline_state (data, GST_STATE_READY);
+      break;
+    case CONTROL_CMD_RESIZE:
+      apply_widget_size (data, (gint) (cmd->arg >> 32), (gint) (cmd->arg & 0xffffffff));
+      break;
+    case CONTROL_CMD_SCRUB:
+      seek_request (data, cmd->arg, FALSE);
+      break;
+    case CONTROL_CMD_SEEK:
+      seek_request (data, cmd->arg, TRUE);
+      break;
+    case CONTROL_CMD_SELECT_AUDIO:
+      wall_select_audio (data->wall, (gint) cmd->arg);
+      break;
+    case CONTROL_CMD_NEXT_AUDIO_TRACK:
+      tracks_next_audio (data->tracks, data);
+      break;
+    case CONTROL_CMD_AV_OFFSET:
+      avsync_set_offset (data->avsync, cmd->arg);
+      break;
+    case CONTROL_CMD_QUIT:
+      g_main_loop_quit (data->control_loop);
+      break;
+  }
+}
+
+
+static gboolean command_source_prepare (GSource *source, gint *timeout) {
+  *timeout = -1;
+  return !control_queue_is_empty (&((CommandSource *) source)->data->commands);
+}
+
+static gboolean command_source_check (GSource *source) {
+  return !control_queue_is_empty (&((CommandSource *) source)->data->commands);
+}
+
+static gboolean command_source_dispatch (GSource *source, GSourceFunc callback, gpointer user_data) {
+  CustomData *data = ((CommandSource *) source)->data;
+  ControlCommand cmd;
+
+  while (control_queue_pop (&data->commands, &cmd)) {
+    handle_command (data, &cmd);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs command_source_funcs = {
+  command_source_prepare,
+  command_source_check,
+  command_source_dispatch,
+  NULL
+};
+
+
+static gboolean bus_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+  handle_message (data, msg);
+  return G_SOURCE_CONTINUE;
+}
+
+static gpointer control_thread_func (CustomData *data) {
+  g_main_context_push_thread_default (data->control_context);
+  g_main_loop_run (data->control_loop);
+  metrics_set_running (data->metrics, data->control_context, FALSE);
+  if (data->position_source != NULL) {
+    g_source_destroy (data->position_source);
+    g_source_unref (data->position_source);
+    data->position_source = NULL;
+  }
+  g_main_context_pop_thread_default (data->control_context);
+  return NULL;
+}
+
+gboolean control_start (CustomData *data) {
+  GstBus *bus;
+
+  control_queue_init (&data->commands);
+  atomic_init (&data->state, GST_STATE_NULL);
+  atomic_init (&data->playing, FALSE);
+  atomic_init (&data->terminate, FALSE);
+  atomic_init (&data->position, -1);
+  data->seek_enabled = FALSE;
+  data->position_source = NULL;
+  data->target_state = GST_STATE_NULL;
+  data->buffering_paused = FALSE;
+
+  data->control_context = g_main_context_new ();
+  data->control_loop = g_main_loop_new (data->control_context, FALSE);
+
+  /* Bus messages are handled on the control thread as soon as they are posted */
+  bus = gst_element_get_bus (data->pipeline);
+  data->bus_source = gst_bus_create_watch (bus);
+  g_source_set_callback (data->bus_source, (GSourceFunc) bus_cb, data, NULL);
+  g_source_attach (data->bus_source, data->control_context);
+  gst_object_unref (bus);
+
+  data->command_source = g_source_new (&command_source_funcs, sizeof (CommandSource));
+  ((CommandSource *) data->command_source)->data = data;
+  g_source_attach (data->command_source, data->control_context);
+
+  data->control_thread = g_thread_try_new ("pipeline-control", (GThreadFunc) control_thread_func, data, NULL);
+  if (data->control_thread == NULL) {
+    g_printerr ("Could not start the pipeline control thread.\n");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void control_send (CustomData *data, ControlCommandType type, gint64 arg) {
+  ControlCommand cmd = { type, arg };
+
+  if (!control_queue_push (&data->commands, &cmd)) {
+    g_printerr ("Control queue full, dropping command %d.\n", type);
+    return;
+  }
+  g_main_context_wakeup (data->control_context);
+}
+
+void control_invoke (CustomData *data, GSourceFunc func, gpointer user_data, GDestroyNotify notify) {
+  g_mutex_lock (&data->invoke_lock);
+  if (data->control_stopped) {
+    g_mutex_unlock (&data->invoke_lock);
+    if (notify != NULL)
+      notify (user_data);
+    return;
+  }
+  g_main_context_invoke_full (data->control_context, G_PRIORITY_DEFAULT, func, user_data, notify);
+  g_mutex_unlock (&data->invoke_lock);
+}
+
+void control_stop (CustomData *data) {
+  if (data->control_thread == NULL)
+    return;
+
+  /* The streaming threads outlive the control thread until the pipeline is shut
+   * down, from here on nothing they do may reach the control context */
+  g_mutex_lock (&data->invoke_lock);
+  data->control_stopped = TRUE;
+  g_mutex_unlock (&data->invoke_lock);
+
+  control_send (data, CONTROL_CMD_QUIT, 0);
+  g_thread_join (data->control_thread);
+  data->control_thread = NULL;
+  atomic_store (&data->playing, FALSE);
+  atomic_store (&data->terminate, TRUE);
+
+  g_source_destroy (data->bus_source);
+  g_source_unref (data->bus_source);
+  data->bus_source = NULL;
+  g_source_destroy (data->command_source);
+  g_source_unref (data->command_source);
+  data->command_source = NULL;
+  g_main_loop_unref (data->control_loop);
+  data->control_loop = NULL;
+  g_main_context_unref (data->control_context);
+  data->control_context = NULL;
+  g_free (data->buffered_ranges);
+  data->buffered_ranges = NULL;
+}
+
+
+static gboolean is_decodebin3 (GstObject *object) {
+  GstElementFactory *factory = GST_IS_ELEMENT (object) ? gst_element_get_factory (GST_ELEMENT (object)) : NULL;
+
+  return factory != NULL && g_strcmp0 (GST_OBJECT_NAME (factory), "decodebin3") == 0;
+}
+
+static void handle_message (CustomData *data, GstMessage *msg) {
+  GError *err;
+  gchar *debug_info;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_ERROR:
+      gst_message_parse_error (msg, &err, &debug_info);
+      g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+      g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+      g_clear_error (&err);
+      g_free (debug_info);
+      request_terminate (data);
+      break;
+    case GST_MESSAGE_EOS:
+      g_print ("\nEnd-Of-Stream reached.\n");
+      request_terminate (data);
+      break;
+    case GST_MESSAGE_ASYNC_DONE: {
+      gint64 current = -1;
+      startup_mark (data->startup, STARTUP_PHASE_PREROLL);
+      seek_handle_async_done (data);
+      if (gst_element_query_position (data->pipeline, GST_FORMAT_TIME, &current))
+        seek_publish_position (data, current, atomic_load (&data->duration));
+    } break;
+    case GST_MESSAGE_BUFFERING:
+      streaming_handle_buffering (data, msg);
+      break;
+    case GST_MESSAGE_QOS:
+      metrics_handle_qos (data->metrics, msg);
+      wall_handle_qos (data->wall, msg);
+      overload_handle_qos (data->overload, msg);
+      break;
+    case GST_MESSAGE_STREAM_COLLECTION:
+      /* urisourcebin and parsebin post their own partial collections, decodebin3 the merged one */
+      if (data->tracks != NULL && is_decodebin3 (GST_MESSAGE_SRC (msg)))
+        tracks_handle_collection (data->tracks, data, msg);
+      break;
+    case GST_MESSAGE_STREAMS_SELECTED:
+      /* decodebin3 posts it once every selected stream has its pad, uridecodebin3 has no
+       * no-more-pads for the startup trace to wait for */
+      startup_mark (data->startup, STARTUP_PHASE_PADS);
+      if (data->tracks != NULL)
+        tracks_handle_selected (msg);
+      break;
+    case GST_MESSAGE_LATENCY:
+      /* A live element changed its latency, redistribute it to the sinks */
+      gst_bin_recalculate_latency (GST_BIN (data->pipeline));
+      live_update_latency (data->live, data->pipeline);
+      avsync_update_latency (data->avsync, data->pipeline);
+      break;
+    case GST_MESSAGE_DURATION_CHANGED:
+      atomic_store (&data->duration, GST_CLOCK_TIME_NONE);
+      break;
+    case GST_MESSAGE_STATE_CHANGED: {
+      GstState old_state, new_state, pending_state;
+      gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
+      if (GST_MESSAGE_SRC (msg) == GST_OBJECT (data->pipeline)) {
+        g_print ("Pipeline state changed from %s to %s:\n",
+            gst_element_state_get_name (old_state), gst_element_state_get_name (new_state));
+
+        atomic_store (&data->state, new_state);
+        atomic_store (&data->playing, new_state == GST_STATE_PLAYING);
+        update_position_timer (data);
+        metrics_set_running (data->metrics, data->control_context, new_state == GST_STATE_PLAYING);
+
+        if (new_state == GST_STATE_PLAYING) {
+          startup_mark (data->startup, STARTUP_PHASE_PLAYING);
+          startup_report (data->startup);
+          live_update_latency (data->live, data->pipeline);
+          avsync_update_latency (data->avsync, data->pipeline);
+          /* Preroll the next item only once the current one runs */
+          if (data->playlist != NULL)
+            playlist_prepare_next (data->playlist);
+
+          GstQuery *query;
+          gint64 start, end;
+          query = gst_query_new_seeking (GST_FORMAT_TIME);
+          if (gst_element_query (data->pipeline, query)) {
+            gst_query_parse_seeking (query, NULL, &data->seek_enabled, &start, &end);
+            if (data->seek_enabled) {
+              g_print ("Seeking is ENABLED from %" GST_TIME_FORMAT " to %" GST_TIME_FORMAT "\n",
+                  GST_TIME_ARGS (start), GST_TIME_ARGS (end));
+            } else {
+              g_print ("Seeking is DISABLED for this stream.\n");
+            }
+          }
+          else {
+            g_printerr ("Seeking query failed.");
+          }
+          gst_query_unref (query);
+        }
+      }
+    } break;
+    default:
+      /* The watch sees every message posted on the bus, ignore the rest */
+      break;
+  }
+}
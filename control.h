@@ -0,0 +1,53 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdatomic.h>
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+/* Commands sent from the UI thread to the pipeline control thread */
+typedef enum {
+  CONTROL_CMD_PLAY,
+  CONTROL_CMD_PAUSE,
+  CONTROL_CMD_STOP,
+  CONTROL_CMD_RESIZE,     /* arg: width << 32 | height in device pixels */
+  CONTROL_CMD_SCRUB,      /* arg: position in ns, keyframe seek while dragging */
+  CONTROL_CMD_SEEK,       /* arg: position in ns, accurate seek */
+  CONTROL_CMD_SELECT_AUDIO, /* arg: video wall tile to hear, -1 to mix all */
+  CONTROL_CMD_NEXT_AUDIO_TRACK,
+  CONTROL_CMD_AV_OFFSET,  /* arg: ns, > 0 delays audio, < 0 delays video */
+  CONTROL_CMD_QUIT
+} ControlCommandType;
+
+typedef struct _ControlCommand {
+  ControlCommandType type;
+  gint64 arg;
+} ControlCommand;
+
+/* Must be a power of two */
+#define CONTROL_QUEUE_SIZE 64
+
+/* Lock-free single producer (UI thread) / single consumer (control thread) ring */
+typedef struct _ControlQueue {
+  ControlCommand slots[CONTROL_QUEUE_SIZE];
+  atomic_uint head;
+  atomic_uint tail;
+} ControlQueue;
+
+void control_queue_init (ControlQueue *queue);
+gboolean control_queue_push (ControlQueue *queue, const ControlCommand *cmd);
+gboolean control_queue_pop (ControlQueue *queue, ControlCommand *cmd);
+gboolean control_queue_is_empty (ControlQueue *queue);
+
+/* Start the thread that owns the pipeline state and its bus */
+gboolean control_start (CustomData *data);
+/* Queue a command for the control thread, callable from the UI thread only */
+void control_send (CustomData *data, ControlCommandType type, gint64 arg);
+/* Run func on the control thread (the default context in headless modes), callable
+ * from any thread. Dropped, with notify called, once control_stop() has begun */
+void control_invoke (CustomData *data, GSourceFunc func, gpointer user_data, GDestroyNotify notify);
+/* Ask the control thread to quit and wait for it */
+void control_stop (CustomData *data);
+
+#endif
@@ -1,49 +1,175 @@
-#include <string.h>
-#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
 
 #include <gtk/gtk.h>
 #include <gst/gst.h>
 #include <gdk/gdk.h>
+#include <glib-unix.h>
+
+#include "player.h"
+#include "hwaccel.h"
+#include "pipeline.h"
+#include "benchmark.h"
+#include "streaming.h"
+#include "probecache.h"
+#include "thumbnails.h"
+#include "mmapsrc.h"
+#include "tracing.h"
+
+#ifdef HWACC_ENABLED
+#define HWACCEL_DEFAULT "auto"
+#else
+#define HWACCEL_DEFAULT "off"
+#endif
+
+/* Keyboard A/V correction step */
+#define AV_OFFSET_STEP (10 * GST_MSECOND)
+
+static gchar *hwaccel_option = NULL;
+static gboolean hwaccel_probe = FALSE;
+static gint convert_threads = 0;
+static gboolean scale_to_widget = FALSE;
+static gboolean stats_overlay = FALSE;
+static gchar *stats_json = NULL;
+static gint stats_interval = 1000;
+static gboolean benchmark = FALSE;
+static gchar *buffering_option = NULL;
+static gboolean adaptive_buffering = FALSE;
+static gboolean stream_option = FALSE;
+static gint cache_size_mb = 256;
+static gchar *cache_dir = NULL;
+static gboolean loop_playlist = FALSE;
+static gboolean fast_start = FALSE;
+static gboolean startup_trace = FALSE;
+static gboolean wall_mode = FALSE;
+static gchar *wall_size = NULL;
+static gchar *wall_audio = NULL;
+static gboolean thumbnails = FALSE;
+static gint thumbnail_count = 16;
+static gint thumbnail_width = 160;
+static gint thumbnail_jobs = 0;
+static gchar *thumbnail_dir = NULL;
+static gboolean live_option = FALSE;
+static gint live_latency = 50;
+static gchar *resample_method = NULL;
+static gint resample_quality = -1;
+static gboolean audio_passthrough = FALSE;
+static gint audio_track = 0;
+static gboolean legacy_decodebin = FALSE;
+static gchar *overload_option = NULL;
+static gchar *record_path = NULL;
+static gboolean record_remux = FALSE;
+static gchar *pipeline_config = NULL;
+static gboolean av_sync = FALSE;
+static gint av_offset = 0;
+static gboolean mmap_input = FALSE;
+static gchar *trace_path = NULL;
+static gint trace_events = 1 << 20;
+static gchar *export_frames = NULL;
+static gint export_slots = 4;
+static gboolean vsync_pacing = FALSE;
+static gint memory_limit = 0;
+static gint queue_memory = 64;
+static gint soak_seconds = 0;
+static gint soak_tolerance = 16;
+
+static GOptionEntry entries[] = {
+  { "hwaccel", 0, 0, G_OPTION_ARG_STRING, &hwaccel_option, "Hardware decoding: off, auto or on (default " HWACCEL_DEFAULT ")", "MODE" },
+  { "hwaccel-probe", 0, 0, G_OPTION_ARG_NONE, &hwaccel_probe, "Print the selected video path and exit, no display needed", NULL },
+  { "convert-threads", 0, 0, G_OPTION_ARG_INT, &convert_threads, "Threads for software conversion and scaling (default: one per core)", "N" },
+  { "scale-to-widget", 0, 0, G_OPTION_ARG_NONE, &scale_to_widget, "Downscale frames to the video widget size before conversion", NULL },
+  { "stats", 0, 0, G_OPTION_ARG_NONE, &stats_overlay, "Show playback statistics over the video", NULL },
+  { "stats-json", 0, 0, G_OPTION_ARG_FILENAME, &stats_json, "Append playback statistics as JSON lines to FILE (- for stdout)", "FILE" },
+  { "stats-interval", 0, 0, G_OPTION_ARG_INT, &stats_interval, "Statistics sampling period in milliseconds (default 1000)", "MS" },
+  { "pipeline-config", 0, 0, G_OPTION_ARG_FILENAME, &pipeline_config, "Audio and video branch elements and queue settings (default ~/.config/open-pipe/pipeline.ini)", "FILE" },
+  { "buffering", 0, 0, G_OPTION_ARG_STRING, &buffering_option, "Queue sizing: default, auto, low-latency or high-throughput (default auto)", "PRESET" },
+  { "adaptive-buffering", 0, 0, G_OPTION_ARG_NONE, &adaptive_buffering, "Grow queues on underruns and shrink them back when idle", NULL },
+  { "memory-limit", 0, 0, G_OPTION_ARG_INT, &memory_limit, "Keep the resident memory under MB: bounded frame pools, capped queues that shrink near the limit", "MB" },
+  { "queue-memory", 0, 0, G_OPTION_ARG_INT, &queue_memory, "Megabytes both queues may hold together with --memory-limit (default 64)", "MB" },
+  { "mmap", 0, 0, G_OPTION_ARG_NONE, &mmap_input, "Read local files through mmap without copying them into buffers", NULL },
+  { "stream", 0, 0, G_OPTION_ARG_NONE, &stream_option, "Use the download cache even for local URIs (always on for network URIs)", NULL },
+  { "cache-size", 0, 0, G_OPTION_ARG_INT, &cache_size_mb, "Size of the streaming ring buffer cache in MB (default 256)", "MB" },
+  { "cache-dir", 0, 0, G_OPTION_ARG_FILENAME, &cache_dir, "Directory for the streaming cache file (default: system temp dir)", "DIR" },
+  { "loop", 0, 0, G_OPTION_ARG_NONE, &loop_playlist, "Start over with the first item after the last one", NULL },
+  { "fast-start", 0, 0, G_OPTION_ARG_NONE, &fast_start, "Preroll while the window is built and reuse the probe results of known files", NULL },
+  { "startup-trace", 0, 0, G_OPTION_ARG_NONE, &startup_trace, "Print how long each startup phase took until the first frame", NULL },
+  { "wall", 0, 0, G_OPTION_ARG_NONE, &wall_mode, "Decode all FILEs at once, tiled into one video", NULL },
+  { "wall-size", 0, 0, G_OPTION_ARG_STRING, &wall_size, "Size of the tiled video (default 1920x1080)", "WxH" },
+  { "wall-audio", 0, 0, G_OPTION_ARG_STRING, &wall_audio, "Wall audio: mix or the index of the tile to hear (default mix), click a tile to switch", "TILE" },
+  { "av-sync", 0, 0, G_OPTION_ARG_NONE, &av_sync, "Report the A/V offset, its drift and its likely cause; + and - shift audio by 10 ms, 0 resets", NULL },
+  { "av-offset", 0, 0, G_OPTION_ARG_INT, &av_offset, "Render audio this many milliseconds later (negative: video later)", "MS" },
+  { "resample-method", 0, 0, G_OPTION_ARG_STRING, &resample_method, "Resampler: nearest, linear, cubic, blackman-nuttall or kaiser", "METHOD" },
+  { "resample-quality", 0, 0, G_OPTION_ARG_INT, &resample_quality, "Resampler quality from 0 (fastest) to 10 (best), default 4", "Q" },
+  { "audio-passthrough", 0, 0, G_OPTION_ARG_NONE, &audio_passthrough, "Send AC3, E-AC3 and DTS undecoded to sinks that support it", NULL },
+  { "audio-track", 0, 0, G_OPTION_ARG_INT, &audio_track, "Audio track to play, -1 for none (default 0), the Audio track button cycles them", "N" },
+  { "legacy-decodebin", 0, 0, G_OPTION_ARG_NONE, &legacy_decodebin, "Decode every stream with uridecodebin instead of selecting tracks with uridecodebin3", NULL },
+  { "overload", 0, 0, G_OPTION_ARG_STRING, &overload_option, "Skip video decoding work when frames are dropped: auto or off (default auto)", "MODE" },
+  { "record", 0, 0, G_OPTION_ARG_FILENAME, &record_path, "Also write the played streams to FILE (Matroska), dropping data rather than stalling playback", "FILE" },
+  { "record-remux", 0, 0, G_OPTION_ARG_NONE, &record_remux, "Record the source codecs as they are instead of re-encoding where Matroska takes them", NULL },
+  { "live", 0, 0, G_OPTION_ARG_NONE, &live_option, "Low-latency live playback (always on for rtsp, rtp, udp and srt URIs)", NULL },
+  { "live-latency", 0, 0, G_OPTION_ARG_INT, &live_latency, "Jitterbuffer and queue latency in live mode, in milliseconds (default 50)", "MS" },
+  { "thumbnails", 0, 0, G_OPTION_ARG_NONE, &thumbnails, "Write a sprite sheet and a timestamp index for every FILE, no display needed", NULL },
+  { "thumbnail-count", 0, 0, G_OPTION_ARG_INT, &thumbnail_count, "Thumbnails per file (default 16)", "N" },
+  { "thumbnail-width", 0, 0, G_OPTION_ARG_INT, &thumbnail_width, "Thumbnail width in pixels (default 160)", "W" },
+  { "thumbnail-jobs", 0, 0, G_OPTION_ARG_INT, &thumbnail_jobs, "Files processed in parallel (default: one per core)", "N" },
+  { "thumbnail-dir", 0, 0, G_OPTION_ARG_FILENAME, &thumbnail_dir, "Directory for the sprite sheets (default: current directory)", "DIR" },
+  { "vsync", 0, 0, G_OPTION_ARG_NONE, &vsync_pacing, "Pace video frames to the display refresh, skipping frames that would never be shown", NULL },
+  { "export-frames", 0, 0, G_OPTION_ARG_STRING, &export_frames, "Publish decoded frames in the shared memory ring NAME for other processes, see frameshm.h", "NAME" },
+  { "export-slots", 0, 0, G_OPTION_ARG_INT, &export_slots, "Frames kept in the export ring (default 4)", "N" },
+  { "trace", 0, 0, G_OPTION_ARG_FILENAME, &trace_path, "Record element processing times and branch latencies, written to FILE as Chrome trace JSON on exit or SIGUSR1", "FILE" },
+  { "trace-events", 0, 0, G_OPTION_ARG_INT, &trace_events, "Events kept by --trace, the oldest are overwritten (default 1048576)", "N" },
+  { "benchmark", 0, 0, G_OPTION_ARG_NONE, &benchmark, "Decode FILE as fast as possible without a window and print throughput as JSON", NULL },
+  { "soak", 0, 0, G_OPTION_ARG_INT, &soak_seconds, "Benchmark FILE in a loop for SECONDS and fail if the memory use keeps growing", "SECONDS" },
+  { "soak-tolerance", 0, 0, G_OPTION_ARG_INT, &soak_tolerance, "RSS growth allowed over a --soak run (default 16)", "MB" },
+  { NULL }
+};
 
-typedef struct _CustomData {
-  GstElement *pipeline;
-  GstElement *source;
-  GstElement *aconvert;
-  GstElement *vconvert;
-  GstElement *resample;
-  GstElement *audio_queue;
-  GstElement *video_queue;
-  GstElement *asink;
-  GstElement *vsink;
-  GstElement *videosink;
-  GstElement *gtkglsink;
-  gboolean playing;      
-  gboolean terminate;    
-  gboolean seek_enabled; 
-  gboolean seek_done;    
-  gint64 duration;
-  GtkWidget *sink_widget;       
-} CustomData;
-
-static void handle_message (CustomData *data, GstMessage *msg);
-static void pad_added_handler (GstElement *src, GstPad *pad, CustomData *data);
+static void widget_size_allocate_cb (GtkWidget *widget, GdkRectangle *allocation, CustomData *data);
 
 static void play_cb (GtkButton *button, CustomData *data) {
-  gst_element_set_state (data->pipeline, GST_STATE_PLAYING);
+  control_send (data, CONTROL_CMD_PLAY, 0);
 }
 
 static void pause_cb (GtkButton *button, CustomData *data) {
-  gst_element_set_state (data->pipeline, GST_STATE_PAUSED);
+  control_send (data, CONTROL_CMD_PAUSE, 0);
 }
 
 static void stop_cb (GtkButton *button, CustomData *data) {
-  gst_element_set_state (data->pipeline, GST_STATE_READY);
+  control_send (data, CONTROL_CMD_STOP, 0);
+}
+
+static void audio_track_cb (GtkButton *button, CustomData *data) {
+  control_send (data, CONTROL_CMD_NEXT_AUDIO_TRACK, 0);
+}
+
+/* UI thread: the control thread applies the new offset to the sinks */
+static gboolean key_press_cb (GtkWidget *widget, GdkEventKey *event, CustomData *data) {
+  switch (event->keyval) {
+    case GDK_KEY_plus:
+    case GDK_KEY_equal:
+    case GDK_KEY_KP_Add:
+      data->avsync->ui_offset += AV_OFFSET_STEP;
+      break;
+    case GDK_KEY_minus:
+    case GDK_KEY_KP_Subtract:
+      data->avsync->ui_offset -= AV_OFFSET_STEP;
+      break;
+    case GDK_KEY_0:
+    case GDK_KEY_KP_0:
+      data->avsync->ui_offset = 0;
+      break;
+    default:
+      return FALSE;
+  }
+  control_send (data, CONTROL_CMD_AV_OFFSET, data->avsync->ui_offset);
+  return TRUE;
 }
 
 void create_ui(CustomData *data){
     GtkWidget *window;
     GtkWidget *main_view;
+    GtkWidget *player_view;
     GtkWidget *buttons;
     GtkWidget *play_button, *pause_button, *stop_button;
 
@@ -60,9 +186,20 @@ void create_ui(CustomData *data){
     gtk_box_pack_start(GTK_BOX(buttons), stop_button, TRUE, TRUE, 0);
     g_signal_connect (G_OBJECT (stop_button), "clicked", G_CALLBACK (stop_cb), data);
 
+    if (data->tracks != NULL) {
+      GtkWidget *track_button = gtk_button_new_with_label("Audio track");
+      gtk_box_pack_start(GTK_BOX(buttons), track_button, TRUE, TRUE, 0);
+      g_signal_connect (G_OBJECT (track_button), "clicked", G_CALLBACK (audio_track_cb), data);
+    }
+
+
+    if (data->vscale_filter != NULL)
+      g_signal_connect (G_OBJECT (data->sink_widget), "size-allocate", G_CALLBACK (widget_size_allocate_cb), data);
+    wall_connect_widget (data);
+    pacing_connect_widget (data->pacing, data->sink_widget);
 
     main_view = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
-    gtk_box_pack_start(GTK_BOX (main_view), data->sink_widget, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX (main_view), metrics_create_overlay (data->metrics, data->sink_widget), TRUE, TRUE, 0);
     gtk_box_pack_start (GTK_BOX (main_view), buttons, TRUE, TRUE, 0);
 
 
@@ -70,252 +207,322 @@ void create_ui(CustomData *data){
     gtk_window_set_title(GTK_WINDOW(window), "Open pipe media player");
     
     g_signal_connect(window, "destroy", G_CALLBACK(gtk_main_quit), NULL);
+    if (data->avsync != NULL)
+      g_signal_connect (G_OBJECT (window), "key-press-event", G_CALLBACK (key_press_cb), data);
 
-    gtk_container_add(GTK_CONTAINER(window), main_view);
+    player_view = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+    gtk_box_pack_start(GTK_BOX (player_view), main_view, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX (player_view), seek_create_bar (data), FALSE, FALSE, 0);
+
+    gtk_container_add(GTK_CONTAINER(window), player_view);
     gtk_window_set_default_size(GTK_WINDOW(window), 800, 600);
     gtk_widget_show_all(window);
 };
 
-void* gtk_main_loop(void* data) {
-  CustomData* cstd = (CustomData*)data;
-  gtk_main();
-  cstd->terminate = TRUE;
+/* kill -USR1 writes the trace so far, recording goes on */
+static gboolean dump_trace_cb (Tracing *tracing) {
+  tracing_dump (tracing);
+  return G_SOURCE_CONTINUE;
+}
+
+/* Accept URIs as they are and turn anything else into a file URI, NULL if it cannot be */
+static gchar *uri_from_arg (const char *arg) {
+  GError *error = NULL;
+  gchar *uri;
+
+  if (gst_uri_is_valid (arg))
+    return g_strdup (arg);
+
+  /* Makes relative paths absolute and escapes what needs it */
+  uri = gst_filename_to_uri (arg, &error);
+  if (uri == NULL) {
+    g_printerr ("Invalid file name '%s': %s\n", arg, error->message);
+    g_clear_error (&error);
+  }
+  return uri;
 }
 
 int main(int argc, char *argv[]) {
-  CustomData data;
-  GstBus *bus;
-  GstMessage *msg;
-  GstStateChangeReturn ret;
-  data.terminate = FALSE;
+  gint64 start_time = g_get_monotonic_time ();
+  CustomData data = { 0 };
+  GOptionContext *context;
+  ProbeCache *probe_cache = NULL;
+  Branches *branches;
+  Tracing *tracing = NULL;
+  GError *error = NULL;
+  HwAccelMode hwaccel_mode;
+  gboolean accelerated;
+  PipelineConfig config;
+  const gchar *uri;
+  gchar **uris;
+  gint n_uris, i;
+
+  context = g_option_context_new ("[FILE...] - Open pipe media player");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  g_option_context_add_group (context, gtk_get_option_group (FALSE));
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_clear_error (&error);
+    return -1;
+  }
+  g_option_context_free (context);
 
-  gtk_init(&argc, &argv);
-  gst_init (&argc, &argv);
-
-  data.seek_done = TRUE;
-  data.source = gst_element_factory_make ("uridecodebin", "source");
-  data.aconvert = gst_element_factory_make ("audioconvert", "audio-convert");
-  data.resample = gst_element_factory_make ("audioresample", "resample");
-  data.audio_queue = gst_element_factory_make("queue", "audio_queue");
-  data.video_queue = gst_element_factory_make("queue", "video_queue");
-  data.asink = gst_element_factory_make ("autoaudiosink", "audio-sink");
-  data.vconvert = gst_element_factory_make ("videoconvert", "video-convert");
-  data.videosink = gst_element_factory_make ("glsinkbin", "glsinkbin");
-  data.gtkglsink = gst_element_factory_make ("gtkglsink", "gtkglsink");
-  
-  data.pipeline = gst_pipeline_new ("open-audio-video-pipeline");
-  
-  if (!data.pipeline || !data.videosink || !data.source || !data.aconvert || !data.audio_queue || !data.video_queue || !data.vconvert || !data.resample || !data.asink || !data.gtkglsink){
-    g_printerr ("Not all elements could be created.\n");
+  if (startup_trace) {
+    data.startup = startup_trace_new (start_time);
+    data.startup->fast_start = fast_start;
+  }
+  startup_mark (data.startup, STARTUP_PHASE_OPTIONS);
+
+  if (!hwaccel_mode_from_string (hwaccel_option ? hwaccel_option : HWACCEL_DEFAULT, &hwaccel_mode)) {
+    g_printerr ("Unknown hwaccel mode '%s'.\n", hwaccel_option);
     return -1;
   }
-  
-  /* Select the source */
-  if(argc > 1){
-    size_t length = strlen(argv[1]);
-    char *copy = malloc(7+length + 1);
-    strcpy(copy, "file://");
-    strcat(copy, argv[1]);
-    g_object_set (data.source, "uri", copy, NULL);
-  }else{
-    g_object_set (data.source, "uri", "http://commondatastorage.googleapis.com/gtv-videos-bucket/sample/BigBuckBunny.mp4", NULL);
+
+  /* Decide the decoding path before touching the display */
+  accelerated = hwaccel_setup (hwaccel_mode);
+  startup_mark (data.startup, STARTUP_PHASE_HWACCEL);
+  if (hwaccel_probe) {
+    g_print ("Video path: %s\n", accelerated ? "hardware (dmabuf/GL)" : "software");
+    return 0;
   }
 
+  /* Every uridecodebin, including the thumbnail and benchmark ones, then maps file:// URIs */
+  if (mmap_input && !mmap_src_register ())
+    g_printerr ("Could not register the mmap source, files are read as usual.\n");
+
+  config.accelerated = accelerated;
+  config.convert_threads = convert_threads > 0 ? convert_threads : g_get_num_processors ();
+  config.scale_to_widget = scale_to_widget;
+  benchmark |= soak_seconds > 0;
+  config.headless = benchmark;
+  config.adaptive_buffering = adaptive_buffering;
+  config.audio.resample_method = resample_method;
+  config.audio.resample_quality = resample_quality;
+  config.audio.passthrough = audio_passthrough;
+  config.legacy_decodebin = legacy_decodebin;
+  config.record_path = record_path;
+  config.record_remux = record_remux;
+  config.memory_limit_mb = MAX (memory_limit, 0);
+  config.queue_memory_mb = MAX (queue_memory, 1);
+
+  if (!buffering_preset_from_string (buffering_option ? buffering_option : "auto", &config.buffering)) {
+    g_printerr ("Unknown buffering preset '%s'.\n", buffering_option);
+    return -1;
+  }
+  if (overload_option != NULL && g_strcmp0 (overload_option, "auto") != 0 && g_strcmp0 (overload_option, "off") != 0) {
+    g_printerr ("Unknown overload mode '%s'.\n", overload_option);
+    return -1;
+  }
 
-  /* Set gtk widget as sink video */
-  #ifdef HWACC_ENABLED
-    if (data.gtkglsink != NULL && data.videosink != NULL) {
-      g_printerr ("Successfully created GTK GL Sink \n");
-      g_object_set (data.videosink, "sink", data.gtkglsink, NULL);
-      g_object_get (data.gtkglsink, "widget", &data.sink_widget, NULL);
-    }else{
-      return -1;
+  /* Select the sources, every positional argument is a playlist item or a wall tile */
+  n_uris = MAX (argc - 1, 1);
+  uris = g_new0 (gchar *, n_uris + 1);
+  if (argc > 1) {
+    for (i = 1; i < argc; i++) {
+      uris[i - 1] = uri_from_arg (argv[i]);
+      if (uris[i - 1] == NULL)
+        return -1;
     }
-  #else
-      g_printerr ("Could not create gtkglsink, falling back to gtksink.\n");
-      data.videosink = gst_element_factory_make ("gtksink", "gtksink");
-      g_object_get (data.videosink, "widget", &data.sink_widget, NULL);
-  #endif 
-
-
-  /* Add gst-elements to BIN */
-  gst_bin_add_many (GST_BIN (data.pipeline), data.source, data.audio_queue, data.video_queue, data.aconvert, data.resample, data.asink, data.vconvert, data.videosink, NULL);
-  
-  /* Link separate audio pipeline branch */
-  if (!gst_element_link_many (data.audio_queue, data.aconvert, data.resample, data.asink, NULL)) {
-    g_printerr ("Elements could not be linked on audio brach.\n");
-    gst_object_unref (data.pipeline);
+  } else {
+    uris[0] = g_strdup ("http://commondatastorage.googleapis.com/gtv-videos-bucket/sample/BigBuckBunny.mp4");
+  }
+  uri = uris[0];
+
+  /* Live feeds are played as they arrive, never cached or buffered */
+  live_option |= live_uri_is_live (uri);
+  config.streaming = stream_option;
+  for (i = 0; i < n_uris && !live_option; i++)
+    config.streaming |= streaming_uri_is_network (uris[i]);
+  if (live_option)
+    config.buffering = BUFFERING_DEFAULT;
+  config.cache_size_mb = MAX (cache_size_mb, 1);
+  config.cache_dir = cache_dir;
+
+  config.wall_uris = (const gchar * const *) uris;
+  config.wall_tiles = wall_mode ? n_uris : 0;
+  config.wall_width = 1920;
+  config.wall_height = 1080;
+  config.wall_audio = WALL_AUDIO_MIX;
+  if (wall_size != NULL && (sscanf (wall_size, "%dx%d", &config.wall_width, &config.wall_height) != 2 ||
+      config.wall_width < 2 || config.wall_height < 2)) {
+    g_printerr ("Invalid wall size '%s'.\n", wall_size);
     return -1;
   }
+  if (wall_audio != NULL && g_strcmp0 (wall_audio, "mix") != 0) {
+    gint64 tile;
+    if (!g_ascii_string_to_signed (wall_audio, 10, 0, n_uris - 1, &tile, NULL)) {
+      g_printerr ("Invalid wall audio '%s', expected mix or a tile from 0 to %d.\n", wall_audio, n_uris - 1);
+      return -1;
+    }
+    config.wall_audio = (gint) tile;
+  }
 
-  /* Link separate video pipeline branch */
-  if (!gst_element_link_many (data.video_queue, data.vconvert, data.videosink, NULL)) {
-    g_printerr ("Elements could not be linked on video brach.\n");
-    gst_object_unref (data.pipeline);
+  if (record_path != NULL && (wall_mode || (record_remux && audio_passthrough))) {
+    g_printerr ("--record works on a single source and without --audio-passthrough when remuxing.\n");
     return -1;
   }
 
-  /* Connect source pads to pipeline on the fly depending on the content of the source */
-  g_signal_connect(data.source, "pad-added", G_CALLBACK(pad_added_handler), &data);
+  if (thumbnails) {
+    ThumbnailConfig thumbnail_config;
+    thumbnail_config.count = MAX (thumbnail_count, 1);
+    thumbnail_config.width = MAX (thumbnail_width, 16) & ~1;
+    thumbnail_config.jobs = thumbnail_jobs > 0 ? thumbnail_jobs : g_get_num_processors ();
+    thumbnail_config.output_dir = thumbnail_dir ? thumbnail_dir : ".";
+    return thumbnails_run (uris, n_uris, &thumbnail_config);
+  }
 
-  /* Create GUI */
-  create_ui (&data);
+  /* Tuning without a rebuild, a missing default file just means the built-in branches */
+  if (pipeline_config != NULL) {
+    branches = branches_load (pipeline_config, FALSE);
+  } else {
+    gchar *path = g_build_filename (g_get_user_config_dir (), "open-pipe", "pipeline.ini", NULL);
+    branches = branches_load (path, TRUE);
+    g_free (path);
+  }
+  config.branches = branches;
+
+  /* The hooks must be in place before the first pipeline exists */
+  if (trace_path != NULL)
+    tracing = tracing_start (MAX (trace_events, 1), trace_path);
+
+  /* Same chain as the player, without any display */
+  if (benchmark) {
+    SoakConfig soak = { MAX (soak_seconds, 0), MAX (soak_tolerance, 0) };
+    gint ret = benchmark_run (uri, &config, tracing, &soak);
+    branches_free (branches);
+    return ret;
+  }
 
-  ret = gst_element_set_state (data.pipeline, GST_STATE_PLAYING);
-  if (ret == GST_STATE_CHANGE_FAILURE) {
-    g_printerr ("Unable to set the pipeline to the playing state.\n");
-    gst_object_unref (data.pipeline);
+  gtk_init(&argc, &argv);
+  startup_mark (data.startup, STARTUP_PHASE_GTK_INIT);
+
+  if (!pipeline_build (&data, uri, &config))
     return -1;
-  }
-  
-  /* Run gtk main loop in a separate thread */
-  pthread_t ui_loop_thread;
-  pthread_create(&ui_loop_thread, NULL, &gtk_main_loop, (void*)&data);
+  startup_mark (data.startup, STARTUP_PHASE_PIPELINE);
 
+  if (g_strcmp0 (overload_option, "off") != 0) {
+    data.overload = overload_new ();
+    overload_attach (data.overload, &data);
+  }
 
-  /* Pipeline query handler */
-  bus = gst_element_get_bus (data.pipeline);
+  if (data.source != NULL &&
+      g_strcmp0 (GST_OBJECT_NAME (gst_element_get_factory (data.source)), "uridecodebin3") == 0)
+    data.tracks = tracks_new (audio_track);
 
-  do {
-    msg = gst_bus_timed_pop_filtered (bus, 100*GST_MSECOND,
-        GST_MESSAGE_STATE_CHANGED | GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_DURATION);
+  if (live_option && data.source != NULL) {
+    data.live = live_new (MAX (live_latency, 0));
+    live_setup (data.live, &data);
+  }
+  if (av_sync || av_offset != 0) {
+    data.avsync = avsync_new ((gint64) av_offset * GST_MSECOND);
+    avsync_attach (data.avsync, &data);
+  }
+  if (vsync_pacing && data.sink_widget != NULL) {
+    data.pacing = pacing_new ();
+    pacing_attach (data.pacing, &data);
+  }
 
-    if (msg != NULL) {
-      handle_message (&data, msg);
-    }
-    else
-    { 
-      if (data.playing) {
-        gint64 current = -1;
-
-        if (!gst_element_query_position (data.pipeline, GST_FORMAT_TIME, &current)) {
-          g_printerr ("Could not query current position.\n");
-        }
-
-        if (!GST_CLOCK_TIME_IS_VALID (data.duration)) {
-          if (!gst_element_query_duration (data.pipeline, GST_FORMAT_TIME, &data.duration)) {
-            g_printerr ("Could not query current duration.\n");
-          }
-        }
-
-        g_print ("Position %" GST_TIME_FORMAT " / %" GST_TIME_FORMAT "\r", GST_TIME_ARGS (current), GST_TIME_ARGS (data.duration));
-        
-        
-        // if (data.seek_enabled && !data.seek_done && current > 5 * GST_SECOND) {
-        //   g_print ("\nReached 10s, performing seek...\n");
-        //   gst_element_seek_simple (data.pipeline, GST_FORMAT_TIME,GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT, 45 * GST_SECOND);
-        //   data.seek_done = TRUE;
-        // }
-
-      }     
+  if (export_frames != NULL) {
+    data.frame_export = frame_export_new (export_frames, export_slots);
+    if (!frame_export_attach (data.frame_export, &data)) {
+      frame_export_free (data.frame_export);
+      gst_object_unref (data.pipeline);
+      return -1;
     }
-  } while (!data.terminate);
+  }
+  startup_attach (data.startup, &data);
+  tracing_attach (tracing, &data);
+
+  /* Wall tiles have no single source to probe */
+  if (fast_start && data.source != NULL) {
+    probe_cache = probe_cache_open (uri);
+    probe_cache_attach (probe_cache, &data);
+    if (data.startup != NULL)
+      data.startup->cache_hit = probe_cache->hit;
+  }
 
-  pthread_join(ui_loop_thread, NULL);
+  if (!wall_mode && (n_uris > 1 || loop_playlist)) {
+    data.playlist = playlist_new (uris, n_uris, loop_playlist);
+    playlist_attach (data.playlist, &data);
+  }
 
-  gst_object_unref (bus);
-  gst_element_set_state (data.pipeline, GST_STATE_NULL);
-  gst_object_unref (data.pipeline);
-  return 0;
-}
+  data.seek = seek_engine_new ();
+  seek_engine_attach (data.seek, &data);
 
+  if (stats_overlay || stats_json != NULL) {
+    data.metrics = metrics_new (MAX (stats_interval, 100), stats_json, stats_overlay);
+    metrics_attach (data.metrics, &data);
+  }
 
-static void pad_added_handler (GstElement *src, GstPad *new_pad, CustomData *data) {
-  GstPadLinkReturn ret;
-  GstCaps *new_pad_caps = NULL;
-  GstStructure *new_pad_struct = NULL;
-  const gchar *new_pad_type = NULL;
-
-  g_print ("Received new pad '%s' from '%s':\n", GST_PAD_NAME (new_pad), GST_ELEMENT_NAME (src));
-
-  new_pad_caps = gst_pad_get_current_caps (new_pad);
-  new_pad_struct = gst_caps_get_structure (new_pad_caps, 0);
-  new_pad_type = gst_structure_get_name (new_pad_struct);
-
-  GstPad *vsink_pad = gst_element_get_static_pad (data->video_queue, "sink");
-  if(g_str_has_prefix (new_pad_type, "video/x-raw")){
-    ret = gst_pad_link (new_pad, vsink_pad);
-    if (GST_PAD_LINK_FAILED (ret)) {
-      g_print ("Type is '%s' but link failed.\n", new_pad_type);
-        if (new_pad_caps != NULL)
-          gst_caps_unref (new_pad_caps);
-        gst_object_unref (vsink_pad);
-    } else {
-      g_print ("Link succeeded (type '%s').\n", new_pad_type);
+  /* The pipeline is driven from its own thread, GTK keeps the main thread.
+   * With --fast-start typefinding and decoding run while the window is built */
+  if (fast_start) {
+    if (!control_start (&data)) {
+      gst_object_unref (data.pipeline);
+      return -1;
     }
+    control_send (&data, CONTROL_CMD_PAUSE, 0);
   }
 
-  GstPad *asink_pad = gst_element_get_static_pad (data->audio_queue, "sink");
-  if(g_str_has_prefix (new_pad_type, "audio/x-raw")){
-    ret = gst_pad_link (new_pad, asink_pad);
-    if (GST_PAD_LINK_FAILED (ret)) {
-      g_print ("Type is '%s' but link failed.\n", new_pad_type);
-      if (new_pad_caps != NULL)
-        gst_caps_unref (new_pad_caps);
-      gst_object_unref (asink_pad);
-    } else {
-      g_print ("Link succeeded (type '%s').\n", new_pad_type);
-    }
+  /* Create GUI */
+  create_ui (&data);
+  startup_mark (data.startup, STARTUP_PHASE_UI);
+
+  if (!fast_start && !control_start (&data)) {
+    gst_object_unref (data.pipeline);
+    return -1;
   }
-  
+  control_send (&data, CONTROL_CMD_PLAY, 0);
+
+  if (tracing != NULL)
+    g_unix_signal_add (SIGUSR1, (GSourceFunc) dump_trace_cb, tracing);
+
+  gtk_main ();
+
+  control_stop (&data);
+  wall_report (data.wall);
+  record_finish (data.record, 3000);
+  record_report (data.record);
+  frame_export_report (data.frame_export);
+  pacing_report (data.pacing);
+  memlimit_report (data.memlimit);
+  /* Later playlist items overwrite the duration of the first one */
+  probe_cache_store (probe_cache, data.playlist == NULL ? atomic_load (&data.duration) : (gint64) GST_CLOCK_TIME_NONE);
+  probe_cache_free (probe_cache);
+  startup_trace_free (data.startup);
+  gst_element_set_state (data.pipeline, GST_STATE_NULL);
+  gst_object_unref (data.pipeline);
+  tracing_dump (tracing);
+  tracing_free (tracing);
+  metrics_free (data.metrics);
+  seek_engine_free (data.seek);
+  wall_free (data.wall);
+  live_free (data.live);
+  tracks_free (data.tracks);
+  overload_free (data.overload);
+  record_free (data.record);
+  branches_free (branches);
+  avsync_free (data.avsync);
+  frame_export_free (data.frame_export);
+  pacing_free (data.pacing);
+  memlimit_free (data.memlimit);
+  playlist_free (data.playlist);
+  g_strfreev (uris);
+  if (data.buffering != NULL)
+    buffering_free (data.buffering);
+  return 0;
 }
 
 
-static void handle_message (CustomData *data, GstMessage *msg) {
-  GError *err;
-  gchar *debug_info;
+static void widget_size_allocate_cb (GtkWidget *widget, GdkRectangle *allocation, CustomData *data) {
+  gint scale = gtk_widget_get_scale_factor (widget);
+  gint width = allocation->width * scale;
+  gint height = allocation->height * scale;
 
-  switch (GST_MESSAGE_TYPE (msg)) {
-    case GST_MESSAGE_ERROR:
-      gst_message_parse_error (msg, &err, &debug_info);
-      g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
-      g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
-      g_clear_error (&err);
-      g_free (debug_info);
-      data->terminate = TRUE;
-      break;
-    case GST_MESSAGE_EOS:
-      g_print ("\nEnd-Of-Stream reached.\n");
-      data->terminate = TRUE;
-      break;
-    case GST_MESSAGE_DURATION:
-      data->duration = GST_CLOCK_TIME_NONE;
-      break;
-    case GST_MESSAGE_STATE_CHANGED: {
-      GstState old_state, new_state, pending_state;
-      gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
-      if (GST_MESSAGE_SRC (msg) == GST_OBJECT (data->pipeline)) {
-        g_print ("Pipeline state changed from %s to %s:\n",
-            gst_element_state_get_name (old_state), gst_element_state_get_name (new_state));
-
-        
-        data->playing = (new_state == GST_STATE_PLAYING);
-
-        if (data->playing) {
-          
-          GstQuery *query;
-          gint64 start, end;
-          query = gst_query_new_seeking (GST_FORMAT_TIME);
-          if (gst_element_query (data->pipeline, query)) {
-            gst_query_parse_seeking (query, NULL, &data->seek_enabled, &start, &end);
-            if (data->seek_enabled) {
-              g_print ("Seeking is ENABLED from %" GST_TIME_FORMAT " to %" GST_TIME_FORMAT "\n",
-                  GST_TIME_ARGS (start), GST_TIME_ARGS (end));
-            } else {
-              g_print ("Seeking is DISABLED for this stream.\n");
-            }
-          }
-          else {
-            g_printerr ("Seeking query failed.");
-          }
-          gst_query_unref (query);
-        }
-      }
-    } break;
-    default:
-      
-      g_printerr ("Unexpected message received.\n");
-      break;
-  }
-  gst_message_unref (msg);
+  if (width == data->widget_width && height == data->widget_height)
+    return;
+  data->widget_width = width;
+  data->widget_height = height;
+  control_send (data, CONTROL_CMD_RESIZE, ((gint64) width << 32) | height);
 }
@@ -0,0 +1,310 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#include "frameexport.h"
+#include "player.h"
+#include "pipeline.h"
+
+/* Frames waiting for the export thread before the oldest is dropped */
+#define EXPORT_QUEUE_BUFFERS 2
+/* How often vanished consumers are looked for, in us */
+#define LIVENESS_INTERVAL G_USEC_PER_SEC
+
+
+static void discard_element (GstElement **element) {
+  if (*element != NULL) {
+    gst_object_unref (gst_object_ref_sink (*element));
+    *element = NULL;
+  }
+}
+
+static gsize align_up (gsize size) {
+  return (size + FRAMESHM_ALIGN - 1) / FRAMESHM_ALIGN * FRAMESHM_ALIGN;
+}
+
+FrameExport *frame_export_new (const gchar *name, guint n_slots) {
+  FrameExport *export = g_new0 (FrameExport, 1);
+
+  /* shm_open wants a single leading slash */
+  export->name = name[0] == '/' ? g_strdup (name) : g_strconcat ("/", name, NULL);
+  export->n_slots = MAX (n_slots, 2);
+  gst_video_info_init (&export->info);
+  return export;
+}
+
+void frame_export_free (FrameExport *export) {
+  if (export == NULL)
+    return;
+  if (export->header != NULL) {
+    munmap (export->header, export->size);
+    shm_unlink (export->name);
+  }
+  if (export->caps != NULL)
+    gst_caps_unref (export->caps);
+  g_free (export->name);
+  g_free (export);
+}
+
+static FrameShmSlot *slot_at (FrameExport *export, guint64 seq) {
+  FrameShmHeader *header = export->header;
+
+  return (FrameShmSlot *) ((guint8 *) header + header->header_size + (seq % header->n_slots) * header->slot_size);
+}
+
+/* Consumers re-read the layout when layout_seq moves, odd while it is being rewritten */
+static void publish_layout (FrameExport *export) {
+  FrameShmHeader *header = export->header;
+  GstVideoInfo *info = &export->info;
+  guint i;
+
+  atomic_fetch_add_explicit (&header->layout_seq, 1, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+  g_strlcpy (header->format, gst_video_format_to_string (GST_VIDEO_INFO_FORMAT (info)), sizeof (header->format));
+  header->width = GST_VIDEO_INFO_WIDTH (info);
+  header->height = GST_VIDEO_INFO_HEIGHT (info);
+  header->fps_n = GST_VIDEO_INFO_FPS_N (info);
+  header->fps_d = GST_VIDEO_INFO_FPS_D (info);
+  header->n_planes = MIN (GST_VIDEO_INFO_N_PLANES (info), FRAMESHM_MAX_PLANES);
+  for (i = 0; i < header->n_planes; i++) {
+    header->stride[i] = GST_VIDEO_INFO_PLANE_STRIDE (info, i);
+    header->offset[i] = GST_VIDEO_INFO_PLANE_OFFSET (info, i);
+  }
+  atomic_fetch_add_explicit (&header->layout_seq, 1, memory_order_release);
+}
+
+/* Sized for the current caps, recreated when larger frames no longer fit */
+static gboolean create_segment (FrameExport *export) {
+  gsize header_size = align_up (sizeof (FrameShmHeader));
+  gsize slot_size = align_up (sizeof (FrameShmSlot)) + align_up (GST_VIDEO_INFO_SIZE (&export->info));
+  FrameShmHeader *header;
+  gint fd;
+
+  export->size = header_size + slot_size * export->n_slots;
+  fd = shm_open (export->name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+  if (fd < 0) {
+    g_printerr ("Could not create the frame export %s: %s\n", export->name, g_strerror (errno));
+    return FALSE;
+  }
+  if (ftruncate (fd, export->size) < 0) {
+    g_printerr ("Could not size the frame export %s: %s\n", export->name, g_strerror (errno));
+    close (fd);
+    shm_unlink (export->name);
+    return FALSE;
+  }
+  header = mmap (NULL, export->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (header == MAP_FAILED) {
+    g_printerr ("Could not map the frame export %s: %s\n", export->name, g_strerror (errno));
+    shm_unlink (export->name);
+    return FALSE;
+  }
+
+  /* ftruncate zero-filled it, consumers wait for the magic */
+  export->header = header;
+  export->frame_capacity = slot_size - align_up (sizeof (FrameShmSlot));
+  header->version = FRAMESHM_VERSION;
+  header->n_slots = export->n_slots;
+  header->slot_size = slot_size;
+  header->header_size = header_size;
+  publish_layout (export);
+  atomic_thread_fence (memory_order_release);
+  header->magic = FRAMESHM_MAGIC;
+
+  g_print ("Exporting %s %dx%d frames to shared memory %s (%u slots of %" G_GSIZE_FORMAT " KB)\n",
+      header->format, header->width, header->height, export->name, export->n_slots, slot_size / 1024);
+  return TRUE;
+}
+
+/* Consumers keep their mapping of the old segment, the cleared magic tells them to open the name again */
+static void retire_segment (FrameExport *export) {
+  atomic_thread_fence (memory_order_release);
+  export->header->magic = 0;
+  munmap (export->header, export->size);
+  shm_unlink (export->name);
+  export->header = NULL;
+}
+
+static void update_caps (FrameExport *export, GstCaps *caps) {
+  GstVideoInfo info;
+
+  if (caps == export->caps)
+    return;
+  gst_caps_replace (&export->caps, caps);
+
+  if (caps == NULL || !gst_video_info_from_caps (&info, caps)) {
+    g_printerr ("Cannot export frames with caps %" GST_PTR_FORMAT "\n", caps);
+    return;
+  }
+  if (export->header != NULL && gst_video_info_is_equal (&info, &export->info))
+    return;
+
+  export->info = info;
+  if (export->header != NULL && GST_VIDEO_INFO_SIZE (&info) > export->frame_capacity) {
+    g_print ("%dx%d frames do not fit the frame export, recreating it\n",
+        GST_VIDEO_INFO_WIDTH (&info), GST_VIDEO_INFO_HEIGHT (&info));
+    retire_segment (export);
+  }
+  if (export->header == NULL)
+    create_segment (export);
+  else
+    publish_layout (export);
+}
+
+/* Count what each consumer misses, free the entries of consumers that exited */
+static void update_consumers (FrameExport *export, guint64 seq) {
+  FrameShmHeader *header = export->header;
+  gint64 now = g_get_monotonic_time ();
+  gboolean check_alive = now - export->last_liveness_check >= LIVENESS_INTERVAL;
+  guint i;
+
+  if (check_alive)
+    export->last_liveness_check = now;
+
+  for (i = 0; i < FRAMESHM_MAX_CONSUMERS; i++) {
+    FrameShmConsumer *consumer = &header->consumers[i];
+    int32_t pid = atomic_load (&consumer->pid);
+    guint64 read_seq;
+
+    if (pid == 0)
+      continue;
+    if (check_alive && kill (pid, 0) < 0 && errno == ESRCH) {
+      atomic_compare_exchange_strong (&consumer->pid, &pid, 0);
+      continue;
+    }
+
+    /* Frame seq just replaced frame seq - n_slots */
+    read_seq = atomic_load (&consumer->read_seq);
+    if (seq >= header->n_slots && read_seq <= seq - header->n_slots)
+      atomic_fetch_add (&consumer->dropped, 1);
+    atomic_store (&consumer->lag, seq + 1 - MIN (read_seq, seq + 1));
+  }
+}
+
+/* Export streaming thread, behind a leaky queue so playback never waits for it */
+static GstFlowReturn new_sample_cb (GstAppSink *appsink, FrameExport *export) {
+  GstSample *sample = gst_app_sink_pull_sample (appsink);
+  GstBuffer *buffer;
+  FrameShmSlot *slot;
+  GstMapInfo map;
+  guint64 seq;
+
+  if (sample == NULL)
+    return GST_FLOW_EOS;
+
+  update_caps (export, gst_sample_get_caps (sample));
+  buffer = gst_sample_get_buffer (sample);
+  if (export->header == NULL || buffer == NULL || !gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    gst_sample_unref (sample);
+    return GST_FLOW_OK;
+  }
+  if (map.size > export->frame_capacity) {
+    atomic_fetch_add (&export->oversize, 1);
+    gst_buffer_unmap (buffer, &map);
+    gst_sample_unref (sample);
+    return GST_FLOW_OK;
+  }
+
+  seq = atomic_load_explicit (&export->header->write_seq, memory_order_relaxed);
+  slot = slot_at (export, seq);
+  atomic_store_explicit (&slot->seq, 2 * seq + 1, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+  memcpy ((guint8 *) slot + align_up (sizeof (FrameShmSlot)), map.data, map.size);
+  slot->pts = GST_BUFFER_PTS_IS_VALID (buffer) ? GST_BUFFER_PTS (buffer) : UINT64_MAX;
+  slot->duration = GST_BUFFER_DURATION_IS_VALID (buffer) ? GST_BUFFER_DURATION (buffer) : UINT64_MAX;
+  slot->size = map.size;
+  slot->flags = GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT) ? 0 : FRAMESHM_FLAG_KEYFRAME;
+  /* Only this thread moves it, it is even here */
+  slot->layout_seq = atomic_load_explicit (&export->header->layout_seq, memory_order_relaxed);
+  atomic_store_explicit (&slot->seq, 2 * seq + 2, memory_order_release);
+  atomic_store_explicit (&export->header->write_seq, seq + 1, memory_order_release);
+
+  gst_buffer_unmap (buffer, &map);
+  gst_sample_unref (sample);
+  update_consumers (export, seq);
+  atomic_fetch_add (&export->published, 1);
+  return GST_FLOW_OK;
+}
+
+static GstPadProbeReturn count_in_cb (GstPad *pad, GstPadProbeInfo *info, FrameExport *export) {
+  atomic_fetch_add (&export->in, 1);
+  return GST_PAD_PROBE_OK;
+}
+
+gboolean frame_export_attach (FrameExport *export, CustomData *data) {
+  GstAppSinkCallbacks callbacks = { NULL, NULL, (GstFlowReturn (*) (GstAppSink *, gpointer)) new_sample_cb };
+  GstElement *tee;
+  GstCaps *caps;
+  GstPad *pad;
+
+  export->queue = gst_element_factory_make ("queue", "export-queue");
+  export->convert = gst_element_factory_make ("videoconvert", "export-convert");
+  export->sink = gst_element_factory_make ("appsink", "export-sink");
+  if (export->queue == NULL || export->convert == NULL || export->sink == NULL) {
+    g_printerr ("Frame export needs queue, videoconvert and appsink.\n");
+    discard_element (&export->queue);
+    discard_element (&export->convert);
+    discard_element (&export->sink);
+    return FALSE;
+  }
+
+  /* Its own thread, a slow copy drops the oldest frames of this branch only */
+  g_object_set (export->queue, "leaky", 2, "max-size-buffers", EXPORT_QUEUE_BUFFERS, "max-size-bytes", 0,
+      "max-size-time", (guint64) 0, NULL);
+  /* Consumers map plain memory, GPU or DMABuf frames are converted, system memory ones pass through */
+  caps = gst_caps_new_empty_simple ("video/x-raw");
+  /* Neither clock sync nor preroll, frames go out as soon as they are decoded */
+  g_object_set (export->sink, "caps", caps, "sync", FALSE, "async", FALSE, "enable-last-sample", FALSE, NULL);
+  gst_caps_unref (caps);
+  gst_app_sink_set_callbacks (GST_APP_SINK (export->sink), &callbacks, export, NULL);
+
+  tee = pipeline_splice_tee (data, data->video_queue);
+  gst_bin_add_many (GST_BIN (data->pipeline), export->queue, export->convert, export->sink, NULL);
+  if (!gst_element_link_many (tee, export->queue, export->convert, export->sink, NULL)) {
+    g_printerr ("Could not link the frame export branch.\n");
+    /* The bin drops the last references */
+    gst_bin_remove_many (GST_BIN (data->pipeline), export->queue, export->convert, export->sink, NULL);
+    export->queue = export->convert = export->sink = NULL;
+    return FALSE;
+  }
+
+  pad = gst_element_get_static_pad (export->queue, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) count_in_cb, export, NULL);
+  gst_object_unref (pad);
+  return TRUE;
+}
+
+void frame_export_report (FrameExport *export) {
+  guint64 in, published, oversize;
+  guint level = 0;
+  guint i;
+
+  if (export == NULL || export->queue == NULL)
+    return;
+
+  in = atomic_load (&export->in);
+  published = atomic_load (&export->published);
+  oversize = atomic_load (&export->oversize);
+  g_object_get (export->queue, "current-level-buffers", &level, NULL);
+  g_print ("Exported %" G_GUINT64_FORMAT " frames to %s, %" G_GUINT64_FORMAT " dropped by the player, %"
+      G_GUINT64_FORMAT " too large\n", published, export->name,
+      in > published + oversize + level ? in - published - oversize - level : 0, oversize);
+  if (export->header == NULL)
+    return;
+
+  for (i = 0; i < FRAMESHM_MAX_CONSUMERS; i++) {
+    FrameShmConsumer *consumer = &export->header->consumers[i];
+    int32_t pid = atomic_load (&consumer->pid);
+
+    if (pid != 0)
+      g_print ("  consumer %d: %" G_GUINT64_FORMAT " frames behind, %" G_GUINT64_FORMAT " missed\n", pid,
+          (guint64) atomic_load (&consumer->lag), (guint64) atomic_load (&consumer->dropped));
+  }
+}
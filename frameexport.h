@@ -0,0 +1,42 @@
+#ifndef FRAMEEXPORT_H
+#define FRAMEEXPORT_H
+
+#include <stdatomic.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "frameshm.h"
+
+typedef struct _CustomData CustomData;
+
+typedef struct _FrameExport {
+  gchar *name;                  /* shm_open name */
+  guint n_slots;
+  GstElement *queue;
+  GstElement *convert;
+  GstElement *sink;
+
+  /* Export streaming thread only */
+  FrameShmHeader *header;       /* NULL until the first caps */
+  GstCaps *caps;                /* last caps seen, each is parsed once */
+  gsize size;
+  gsize frame_capacity;
+  GstVideoInfo info;
+  gint64 last_liveness_check;
+
+  atomic_uint_fast64_t published;
+  atomic_uint_fast64_t oversize;
+  atomic_uint_fast64_t in;      /* frames offered by the video branch */
+} FrameExport;
+
+/* name is the shm_open name, e.g. "/open-pipe-frames" */
+FrameExport *frame_export_new (const gchar *name, guint n_slots);
+/* Unmaps and unlinks the segment, consumers keep their mapping */
+void frame_export_free (FrameExport *export);
+
+/* Tee the decoded video into a leaky queue feeding the ring, before the pipeline runs */
+gboolean frame_export_attach (FrameExport *export, CustomData *data);
+/* Frames published, dropped for the player and per consumer */
+void frame_export_report (FrameExport *export);
+
+#endif
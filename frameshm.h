@@ -0,0 +1,75 @@
+#ifndef FRAMESHM_H
+#define FRAMESHM_H
+
+/* Layout of the decoded frame ring exported with --export-frames, shared with
+ * consumer processes. Only C11 and POSIX, consumers do not need GStreamer.
+ *
+ * A consumer shm_open()s the name read-write, maps the header, then the whole
+ * segment (header_size + n_slots * slot_size), claims a consumers[] entry by
+ * compare-exchanging its pid into a 0 pid, and sets read_seq to write_seq.
+ * Frame n is in slot n % n_slots. Its seq is 2n + 1 while the player writes it
+ * and 2n + 2 once complete: read seq, use the frame, read seq again, and drop
+ * the frame if it changed. A consumer more than n_slots behind lost frames, it
+ * skips to write_seq - 1. The player never waits for consumers.
+ *
+ * The layout fields use the same scheme: layout_seq is odd while the player
+ * rewrites them and even once complete, so read layout_seq, copy the fields,
+ * and read it again. Every slot records the even layout_seq its frame was
+ * written under; a frame whose layout_seq differs from the copied layout was
+ * written with another geometry and is dropped.
+ *
+ * When frames grow beyond slot_size the player clears magic, unlinks the name
+ * and creates a larger segment under it: a consumer that sees magic become 0
+ * unmaps, opens the name again and registers anew */
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define FRAMESHM_MAGIC 0x4546504fu   /* "OPFE" */
+#define FRAMESHM_VERSION 3
+#define FRAMESHM_MAX_CONSUMERS 8
+#define FRAMESHM_MAX_PLANES 4
+/* Slot headers and frame data start on this boundary */
+#define FRAMESHM_ALIGN 64
+
+#define FRAMESHM_FLAG_KEYFRAME 1u
+
+typedef struct _FrameShmConsumer {
+  _Atomic int32_t pid;          /* 0 for a free entry */
+  _Atomic uint64_t read_seq;    /* next frame it wants, written by the consumer */
+  _Atomic uint64_t lag;         /* frames behind at the last publish, written by the player */
+  _Atomic uint64_t dropped;     /* frames overwritten before it read them, written by the player */
+} FrameShmConsumer;
+
+typedef struct _FrameShmHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n_slots;
+  uint32_t slot_size;           /* slot header and frame data */
+  uint64_t header_size;         /* offset of slot 0 */
+  _Atomic uint64_t write_seq;   /* frames published so far */
+
+  /* Raw video layout, re-read when layout_seq changes, odd while it is rewritten */
+  _Atomic uint64_t layout_seq;
+  char format[16];              /* GStreamer video format name, e.g. "I420" or "NV12" */
+  uint32_t width;
+  uint32_t height;
+  int32_t fps_n;
+  int32_t fps_d;
+  uint32_t n_planes;
+  uint32_t stride[FRAMESHM_MAX_PLANES];
+  uint64_t offset[FRAMESHM_MAX_PLANES];
+
+  FrameShmConsumer consumers[FRAMESHM_MAX_CONSUMERS];
+} FrameShmHeader;
+
+typedef struct _FrameShmSlot {
+  _Atomic uint64_t seq;
+  uint64_t pts;                 /* ns, UINT64_MAX when unknown */
+  uint64_t duration;
+  uint64_t size;
+  uint32_t flags;
+  uint64_t layout_seq;          /* layout the frame was written with */
+} FrameShmSlot;
+
+#endif
@@ -0,0 +1,120 @@
+#include <string.h>
+
+#include <gst/gst.h>
+
+#include "hwaccel.h"
+
+/* Hardware decoder plugins we know how to check for a device */
+typedef struct _HwDecoderFamily {
+  const gchar *factory_prefix;
+  const gchar *device_dir;
+  const gchar *device_prefix;
+} HwDecoderFamily;
+
+static const HwDecoderFamily families[] = {
+  { "vaapi", "dri", "renderD" },
+  { "va", "dri", "renderD" },
+  { "v4l2", "", "video" },
+};
+
+/* Elements of the GL branch that keeps frames in dmabuf/GLMemory */
+static const gchar *gl_branch_factories[] = {
+  "glupload", "glcolorconvert", "glsinkbin", "gtkglsink", NULL
+};
+
+
+gboolean hwaccel_mode_from_string (const gchar *str, HwAccelMode *mode) {
+  if (g_strcmp0 (str, "off") == 0) {
+    *mode = HWACCEL_OFF;
+  } else if (g_strcmp0 (str, "auto") == 0) {
+    *mode = HWACCEL_AUTO;
+  } else if (g_strcmp0 (str, "on") == 0) {
+    *mode = HWACCEL_ON;
+  } else {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static const HwDecoderFamily *lookup_family (const gchar *factory_name) {
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (families); i++) {
+    if (g_str_has_prefix (factory_name, families[i].factory_prefix))
+      return &families[i];
+  }
+  return NULL;
+}
+
+/* OPEN_PIPE_DEV_DIR replaces /dev, pointing it at an empty directory
+ * exercises the software fallback on any machine */
+static gboolean device_present (const HwDecoderFamily *family) {
+  const gchar *root = g_getenv ("OPEN_PIPE_DEV_DIR");
+  gchar *path = g_build_filename (root ? root : "/dev", family->device_dir, NULL);
+  GDir *dir = g_dir_open (path, 0, NULL);
+  const gchar *name;
+  gboolean found = FALSE;
+
+  g_free (path);
+  if (dir == NULL)
+    return FALSE;
+
+  while (!found && (name = g_dir_read_name (dir)) != NULL) {
+    found = g_str_has_prefix (name, family->device_prefix);
+  }
+  g_dir_close (dir);
+  return found;
+}
+
+static gboolean gl_branch_available (void) {
+  const gchar **name;
+
+  for (name = gl_branch_factories; *name != NULL; name++) {
+    GstElementFactory *factory = gst_element_factory_find (*name);
+    if (factory == NULL) {
+      g_printerr ("Missing element '%s' for the GL video branch.\n", *name);
+      return FALSE;
+    }
+    gst_object_unref (factory);
+  }
+  return TRUE;
+}
+
+gboolean hwaccel_setup (HwAccelMode mode) {
+  GList *factories, *l;
+  guint usable = 0;
+
+  factories = gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_DECODER |
+      GST_ELEMENT_FACTORY_TYPE_MEDIA_VIDEO | GST_ELEMENT_FACTORY_TYPE_HARDWARE, GST_RANK_NONE);
+
+  for (l = factories; l != NULL; l = l->next) {
+    GstPluginFeature *feature = GST_PLUGIN_FEATURE (l->data);
+    const gchar *name = gst_plugin_feature_get_name (feature);
+    const HwDecoderFamily *family = lookup_family (name);
+
+    if (mode == HWACCEL_OFF || (family != NULL && !device_present (family))) {
+      /* Never let decodebin pick a decoder that cannot open its device */
+      gst_plugin_feature_set_rank (feature, GST_RANK_NONE);
+    } else if (family != NULL) {
+      /* Prefer it over the software decoder for the same format */
+      gst_plugin_feature_set_rank (feature, GST_RANK_PRIMARY + 1);
+      g_print ("Hardware decoder '%s' enabled.\n", name);
+      usable++;
+    }
+  }
+  gst_plugin_feature_list_free (factories);
+
+  if (mode == HWACCEL_OFF)
+    return FALSE;
+
+  if (usable == 0 && mode == HWACCEL_AUTO) {
+    g_printerr ("No hardware decoder device found, falling back to software decoding.\n");
+    return FALSE;
+  }
+
+  if (!gl_branch_available ()) {
+    g_printerr ("Falling back to software conversion.\n");
+    return FALSE;
+  }
+  return TRUE;
+}
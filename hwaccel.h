@@ -0,0 +1,20 @@
+#ifndef HWACCEL_H
+#define HWACCEL_H
+
+#include <gst/gst.h>
+
+typedef enum {
+  HWACCEL_OFF,
+  HWACCEL_AUTO,
+  HWACCEL_ON
+} HwAccelMode;
+
+gboolean hwaccel_mode_from_string (const gchar *str, HwAccelMode *mode);
+
+/* Probe for a usable VA-API/V4L2 decoder and steer autoplugging towards it,
+ * or away from hardware decoders when there is no device. Does not need a
+ * display, so the decision can be checked headless with --hwaccel-probe.
+ * Returns TRUE when the zero-copy GL video branch should be built. */
+gboolean hwaccel_setup (HwAccelMode mode);
+
+#endif
@@ -0,0 +1,211 @@
+#include <gst/gst.h>
+
+#include "live.h"
+#include "player.h"
+
+/* Seconds between the NTP (1900) and Unix (1970) epochs */
+#define NTP_UNIX_OFFSET G_GUINT64_CONSTANT (2208988800)
+
+static const gchar *live_protocols[] = { "rtsp", "rtsps", "rtspt", "rtp", "udp", "srt", NULL };
+
+static GstCaps *ntp_caps = NULL;
+
+
+gboolean live_uri_is_live (const gchar *uri) {
+  gchar *protocol = gst_uri_get_protocol (uri);
+  gboolean live = protocol != NULL && g_strv_contains ((const gchar * const *) live_protocols, protocol);
+
+  g_free (protocol);
+  return live;
+}
+
+Live *live_new (guint latency_ms) {
+  Live *live = g_new0 (Live, 1);
+
+  live->latency_ms = latency_ms;
+  gst_segment_init (&live->segment, GST_FORMAT_UNDEFINED);
+  if (ntp_caps == NULL)
+    ntp_caps = gst_caps_new_empty_simple ("timestamp/x-ntp");
+  return live;
+}
+
+void live_free (Live *live) {
+  g_free (live);
+}
+
+/* Source and jitterbuffer properties moved between releases, only set what exists */
+static void set_if_exists (GObject *object, const gchar *property, ...) {
+  va_list args;
+
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (object), property) == NULL)
+    return;
+  va_start (args, property);
+  g_object_set_valist (object, property, args);
+  va_end (args);
+}
+
+static void source_setup_cb (GstElement *uridecodebin, GstElement *source, Live *live) {
+  set_if_exists (G_OBJECT (source), "latency", live->latency_ms, NULL);
+  set_if_exists (G_OBJECT (source), "drop-on-latency", TRUE, NULL);
+  /* rtspsrc: RTCP sender reports give the capture clock */
+  set_if_exists (G_OBJECT (source), "add-reference-timestamp-meta", TRUE, NULL);
+}
+
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, Live *live) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  if (factory == NULL || g_strcmp0 (GST_OBJECT_NAME (factory), "rtpjitterbuffer") != 0)
+    return;
+
+  g_object_set (element, "latency", live->latency_ms, "drop-on-latency", TRUE, NULL);
+  /* Every packet gets the sender's NTP capture time from the RTCP sender reports */
+  set_if_exists (G_OBJECT (element), "add-reference-timestamp-meta", TRUE, NULL);
+}
+
+static void update_max (atomic_uint_fast64_t *max, guint64 value) {
+  guint64 current = atomic_load (max);
+
+  while (value > current && !atomic_compare_exchange_weak (max, &current, value));
+}
+
+/* The frame is shown at its running time plus the pipeline latency, or now if it is late */
+static GstPadProbeReturn sink_probe_cb (GstPad *pad, GstPadProbeInfo *info, Live *live) {
+  GstClockTime running_time, now, base_time, render_time, deadline;
+  GstReferenceTimestampMeta *meta;
+  GstBuffer *buffer;
+  GstClock *clock;
+  gint64 glass_to_glass;
+  guint64 lateness_us = 0;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+      gst_event_copy_segment (event, &live->segment);
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  clock = gst_element_get_clock (live->videosink);
+  if (clock == NULL || !GST_BUFFER_PTS_IS_VALID (buffer) || live->segment.format != GST_FORMAT_TIME) {
+    if (clock != NULL)
+      gst_object_unref (clock);
+    return GST_PAD_PROBE_OK;
+  }
+
+  running_time = gst_segment_to_running_time (&live->segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+  base_time = gst_element_get_base_time (live->videosink);
+  now = gst_clock_get_time (clock) - base_time;
+  gst_object_unref (clock);
+  if (!GST_CLOCK_TIME_IS_VALID (running_time))
+    return GST_PAD_PROBE_OK;
+
+  /* Only the pipeline's own delay, the time before capture is not visible here */
+  deadline = running_time + atomic_load (&live->pipeline_latency);
+  render_time = MAX (now, deadline);
+  if (now > deadline) {
+    lateness_us = (now - deadline) / GST_USECOND;
+    atomic_fetch_add (&live->late, 1);
+  }
+  atomic_fetch_add (&live->lateness_sum_us, lateness_us);
+  update_max (&live->lateness_max_us, lateness_us);
+  atomic_fetch_add (&live->frames, 1);
+
+  /* Glass-to-glass needs the sender's capture time, the running time says nothing about it */
+  meta = gst_buffer_get_reference_timestamp_meta (buffer, ntp_caps);
+  if (meta == NULL)
+    return GST_PAD_PROBE_OK;
+
+  /* Sender capture time against our wall clock, both in NTP time */
+  glass_to_glass = g_get_real_time () * GST_USECOND + NTP_UNIX_OFFSET * GST_SECOND +
+      (gint64) (render_time - now) - (gint64) meta->timestamp;
+  if (glass_to_glass >= 0) {
+    atomic_fetch_add (&live->latency_sum_us, glass_to_glass / GST_USECOND);
+    update_max (&live->latency_max_us, glass_to_glass / GST_USECOND);
+    atomic_fetch_add (&live->samples, 1);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Lift a queue limit still at the element default, one set by --memory-limit or the
+ * pipeline config is kept */
+static void lift_default_limit (GstElement *queue, const gchar *property) {
+  GParamSpec *pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (queue), property);
+  guint value;
+
+  g_object_get (queue, property, &value, NULL);
+  if (value == G_PARAM_SPEC_UINT (pspec)->default_value)
+    g_object_set (queue, property, 0, NULL);
+}
+
+/* Keep at most latency_ms in a queue, the oldest frames go first. Time is the limit that
+ * matters, a lower one already set stays */
+static void set_queue_latency (GstElement *queue, guint latency_ms) {
+  guint64 time, latency = (guint64) latency_ms * GST_MSECOND;
+
+  lift_default_limit (queue, "max-size-buffers");
+  lift_default_limit (queue, "max-size-bytes");
+  g_object_get (queue, "max-size-time", &time, NULL);
+  g_object_set (queue, "leaky", 2, "max-size-time", time > 0 ? MIN (time, latency) : latency, NULL);
+}
+
+void live_setup (Live *live, CustomData *data) {
+  GstPad *pad;
+
+  g_object_set (data->source, "use-buffering", FALSE, "download", FALSE, NULL);
+  g_signal_connect (data->source, "source-setup", G_CALLBACK (source_setup_cb), live);
+  g_signal_connect (data->pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), live);
+
+  set_queue_latency (data->video_queue, live->latency_ms);
+  set_queue_latency (data->audio_queue, live->latency_ms);
+  set_if_exists (G_OBJECT (data->videosink), "qos", TRUE, NULL);
+  set_if_exists (G_OBJECT (data->videosink), "max-lateness", (gint64) live->latency_ms * GST_MSECOND, NULL);
+
+  live->videosink = data->videosink;
+  pad = gst_element_get_static_pad (data->videosink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      (GstPadProbeCallback) sink_probe_cb, live, NULL);
+  gst_object_unref (pad);
+  g_print ("Live mode with %u ms latency\n", live->latency_ms);
+}
+
+void live_update_latency (Live *live, GstElement *pipeline) {
+  GstQuery *query;
+  GstClockTime min_latency;
+  gboolean is_live;
+
+  if (live == NULL)
+    return;
+
+  query = gst_query_new_latency ();
+  if (gst_element_query (pipeline, query)) {
+    gst_query_parse_latency (query, &is_live, &min_latency, NULL);
+    atomic_store (&live->pipeline_latency, min_latency);
+    g_print ("Pipeline latency %" GST_TIME_FORMAT "\n", GST_TIME_ARGS (min_latency));
+  }
+  gst_query_unref (query);
+}
+
+void live_report (Live *live) {
+  gint64 now = g_get_monotonic_time ();
+  guint64 samples, sum, max, frames, lateness_sum, lateness_max, late;
+
+  if (live == NULL || now - live->last_report < G_USEC_PER_SEC)
+    return;
+  live->last_report = now;
+
+  samples = atomic_exchange (&live->samples, 0);
+  sum = atomic_exchange (&live->latency_sum_us, 0);
+  max = atomic_exchange (&live->latency_max_us, 0);
+  frames = atomic_exchange (&live->frames, 0);
+  lateness_sum = atomic_exchange (&live->lateness_sum_us, 0);
+  lateness_max = atomic_exchange (&live->lateness_max_us, 0);
+  late = atomic_exchange (&live->late, 0);
+  if (frames == 0)
+    return;
+
+  g_print ("\nSink lateness: avg %.1f ms, max %.1f ms, %" G_GUINT64_FORMAT " late frames\n",
+      lateness_sum / (gdouble) frames / 1000.0, lateness_max / 1000.0, late);
+  if (samples > 0)
+    g_print ("Glass-to-glass latency (sender capture clock): avg %.1f ms, max %.1f ms\n",
+        sum / (gdouble) samples / 1000.0, max / 1000.0);
+}
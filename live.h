@@ -0,0 +1,41 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <stdatomic.h>
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+typedef struct _Live {
+  guint latency_ms;
+  GstSegment segment;           /* video sink probe thread only */
+  GstElement *videosink;
+
+  /* Glass-to-glass samples, only from frames carrying the sender's NTP capture time */
+  atomic_uint_fast64_t latency_sum_us;
+  atomic_uint_fast64_t latency_max_us;
+  atomic_uint_fast64_t samples;
+  /* Sink lateness of every frame, how long after its render deadline it reached the sink */
+  atomic_uint_fast64_t lateness_sum_us;
+  atomic_uint_fast64_t lateness_max_us;
+  atomic_uint_fast64_t frames;
+  atomic_uint_fast64_t late;
+  atomic_uint_fast64_t pipeline_latency;  /* set by the control thread */
+
+  gint64 last_report;           /* control thread only */
+} Live;
+
+/* RTSP, RTP, UDP and SRT feeds are played in live mode */
+gboolean live_uri_is_live (const gchar *uri);
+
+Live *live_new (guint latency_ms);
+void live_free (Live *live);
+
+/* Minimal jitterbuffer and queue latency, no buffering, late frames dropped at the queues and sinks */
+void live_setup (Live *live, CustomData *data);
+/* Control thread: the pipeline latency changed, sinks render frames this much after their running time */
+void live_update_latency (Live *live, GstElement *pipeline);
+/* Control thread: print the sink lateness and, with a capture clock, the glass-to-glass latency of the last second */
+void live_report (Live *live);
+
+#endif
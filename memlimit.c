@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "memlimit.h"
+#include "player.h"
+
+#define TICK_INTERVAL G_USEC_PER_SEC
+/* Percent of the ceiling where the queues are cut, and where they may grow back */
+#define HIGH_MARK 90
+#define LOW_MARK 70
+#define CHANGE_SPACING (2 * G_USEC_PER_SEC)
+#define RECOVER_AFTER (30 * G_USEC_PER_SEC)
+#define WARNING_INTERVAL (10 * G_USEC_PER_SEC)
+#define MIN_QUEUE_BYTES (1024 * 1024)
+/* Audio gets this fraction of the queue bytes, raw video needs the rest */
+#define AUDIO_SHARE 8
+
+/* Decoder pool: the queued frames plus the ones being decoded, converted and shown
+ * or copied by a tee branch, and room for the reference frames of the codec */
+#define DECODER_HEADROOM 4
+#define DECODER_REFERENCES 16
+/* Frames allocated up front, the rest of the pool only when the queue fills */
+#define DECODER_PREALLOCATED 30
+/* Converter pool: the frame being converted, the sink's last frame and the widget's */
+#define CONVERT_MIN_BUFFERS 3
+#define CONVERT_MAX_BUFFERS 6
+
+
+guint64 memlimit_rss_kb (void) {
+  gchar *contents = NULL;
+  guint64 pages = 0;
+
+  if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    return 0;
+  if (sscanf (contents, "%*u %" G_GUINT64_FORMAT, &pages) != 1)
+    pages = 0;
+  g_free (contents);
+  return pages * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+/* Give the heap pages freed by the streaming threads back to the system */
+static void trim_heap (void) {
+#ifdef __GLIBC__
+  malloc_trim (0);
+#endif
+}
+
+static void pool_slot_init (PoolSlot *slot, MemLimit *owner, const gchar *name) {
+  slot->owner = owner;
+  slot->name = name;
+  g_mutex_init (&slot->lock);
+}
+
+static void pool_slot_clear (PoolSlot *slot) {
+  if (slot->pool != NULL)
+    gst_object_unref (slot->pool);
+  gst_caps_replace (&slot->caps, NULL);
+  g_mutex_clear (&slot->lock);
+}
+
+MemLimit *memlimit_new (guint rss_limit_mb, guint queue_mb) {
+  MemLimit *memlimit = g_new0 (MemLimit, 1);
+
+  memlimit->rss_limit_kb = (guint64) rss_limit_mb * 1024;
+  memlimit->queue_bytes = MAX ((guint64) queue_mb * 1024 * 1024, MIN_QUEUE_BYTES);
+  memlimit->bounded_pools = TRUE;
+  pool_slot_init (&memlimit->decoder, memlimit, "decoder");
+  pool_slot_init (&memlimit->convert, memlimit, "convert");
+  atomic_init (&memlimit->video_bytes, 0);
+  atomic_init (&memlimit->pools_created, 0);
+  atomic_init (&memlimit->pools_reused, 0);
+#ifdef __GLIBC__
+  /* One arena per streaming thread keeps freed frames out of reach of the others */
+  mallopt (M_ARENA_MAX, 4);
+#endif
+  return memlimit;
+}
+
+void memlimit_free (MemLimit *memlimit) {
+  if (memlimit == NULL)
+    return;
+
+  pool_slot_clear (&memlimit->decoder);
+  pool_slot_clear (&memlimit->convert);
+  g_free (memlimit);
+}
+
+static void cap_queue (GstElement *queue, guint default_bytes, guint64 cap) {
+  guint64 bytes = default_bytes > 0 ? MIN (default_bytes, cap) : cap;
+
+  g_object_set (queue, "max-size-bytes", (guint) MIN (bytes, G_MAXUINT), NULL);
+}
+
+static void apply_queue_caps (MemLimit *memlimit) {
+  CustomData *data = memlimit->data;
+  guint64 total = MAX (memlimit->queue_bytes >> memlimit->level, MIN_QUEUE_BYTES);
+  guint64 audio = total / AUDIO_SHARE;
+  guint64 video = total - audio;
+
+  atomic_store (&memlimit->video_bytes, video);
+  if (data->buffering != NULL) {
+    buffering_cap_bytes (data->buffering, video, audio);
+  } else {
+    cap_queue (data->video_queue, memlimit->video_default_bytes, video);
+    cap_queue (data->audio_queue, memlimit->audio_default_bytes, audio);
+  }
+}
+
+static gboolean is_system_memory (GstCaps *caps) {
+  GstCapsFeatures *features = gst_caps_get_features (caps, 0);
+
+  return features == NULL || gst_caps_features_is_equal (features, GST_CAPS_FEATURES_MEMORY_SYSTEM_MEMORY);
+}
+
+/* Same format as the last query, e.g. the next playlist item: hand out the same pool
+ * once its previous user released it, otherwise a new one replaces it */
+static GstBufferPool *slot_pool (MemLimit *memlimit, PoolSlot *slot, GstCaps *caps, guint size,
+    guint min, guint max, gboolean video_meta) {
+  GstBufferPool *pool;
+  GstStructure *config;
+
+  g_mutex_lock (&slot->lock);
+  if (slot->pool != NULL && !gst_buffer_pool_is_active (slot->pool) && gst_caps_is_equal (slot->caps, caps) &&
+      slot->min_buffers == min && slot->max_buffers == max) {
+    pool = gst_object_ref (slot->pool);
+    atomic_fetch_add (&memlimit->pools_reused, 1);
+    g_mutex_unlock (&slot->lock);
+    return pool;
+  }
+
+  pool = gst_video_buffer_pool_new ();
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, size, min, max);
+  if (video_meta)
+    gst_buffer_pool_config_add_option (config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+  if (!gst_buffer_pool_set_config (pool, config)) {
+    g_mutex_unlock (&slot->lock);
+    gst_object_unref (pool);
+    return NULL;
+  }
+
+  /* The previous pool lives on with its users and is freed with them */
+  if (slot->pool != NULL)
+    gst_object_unref (slot->pool);
+  slot->pool = gst_object_ref (pool);
+  gst_caps_replace (&slot->caps, caps);
+  slot->min_buffers = min;
+  slot->max_buffers = max;
+  atomic_fetch_add (&memlimit->pools_created, 1);
+  g_mutex_unlock (&slot->lock);
+
+  g_print ("Memory: %s pool of %u-%u frames, %u KB each\n", slot->name, min, max, size / 1024);
+  return pool;
+}
+
+static gboolean slot_owns (PoolSlot *slot, GstBufferPool *pool) {
+  gboolean owns;
+
+  g_mutex_lock (&slot->lock);
+  owns = slot->pool == pool;
+  g_mutex_unlock (&slot->lock);
+  return owns;
+}
+
+/* Streaming thread, after downstream answered the allocation query of the element
+ * upstream: make it allocate from a pool with a fixed number of frames, so it waits
+ * for one to be released instead of allocating more when the queue or sink lags */
+static GstPadProbeReturn allocation_probe_cb (GstPad *pad, GstPadProbeInfo *info, PoolSlot *slot) {
+  MemLimit *memlimit = slot->owner;
+  GstQuery *query = GST_PAD_PROBE_INFO_QUERY (info);
+  GstBufferPool *pool = NULL;
+  GstVideoInfo video_info;
+  GstCaps *caps;
+  gboolean need_pool, have_entry, video_meta;
+  guint size = 0, query_min = 0, query_max = 0, min, max;
+
+  if (GST_QUERY_TYPE (query) != GST_QUERY_ALLOCATION)
+    return GST_PAD_PROBE_OK;
+  gst_query_parse_allocation (query, &caps, &need_pool);
+  /* GL and dmabuf frames live in their own memory, see hwaccel.c */
+  if (caps == NULL || !is_system_memory (caps) || !gst_video_info_from_caps (&video_info, caps))
+    return GST_PAD_PROBE_OK;
+
+  if (slot == &memlimit->decoder) {
+    guint frames = atomic_load (&memlimit->video_bytes) / MAX (video_info.size, 1) + 1;
+    min = MIN (frames, DECODER_PREALLOCATED) + DECODER_HEADROOM;
+    max = frames + DECODER_HEADROOM + DECODER_REFERENCES;
+  } else {
+    min = CONVERT_MIN_BUFFERS;
+    max = CONVERT_MAX_BUFFERS;
+  }
+  if (!memlimit->bounded_pools)
+    max = 0;
+
+  have_entry = gst_query_get_n_allocation_pools (query) > 0;
+  if (have_entry)
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &query_min, &query_max);
+  /* A converter in passthrough forwarded the query, the sink-side pool is too small */
+  if (pool != NULL && slot == &memlimit->decoder && slot_owns (&memlimit->convert, pool)) {
+    gst_clear_object (&pool);
+    size = query_min = query_max = 0;
+  }
+  size = MAX (size, video_info.size);
+  /* Frames downstream keeps for itself come on top */
+  min += query_min;
+  if (max != 0)
+    max += query_min;
+
+  if (pool != NULL) {
+    /* Downstream brings its own memory, only bound how much of it is used */
+    if (query_max == 0)
+      gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+    gst_object_unref (pool);
+    return GST_PAD_PROBE_OK;
+  }
+
+  video_meta = gst_query_find_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+  pool = slot_pool (memlimit, slot, caps, size, min, max, video_meta);
+  if (pool == NULL)
+    return GST_PAD_PROBE_OK;
+  if (have_entry)
+    gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+  else
+    gst_query_add_allocation_pool (query, pool, size, min, max);
+  gst_object_unref (pool);
+  return GST_PAD_PROBE_OK;
+}
+
+static void bound_allocations (PoolSlot *slot, GstElement *element) {
+  GstPad *pad = gst_element_get_static_pad (element, "sink");
+
+  if (pad == NULL)
+    return;
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM | GST_PAD_PROBE_TYPE_PULL,
+      (GstPadProbeCallback) allocation_probe_cb, slot, NULL);
+  gst_object_unref (pad);
+}
+
+void memlimit_attach (MemLimit *memlimit, CustomData *data) {
+  memlimit->data = data;
+  /* A recording queues seconds of frames, a bounded pool would hold playback back to it */
+  memlimit->bounded_pools = data->record == NULL;
+
+  g_object_get (data->video_queue, "max-size-bytes", &memlimit->video_default_bytes, NULL);
+  g_object_get (data->audio_queue, "max-size-bytes", &memlimit->audio_default_bytes, NULL);
+  apply_queue_caps (memlimit);
+
+  bound_allocations (&memlimit->decoder, data->video_queue);
+  bound_allocations (&memlimit->convert, data->videosink);
+}
+
+/* The decoder asks for a pool again on its next frame, sized for the new queue cap,
+ * and drops the old one with the frames it held */
+static void request_reallocation (MemLimit *memlimit) {
+  GstPad *pad;
+
+  if (!memlimit->bounded_pools)
+    return;
+  pad = gst_element_get_static_pad (memlimit->data->video_queue, "sink");
+  gst_pad_push_event (pad, gst_event_new_reconfigure ());
+  gst_object_unref (pad);
+}
+
+static void set_level (MemLimit *memlimit, guint level, guint64 rss_kb, gint64 now) {
+  memlimit->level = level;
+  memlimit->last_change = now;
+  apply_queue_caps (memlimit);
+  request_reallocation (memlimit);
+  trim_heap ();
+  g_print ("Memory: RSS %" G_GUINT64_FORMAT " MB of %" G_GUINT64_FORMAT " MB, queues limited to %"
+      G_GUINT64_FORMAT " MB\n", rss_kb / 1024, memlimit->rss_limit_kb / 1024,
+      MAX (memlimit->queue_bytes >> level, MIN_QUEUE_BYTES) / (1024 * 1024));
+}
+
+void memlimit_tick (MemLimit *memlimit) {
+  gint64 now = g_get_monotonic_time ();
+  guint64 rss_kb;
+
+  if (memlimit == NULL || memlimit->data == NULL || now - memlimit->last_tick < TICK_INTERVAL)
+    return;
+  memlimit->last_tick = now;
+
+  rss_kb = memlimit_rss_kb ();
+  if (rss_kb == 0)
+    return;
+  memlimit->peak_rss_kb = MAX (memlimit->peak_rss_kb, rss_kb);
+
+  if (rss_kb > memlimit->rss_limit_kb) {
+    memlimit->breaches++;
+    if (memlimit->level == MEMLIMIT_MAX_LEVEL && now - memlimit->last_warning >= WARNING_INTERVAL) {
+      g_printerr ("Memory: RSS %" G_GUINT64_FORMAT " MB is over the %" G_GUINT64_FORMAT
+          " MB limit with the smallest queues.\n", rss_kb / 1024, memlimit->rss_limit_kb / 1024);
+      memlimit->last_warning = now;
+    }
+  }
+
+  /* Buffer less before the heap grows any further, then return to the full queues
+   * one step at a time once the memory use stayed low */
+  if (rss_kb >= memlimit->rss_limit_kb * HIGH_MARK / 100) {
+    memlimit->below_since = 0;
+    if (memlimit->level < MEMLIMIT_MAX_LEVEL && now - memlimit->last_change >= CHANGE_SPACING) {
+      memlimit->degrades++;
+      set_level (memlimit, memlimit->level + 1, rss_kb, now);
+    }
+  } else if (rss_kb < memlimit->rss_limit_kb * LOW_MARK / 100 && memlimit->level > 0) {
+    if (memlimit->below_since == 0) {
+      memlimit->below_since = now;
+    } else if (now - memlimit->below_since >= RECOVER_AFTER) {
+      memlimit->below_since = 0;
+      set_level (memlimit, memlimit->level - 1, rss_kb, now);
+    }
+  } else {
+    memlimit->below_since = 0;
+  }
+}
+
+void memlimit_report (MemLimit *memlimit) {
+  if (memlimit == NULL)
+    return;
+
+  memlimit->peak_rss_kb = MAX (memlimit->peak_rss_kb, memlimit_rss_kb ());
+  g_print ("Memory: peak RSS %" G_GUINT64_FORMAT " MB of %" G_GUINT64_FORMAT " MB, %u queue cuts, %"
+      G_GUINT64_FORMAT " s over the limit, %u pools created, %u reused\n", memlimit->peak_rss_kb / 1024,
+      memlimit->rss_limit_kb / 1024, memlimit->degrades, memlimit->breaches,
+      atomic_load (&memlimit->pools_created), atomic_load (&memlimit->pools_reused));
+}
+
+void memlimit_append_json (MemLimit *memlimit, GString *json) {
+  if (memlimit == NULL)
+    return;
+
+  memlimit->peak_rss_kb = MAX (memlimit->peak_rss_kb, memlimit_rss_kb ());
+  g_string_append_printf (json, ",\"memory\":{\"limit_kb\":%" G_GUINT64_FORMAT ",\"peak_rss_kb\":%" G_GUINT64_FORMAT
+      ",\"level\":%u,\"queue_cuts\":%u,\"seconds_over\":%" G_GUINT64_FORMAT ",\"pools_created\":%u,\"pools_reused\":%u}",
+      memlimit->rss_limit_kb, memlimit->peak_rss_kb, memlimit->level, memlimit->degrades, memlimit->breaches,
+      atomic_load (&memlimit->pools_created), atomic_load (&memlimit->pools_reused));
+}
@@ -0,0 +1,61 @@
+#ifndef MEMLIMIT_H
+#define MEMLIMIT_H
+
+#include <stdatomic.h>
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+/* Steps of queue shrinking before the ceiling is declared breached */
+#define MEMLIMIT_MAX_LEVEL 3
+
+/* Buffer pool handed to one allocation query, streaming threads only */
+typedef struct _PoolSlot {
+  struct _MemLimit *owner;
+  const gchar *name;
+  GMutex lock;
+  GstBufferPool *pool;
+  GstCaps *caps;
+  guint min_buffers;
+  guint max_buffers;
+} PoolSlot;
+
+typedef struct _MemLimit {
+  guint64 rss_limit_kb;
+  guint64 queue_bytes;          /* shared by audio_queue and video_queue */
+  gboolean bounded_pools;       /* FALSE while a recording holds frames for seconds */
+  CustomData *data;
+  guint video_default_bytes;    /* queue limits before the cap, used without a buffering preset */
+  guint audio_default_bytes;
+  _Atomic guint64 video_bytes;  /* current cap of video_queue, sizes the decoder pool */
+
+  PoolSlot decoder;             /* decoder -> video_queue */
+  PoolSlot convert;             /* converter -> video sink */
+  atomic_uint pools_created;
+  atomic_uint pools_reused;
+
+  /* Control thread only */
+  guint level;                  /* queues get queue_bytes >> level */
+  gint64 last_tick;
+  gint64 last_change;
+  gint64 below_since;
+  gint64 last_warning;
+  guint64 peak_rss_kb;
+  guint64 breaches;
+  guint degrades;
+} MemLimit;
+
+/* Resident set size of this process, 0 when unknown */
+guint64 memlimit_rss_kb (void);
+
+MemLimit *memlimit_new (guint rss_limit_mb, guint queue_mb);
+void memlimit_free (MemLimit *memlimit);
+
+/* Cap the queue bytes and bound the video buffer pools of the built pipeline */
+void memlimit_attach (MemLimit *memlimit, CustomData *data);
+/* Control thread: watch the RSS, shrink the queues near the ceiling, regrow them below it */
+void memlimit_tick (MemLimit *memlimit);
+void memlimit_report (MemLimit *memlimit);
+void memlimit_append_json (MemLimit *memlimit, GString *json);
+
+#endif
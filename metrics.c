@@ -0,0 +1,301 @@
+#include <time.h>
+
+#include "metrics.h"
+#include "player.h"
+
+typedef struct _OverlayUpdate {
+  Metrics *metrics;
+  gchar *text;
+} OverlayUpdate;
+
+
+static void record_thread (ThreadClock *tc) {
+  pthread_t self = pthread_self ();
+  clockid_t clock;
+
+  if (atomic_load_explicit (&tc->valid, memory_order_relaxed) && pthread_equal (tc->owner, self))
+    return;
+  if (pthread_getcpuclockid (self, &clock) != 0)
+    return;
+
+  tc->owner = self;
+  atomic_store_explicit (&tc->valid, FALSE, memory_order_relaxed);
+  tc->clock = clock;
+  atomic_store_explicit (&tc->valid, TRUE, memory_order_release);
+}
+
+/* Returns -1 until the thread has been seen or once it has exited */
+static gdouble thread_cpu_ms (ThreadClock *tc) {
+  struct timespec ts;
+
+  if (!atomic_load_explicit (&tc->valid, memory_order_acquire))
+    return -1;
+  if (clock_gettime (tc->clock, &ts) != 0)
+    return -1;
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static GstPadProbeReturn queue_probe_cb (GstPad *pad, GstPadProbeInfo *info, StreamMetrics *stream) {
+  atomic_fetch_add_explicit (&stream->decoded, 1, memory_order_relaxed);
+  record_thread (&stream->decode_thread);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn sink_probe_cb (GstPad *pad, GstPadProbeInfo *info, StreamMetrics *stream) {
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+      gst_event_copy_segment (event, &stream->segment);
+    return GST_PAD_PROBE_OK;
+  }
+
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  atomic_fetch_add_explicit (&stream->rendered, 1, memory_order_relaxed);
+  record_thread (&stream->render_thread);
+
+  if (GST_BUFFER_PTS_IS_VALID (buffer) && stream->segment.format == GST_FORMAT_TIME) {
+    guint64 running_time = gst_segment_to_running_time (&stream->segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+    if (GST_CLOCK_TIME_IS_VALID (running_time))
+      atomic_store_explicit (&stream->last_running_time, running_time, memory_order_relaxed);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+static void init_stream (StreamMetrics *stream, const gchar *name) {
+  stream->name = name;
+  stream->queue = NULL;
+  stream->sink = NULL;
+  atomic_init (&stream->decoded, 0);
+  atomic_init (&stream->rendered, 0);
+  atomic_init (&stream->last_running_time, GST_CLOCK_TIME_NONE);
+  atomic_init (&stream->decode_thread.valid, FALSE);
+  atomic_init (&stream->render_thread.valid, FALSE);
+  stream->decode_thread.last_cpu_ms = -1;
+  stream->render_thread.last_cpu_ms = -1;
+  gst_segment_init (&stream->segment, GST_FORMAT_UNDEFINED);
+  stream->dropped = 0;
+  stream->last_decoded = 0;
+  stream->last_rendered = 0;
+}
+
+Metrics *metrics_new (guint interval_ms, const gchar *json_path, gboolean overlay) {
+  Metrics *metrics = g_new0 (Metrics, 1);
+
+  init_stream (&metrics->streams[METRICS_STREAM_VIDEO], "video");
+  init_stream (&metrics->streams[METRICS_STREAM_AUDIO], "audio");
+  metrics->interval_ms = interval_ms;
+  metrics->start_time = g_get_monotonic_time ();
+  metrics->last_av_offset = G_MININT64;
+
+  if (json_path != NULL) {
+    metrics->json = g_strcmp0 (json_path, "-") == 0 ? stdout : fopen (json_path, "w");
+    if (metrics->json == NULL)
+      g_printerr ("Could not open '%s' for the stats export.\n", json_path);
+  }
+  if (overlay)
+    metrics->label = gtk_label_new (NULL);
+  return metrics;
+}
+
+void metrics_free (Metrics *metrics) {
+  if (metrics == NULL)
+    return;
+  if (metrics->json != NULL && metrics->json != stdout)
+    fclose (metrics->json);
+  g_free (metrics);
+}
+
+static void attach_stream (StreamMetrics *stream, GstElement *queue, GstElement *sink) {
+  GstPad *pad;
+
+  stream->queue = queue;
+  stream->sink = sink;
+
+  pad = gst_element_get_static_pad (queue, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) queue_probe_cb, stream, NULL);
+  gst_object_unref (pad);
+
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      (GstPadProbeCallback) sink_probe_cb, stream, NULL);
+  gst_object_unref (pad);
+}
+
+void metrics_attach (Metrics *metrics, CustomData *data) {
+  attach_stream (&metrics->streams[METRICS_STREAM_VIDEO], data->video_queue, data->videosink);
+  attach_stream (&metrics->streams[METRICS_STREAM_AUDIO], data->audio_queue, data->asink);
+}
+
+GtkWidget *metrics_create_overlay (Metrics *metrics, GtkWidget *sink_widget) {
+  GtkWidget *overlay;
+
+  if (metrics == NULL || metrics->label == NULL)
+    return sink_widget;
+
+  overlay = gtk_overlay_new ();
+  gtk_container_add (GTK_CONTAINER (overlay), sink_widget);
+  gtk_widget_set_halign (metrics->label, GTK_ALIGN_START);
+  gtk_widget_set_valign (metrics->label, GTK_ALIGN_START);
+  gtk_label_set_xalign (GTK_LABEL (metrics->label), 0);
+  gtk_overlay_add_overlay (GTK_OVERLAY (overlay), metrics->label);
+  return overlay;
+}
+
+void metrics_handle_qos (Metrics *metrics, GstMessage *msg) {
+  GstObject *src = GST_MESSAGE_SRC (msg);
+  GstFormat format;
+  guint64 processed, dropped;
+  guint i;
+
+  if (metrics == NULL)
+    return;
+
+  for (i = 0; i < METRICS_N_STREAMS; i++) {
+    StreamMetrics *stream = &metrics->streams[i];
+    if (stream->sink == NULL)
+      continue;
+    if (src != GST_OBJECT (stream->sink) && !gst_object_has_as_ancestor (src, GST_OBJECT (stream->sink)))
+      continue;
+
+    /* Counters are cumulative, only frame counts are comparable with the probes */
+    gst_message_parse_qos_stats (msg, &format, &processed, &dropped);
+    if (dropped == (guint64) -1)
+      return;
+    if (format == GST_FORMAT_BUFFERS) {
+      stream->dropped = dropped;
+    } else if (format == GST_FORMAT_DEFAULT && processed != (guint64) -1 && processed + dropped > 0) {
+      /* Audio sinks count samples, scale their dropped share to the buffers that reached the sink */
+      guint64 rendered = atomic_load_explicit (&stream->rendered, memory_order_relaxed);
+      stream->dropped = (guint64) ((gdouble) dropped / (processed + dropped) * rendered);
+    }
+    return;
+  }
+}
+
+
+void metrics_append_double (GString *str, const gchar *key, gdouble value, guint decimals) {
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar format[8];
+
+  /* Locale independent, JSON needs the dot */
+  g_snprintf (format, sizeof (format), "%%.%uf", MIN (decimals, 9));
+  g_string_append_printf (str, "\"%s\":%s", key, g_ascii_formatd (buf, sizeof (buf), format, value));
+}
+
+static gdouble cpu_percent (ThreadClock *tc, gdouble elapsed_ms) {
+  gdouble now_ms = thread_cpu_ms (tc);
+  gdouble percent = 0;
+
+  if (now_ms >= 0 && tc->last_cpu_ms >= 0 && elapsed_ms > 0)
+    percent = 100.0 * (now_ms - tc->last_cpu_ms) / elapsed_ms;
+  tc->last_cpu_ms = now_ms;
+  return percent;
+}
+
+static gboolean update_overlay (OverlayUpdate *update) {
+  gtk_label_set_text (GTK_LABEL (update->metrics->label), update->text);
+  return G_SOURCE_REMOVE;
+}
+
+static void free_overlay_update (OverlayUpdate *update) {
+  g_free (update->text);
+  g_free (update);
+}
+
+static gboolean metrics_sample (Metrics *metrics) {
+  gint64 now = g_get_monotonic_time ();
+  gdouble elapsed_ms = (now - metrics->last_sample_time) / 1000.0;
+  GString *json = g_string_new (NULL);
+  GString *text = g_string_new (NULL);
+  gint64 video_rt, audio_rt, av_offset = G_MININT64;
+  guint i;
+
+  g_string_append_printf (json, "{\"time_ms\":%" G_GINT64_FORMAT ",\"streams\":{", (now - metrics->start_time) / 1000);
+
+  for (i = 0; i < METRICS_N_STREAMS; i++) {
+    StreamMetrics *stream = &metrics->streams[i];
+    guint64 decoded = atomic_load_explicit (&stream->decoded, memory_order_relaxed);
+    guint64 rendered = atomic_load_explicit (&stream->rendered, memory_order_relaxed);
+    /* Buffers reaching the sink minus the ones it reported as dropped */
+    guint64 shown = rendered > stream->dropped ? rendered - stream->dropped : 0;
+    gdouble rate = elapsed_ms > 0 ? (decoded - stream->last_decoded) * 1000.0 / elapsed_ms : 0;
+    gdouble decode_cpu = cpu_percent (&stream->decode_thread, elapsed_ms);
+    gdouble render_cpu = cpu_percent (&stream->render_thread, elapsed_ms);
+    guint level_buffers = 0, level_bytes = 0;
+    guint64 level_time = 0;
+
+    if (stream->queue != NULL)
+      g_object_get (stream->queue, "current-level-buffers", &level_buffers,
+          "current-level-bytes", &level_bytes, "current-level-time", &level_time, NULL);
+
+    g_string_append_printf (json, "%s\"%s\":{", i ? "," : "", stream->name);
+    metrics_append_double (json, "rate", rate, 1);
+    g_string_append_printf (json, ",\"decoded\":%" G_GUINT64_FORMAT ",\"rendered\":%" G_GUINT64_FORMAT
+        ",\"dropped\":%" G_GUINT64_FORMAT ",\"queue\":{\"buffers\":%u,\"bytes\":%u,\"time_ms\":%" G_GUINT64_FORMAT "},\"cpu\":{",
+        decoded, shown, stream->dropped, level_buffers, level_bytes, level_time / GST_MSECOND);
+    metrics_append_double (json, "decode_percent", decode_cpu, 1);
+    g_string_append_c (json, ',');
+    metrics_append_double (json, "render_percent", render_cpu, 1);
+    g_string_append (json, "}}");
+
+    g_string_append_printf (text, "%s: %.1f/s  rendered %" G_GUINT64_FORMAT "  dropped %" G_GUINT64_FORMAT "\n"
+        "  queue %u buf / %u KB / %" G_GUINT64_FORMAT " ms  cpu %.0f%% + %.0f%%\n",
+        stream->name, rate, shown, stream->dropped, level_buffers, level_bytes / 1024,
+        level_time / GST_MSECOND, decode_cpu, render_cpu);
+
+    stream->last_decoded = decoded;
+    stream->last_rendered = rendered;
+  }
+  g_string_append_c (json, '}');
+
+  /* Running times of the last buffers that reached each sink */
+  video_rt = atomic_load_explicit (&metrics->streams[METRICS_STREAM_VIDEO].last_running_time, memory_order_relaxed);
+  audio_rt = atomic_load_explicit (&metrics->streams[METRICS_STREAM_AUDIO].last_running_time, memory_order_relaxed);
+  if (GST_CLOCK_TIME_IS_VALID (video_rt) && GST_CLOCK_TIME_IS_VALID (audio_rt)) {
+    av_offset = video_rt - audio_rt;
+    g_string_append_c (json, ',');
+    metrics_append_double (json, "av_offset_ms", av_offset / (gdouble) GST_MSECOND, 1);
+    g_string_append_printf (text, "A/V offset %.1f ms", av_offset / (gdouble) GST_MSECOND);
+    if (metrics->last_av_offset != G_MININT64) {
+      g_string_append_c (json, ',');
+      metrics_append_double (json, "av_drift_ms", (av_offset - metrics->last_av_offset) / (gdouble) GST_MSECOND, 1);
+      g_string_append_printf (text, "  drift %.1f ms", (av_offset - metrics->last_av_offset) / (gdouble) GST_MSECOND);
+    }
+  }
+  metrics->last_av_offset = av_offset;
+  metrics->last_sample_time = now;
+  g_string_append (json, "}\n");
+
+  if (metrics->json != NULL) {
+    fputs (json->str, metrics->json);
+    fflush (metrics->json);
+  }
+
+  if (metrics->label != NULL) {
+    OverlayUpdate *update = g_new (OverlayUpdate, 1);
+    update->metrics = metrics;
+    update->text = g_string_free (text, FALSE);
+    g_main_context_invoke_full (NULL, G_PRIORITY_DEFAULT, (GSourceFunc) update_overlay, update,
+        (GDestroyNotify) free_overlay_update);
+  } else {
+    g_string_free (text, TRUE);
+  }
+  g_string_free (json, TRUE);
+  return G_SOURCE_CONTINUE;
+}
+
+void metrics_set_running (Metrics *metrics, GMainContext *context, gboolean running) {
+  if (metrics == NULL)
+    return;
+
+  if (running && metrics->timer == NULL) {
+    metrics->last_sample_time = g_get_monotonic_time ();
+    metrics->timer = g_timeout_source_new (metrics->interval_ms);
+    g_source_set_callback (metrics->timer, (GSourceFunc) metrics_sample, metrics, NULL);
+    g_source_attach (metrics->timer, context);
+  } else if (!running && metrics->timer != NULL) {
+    g_source_destroy (metrics->timer);
+    g_source_unref (metrics->timer);
+    metrics->timer = NULL;
+  }
+}
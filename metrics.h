@@ -0,0 +1,73 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+/* CPU clock of the thread that last ran a probe, published with a flag */
+typedef struct _ThreadClock {
+  pthread_t owner;              /* probe thread only */
+  clockid_t clock;
+  atomic_bool valid;
+  gdouble last_cpu_ms;          /* control thread only */
+} ThreadClock;
+
+typedef struct _StreamMetrics {
+  const gchar *name;
+  GstElement *queue;
+  GstElement *sink;
+
+  /* Updated from the streaming threads */
+  atomic_uint_fast64_t decoded;
+  atomic_uint_fast64_t rendered;
+  _Atomic gint64 last_running_time;
+  ThreadClock decode_thread;
+  ThreadClock render_thread;
+  GstSegment segment;           /* sink probe thread only */
+
+  /* Control thread only */
+  guint64 dropped;
+  guint64 last_decoded;
+  guint64 last_rendered;
+} StreamMetrics;
+
+enum {
+  METRICS_STREAM_VIDEO,
+  METRICS_STREAM_AUDIO,
+  METRICS_N_STREAMS
+};
+
+typedef struct _Metrics {
+  StreamMetrics streams[METRICS_N_STREAMS];
+  guint interval_ms;
+  FILE *json;
+  GtkWidget *label;             /* UI thread only, NULL without overlay */
+  GSource *timer;
+  gint64 start_time;
+  gint64 last_sample_time;
+  gint64 last_av_offset;
+} Metrics;
+
+/* json_path may be NULL (no export) or "-" for stdout */
+Metrics *metrics_new (guint interval_ms, const gchar *json_path, gboolean overlay);
+void metrics_free (Metrics *metrics);
+
+/* Install the counting probes on the queues and sinks of the built pipeline */
+void metrics_attach (Metrics *metrics, CustomData *data);
+/* Wrap the video widget into an overlay showing the stats, returns the widget to pack */
+GtkWidget *metrics_create_overlay (Metrics *metrics, GtkWidget *sink_widget);
+
+/* Control thread: sample only while PLAYING */
+void metrics_set_running (Metrics *metrics, GMainContext *context, gboolean running);
+void metrics_handle_qos (Metrics *metrics, GstMessage *msg);
+
+/* "key":value with a fixed number of decimals, shared by the JSON writers */
+void metrics_append_double (GString *str, const gchar *key, gdouble value, guint decimals);
+
+#endif
@@ -0,0 +1,293 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <gst/gst.h>
+
+#include "mmapsrc.h"
+
+/* Pages hinted ahead of the read position, and after a seek target */
+#define READAHEAD_BYTES (8 * 1024 * 1024)
+/* Buffers are free to make, fewer of them means fewer pushes */
+#define PUSH_BLOCKSIZE (1024 * 1024)
+
+/* Outlives the element state while downstream still holds buffers */
+typedef struct _Mapping {
+  grefcount ref;
+  guint8 *data;
+  gsize size;
+} Mapping;
+
+struct _MmapSrc {
+  GstBaseSrc parent;
+  gchar *location;
+  Mapping *mapping;
+
+  /* Streaming thread only */
+  guint64 position;             /* end of the last buffer */
+  guint64 advised_until;
+};
+
+enum {
+  PROP_0,
+  PROP_LOCATION
+};
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static void mmap_src_uri_handler_init (gpointer g_iface, gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE (MmapSrc, mmap_src, GST_TYPE_BASE_SRC,
+    G_IMPLEMENT_INTERFACE (GST_TYPE_URI_HANDLER, mmap_src_uri_handler_init));
+
+
+static Mapping *mapping_ref (Mapping *mapping) {
+  g_ref_count_inc (&mapping->ref);
+  return mapping;
+}
+
+static void mapping_unref (Mapping *mapping) {
+  if (!g_ref_count_dec (&mapping->ref))
+    return;
+  munmap (mapping->data, mapping->size);
+  g_free (mapping);
+}
+
+/* madvise wants page aligned ranges */
+static void advise (Mapping *mapping, guint64 offset, guint64 length, gint advice) {
+  guint64 page = (guint64) sysconf (_SC_PAGESIZE);
+  guint64 start = offset / page * page;
+  guint64 end = MIN (offset + length, mapping->size);
+
+  if (start < end)
+    madvise (mapping->data + start, end - start, advice);
+}
+
+static gboolean mmap_src_start (GstBaseSrc *basesrc) {
+  MmapSrc *src = MMAP_SRC (basesrc);
+  struct stat st;
+  Mapping *mapping;
+  void *data;
+  gint fd;
+
+  if (src->location == NULL) {
+    GST_ELEMENT_ERROR (src, RESOURCE, NOT_FOUND, ("No file name specified."), (NULL));
+    return FALSE;
+  }
+
+  fd = open (src->location, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    GST_ELEMENT_ERROR (src, RESOURCE, OPEN_READ, ("Could not open file \"%s\".", src->location),
+        ("%s", g_strerror (errno)));
+    return FALSE;
+  }
+  if (fstat (fd, &st) < 0 || !S_ISREG (st.st_mode) || st.st_size == 0) {
+    GST_ELEMENT_ERROR (src, RESOURCE, OPEN_READ, ("\"%s\" is not a regular non-empty file.", src->location), (NULL));
+    close (fd);
+    return FALSE;
+  }
+
+  /* The mapping stays valid after close, truncating the file under it would SIGBUS */
+  data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED) {
+    GST_ELEMENT_ERROR (src, RESOURCE, OPEN_READ, ("Could not map file \"%s\".", src->location),
+        ("%s", g_strerror (errno)));
+    return FALSE;
+  }
+
+  mapping = g_new0 (Mapping, 1);
+  g_ref_count_init (&mapping->ref);
+  mapping->data = data;
+  mapping->size = st.st_size;
+  src->mapping = mapping;
+
+  /* Playback reads front to back, let the kernel read ahead aggressively */
+  advise (mapping, 0, mapping->size, MADV_SEQUENTIAL);
+  advise (mapping, 0, READAHEAD_BYTES, MADV_WILLNEED);
+  src->position = 0;
+  src->advised_until = READAHEAD_BYTES;
+  return TRUE;
+}
+
+static gboolean mmap_src_stop (GstBaseSrc *basesrc) {
+  MmapSrc *src = MMAP_SRC (basesrc);
+
+  g_clear_pointer (&src->mapping, mapping_unref);
+  return TRUE;
+}
+
+static gboolean mmap_src_get_size (GstBaseSrc *basesrc, guint64 *size) {
+  MmapSrc *src = MMAP_SRC (basesrc);
+
+  if (src->mapping == NULL)
+    return FALSE;
+  *size = src->mapping->size;
+  return TRUE;
+}
+
+static gboolean mmap_src_is_seekable (GstBaseSrc *basesrc) {
+  return TRUE;
+}
+
+static GstFlowReturn mmap_src_create (GstBaseSrc *basesrc, guint64 offset, guint length, GstBuffer **buffer) {
+  MmapSrc *src = MMAP_SRC (basesrc);
+  Mapping *mapping = src->mapping;
+  GstMemory *memory;
+  GstBuffer *buf;
+
+  if (offset >= mapping->size)
+    return GST_FLOW_EOS;
+  length = MIN (length, mapping->size - offset);
+
+  if (offset != src->position) {
+    /* A seek or a demuxer pulling elsewhere, fetch the new area right away */
+    advise (mapping, offset, READAHEAD_BYTES, MADV_WILLNEED);
+    src->advised_until = offset + READAHEAD_BYTES;
+  } else if (offset + length + READAHEAD_BYTES / 2 > src->advised_until) {
+    /* Keep a window ahead of the reader in flight */
+    advise (mapping, src->advised_until, READAHEAD_BYTES, MADV_WILLNEED);
+    src->advised_until += READAHEAD_BYTES;
+  }
+  src->position = offset + length;
+
+  /* No copy, the buffer points into the page cache */
+  memory = gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY, mapping->data + offset, length, 0, length,
+      mapping_ref (mapping), (GDestroyNotify) mapping_unref);
+  buf = gst_buffer_new ();
+  gst_buffer_append_memory (buf, memory);
+  GST_BUFFER_OFFSET (buf) = offset;
+  GST_BUFFER_OFFSET_END (buf) = offset + length;
+  *buffer = buf;
+  return GST_FLOW_OK;
+}
+
+static gboolean mmap_src_set_location (MmapSrc *src, const gchar *location, GError **error) {
+  GstState state;
+
+  GST_OBJECT_LOCK (src);
+  state = GST_STATE (src);
+  if (state != GST_STATE_NULL && state != GST_STATE_READY) {
+    GST_OBJECT_UNLOCK (src);
+    g_set_error (error, GST_URI_ERROR, GST_URI_ERROR_BAD_STATE, "Changing the location of an open file is not supported.");
+    return FALSE;
+  }
+  g_free (src->location);
+  src->location = g_strdup (location);
+  GST_OBJECT_UNLOCK (src);
+  return TRUE;
+}
+
+static void mmap_src_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec) {
+  MmapSrc *src = MMAP_SRC (object);
+
+  switch (prop_id) {
+    case PROP_LOCATION:
+      mmap_src_set_location (src, g_value_get_string (value), NULL);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void mmap_src_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec) {
+  MmapSrc *src = MMAP_SRC (object);
+
+  switch (prop_id) {
+    case PROP_LOCATION:
+      GST_OBJECT_LOCK (src);
+      g_value_set_string (value, src->location);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void mmap_src_finalize (GObject *object) {
+  MmapSrc *src = MMAP_SRC (object);
+
+  g_free (src->location);
+  G_OBJECT_CLASS (mmap_src_parent_class)->finalize (object);
+}
+
+static void mmap_src_class_init (MmapSrcClass *klass) {
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSrcClass *basesrc_class = GST_BASE_SRC_CLASS (klass);
+
+  object_class->set_property = mmap_src_set_property;
+  object_class->get_property = mmap_src_get_property;
+  object_class->finalize = mmap_src_finalize;
+  g_object_class_install_property (object_class, PROP_LOCATION,
+      g_param_spec_string ("location", "File Location", "Location of the file to map", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+  gst_element_class_set_static_metadata (element_class, "Memory mapped file source", "Source/File",
+      "Reads a local file through mmap without copying", "Open pipe media player");
+
+  basesrc_class->start = mmap_src_start;
+  basesrc_class->stop = mmap_src_stop;
+  basesrc_class->get_size = mmap_src_get_size;
+  basesrc_class->is_seekable = mmap_src_is_seekable;
+  basesrc_class->create = mmap_src_create;
+}
+
+static void mmap_src_init (MmapSrc *src) {
+  gst_base_src_set_blocksize (GST_BASE_SRC (src), PUSH_BLOCKSIZE);
+}
+
+static GstURIType mmap_src_uri_get_type (GType type) {
+  return GST_URI_SRC;
+}
+
+static const gchar * const *mmap_src_uri_get_protocols (GType type) {
+  static const gchar *protocols[] = { "file", NULL };
+
+  return protocols;
+}
+
+static gchar *mmap_src_uri_get_uri (GstURIHandler *handler) {
+  MmapSrc *src = MMAP_SRC (handler);
+  gchar *uri = NULL;
+
+  GST_OBJECT_LOCK (src);
+  if (src->location != NULL)
+    uri = gst_filename_to_uri (src->location, NULL);
+  GST_OBJECT_UNLOCK (src);
+  return uri;
+}
+
+static gboolean mmap_src_uri_set_uri (GstURIHandler *handler, const gchar *uri, GError **error) {
+  gchar *location = g_filename_from_uri (uri, NULL, NULL);
+  gboolean set;
+
+  if (location == NULL) {
+    g_set_error (error, GST_URI_ERROR, GST_URI_ERROR_BAD_URI, "Invalid file URI '%s'", uri);
+    return FALSE;
+  }
+  set = mmap_src_set_location (MMAP_SRC (handler), location, error);
+  g_free (location);
+  return set;
+}
+
+static void mmap_src_uri_handler_init (gpointer g_iface, gpointer iface_data) {
+  GstURIHandlerInterface *iface = (GstURIHandlerInterface *) g_iface;
+
+  iface->get_type = mmap_src_uri_get_type;
+  iface->get_protocols = mmap_src_uri_get_protocols;
+  iface->get_uri = mmap_src_uri_get_uri;
+  iface->set_uri = mmap_src_uri_set_uri;
+}
+
+gboolean mmap_src_register (void) {
+  /* uridecodebin and urisourcebin take the highest ranked handler of the protocol */
+  return gst_element_register (NULL, "mmapsrc", GST_RANK_PRIMARY + 1, MMAP_TYPE_SRC);
+}
@@ -0,0 +1,18 @@
+#ifndef MMAPSRC_H
+#define MMAPSRC_H
+
+#include <gst/gst.h>
+#include <gst/base/gstbasesrc.h>
+
+G_BEGIN_DECLS
+
+/* Local file source handing out read-only memory wrapping the mapped file */
+#define MMAP_TYPE_SRC (mmap_src_get_type ())
+G_DECLARE_FINAL_TYPE (MmapSrc, mmap_src, MMAP, SRC, GstBaseSrc)
+
+/* Register mmapsrc in-process, ranked above filesrc for file:// URIs */
+gboolean mmap_src_register (void);
+
+G_END_DECLS
+
+#endif
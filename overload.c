@@ -0,0 +1,223 @@
+#include <string.h>
+
+#include <gst/gst.h>
+
+#include "overload.h"
+#include "player.h"
+
+/* Decisions are taken on one second of QoS stats */
+#define WINDOW_US G_USEC_PER_SEC
+/* Let the last change take effect before judging it */
+#define SETTLE_US (2 * G_USEC_PER_SEC)
+#define RECOVER_MIN_US (5 * G_USEC_PER_SEC)
+#define RECOVER_MAX_US (60 * G_USEC_PER_SEC)
+
+/* Overloaded: this share of frames dropped, or frames this late */
+#define DROP_RATIO_HIGH 0.05
+#define JITTER_HIGH (100 * GST_MSECOND)
+/* Calm: nothing dropped and frames about on time */
+#define JITTER_LOW (20 * GST_MSECOND)
+
+static const gchar *level_names[OVERLOAD_N_LEVELS] = {
+  "normal", "skipping non-reference frames", "reduced decode resolution", "keyframes only"
+};
+
+typedef struct _OverloadDecoder {
+  Overload *overload;
+  GstElement *element;
+  gboolean has_skip_frame;
+  gboolean has_lowres;
+  gboolean dropping;            /* probe thread: waiting for a keyframe */
+} OverloadDecoder;
+
+
+static void overload_decoder_free (OverloadDecoder *decoder) {
+  gst_object_unref (decoder->element);
+  g_free (decoder);
+}
+
+Overload *overload_new (void) {
+  Overload *overload = g_new0 (Overload, 1);
+
+  g_mutex_init (&overload->lock);
+  overload->decoders = g_ptr_array_new_with_free_func ((GDestroyNotify) overload_decoder_free);
+  overload->recover_after = RECOVER_MIN_US;
+  return overload;
+}
+
+void overload_free (Overload *overload) {
+  if (overload == NULL)
+    return;
+  g_ptr_array_unref (overload->decoders);
+  g_mutex_clear (&overload->lock);
+  g_free (overload);
+}
+
+/* Decoders without a skip option lose their non-reference frames before decoding instead,
+ * and once a keyframe-only period ends they resume at the next keyframe */
+static GstPadProbeReturn decoder_probe_cb (GstPad *pad, GstPadProbeInfo *info, OverloadDecoder *decoder) {
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  gint level = atomic_load (&decoder->overload->level);
+  gboolean delta = GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  if (level >= OVERLOAD_KEYFRAMES) {
+    decoder->dropping = delta;
+    return delta ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+  }
+  if (decoder->dropping) {
+    if (delta)
+      return GST_PAD_PROBE_DROP;
+    decoder->dropping = FALSE;
+  }
+  if (level >= OVERLOAD_SKIP_NONREF && !decoder->has_skip_frame &&
+      GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DROPPABLE))
+    return GST_PAD_PROBE_DROP;
+  return GST_PAD_PROBE_OK;
+}
+
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, Overload *overload) {
+  const gchar *klass = gst_element_get_metadata (element, GST_ELEMENT_METADATA_KLASS);
+  GObjectClass *object_class = G_OBJECT_GET_CLASS (element);
+  OverloadDecoder *decoder;
+  GstPad *pad;
+
+  if (klass == NULL || strstr (klass, "Decoder") == NULL || strstr (klass, "Video") == NULL)
+    return;
+
+  decoder = g_new0 (OverloadDecoder, 1);
+  decoder->overload = overload;
+  decoder->element = gst_object_ref (element);
+  /* gst-libav: skip-frame 1 skips B/non-reference frames, lowres 1 decodes at half size */
+  decoder->has_skip_frame = g_object_class_find_property (object_class, "skip-frame") != NULL;
+  decoder->has_lowres = g_object_class_find_property (object_class, "lowres") != NULL;
+
+  pad = gst_element_get_static_pad (element, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) decoder_probe_cb, decoder, NULL);
+  gst_object_unref (pad);
+
+  g_mutex_lock (&overload->lock);
+  g_ptr_array_add (overload->decoders, decoder);
+  g_mutex_unlock (&overload->lock);
+}
+
+/* Playlist items and decodebin3 reconfiguration take decoders away */
+static void deep_element_removed_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, Overload *overload) {
+  guint i;
+
+  g_mutex_lock (&overload->lock);
+  for (i = 0; i < overload->decoders->len; i++) {
+    OverloadDecoder *decoder = g_ptr_array_index (overload->decoders, i);
+    if (decoder->element == element) {
+      /* The probe still points at it until the pad goes away with the element */
+      g_ptr_array_steal_index_fast (overload->decoders, i);
+      g_object_set_data_full (G_OBJECT (element), "overload-decoder", decoder, g_free);
+      gst_object_unref (element);
+      break;
+    }
+  }
+  g_mutex_unlock (&overload->lock);
+}
+
+void overload_attach (Overload *overload, CustomData *data) {
+  overload->videosink = data->videosink;
+  g_signal_connect (data->pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), overload);
+  g_signal_connect (data->pipeline, "deep-element-removed", G_CALLBACK (deep_element_removed_cb), overload);
+}
+
+void overload_handle_qos (Overload *overload, GstMessage *msg) {
+  GstObject *src = GST_MESSAGE_SRC (msg);
+  GstFormat format;
+  guint64 processed, dropped;
+  gint64 jitter;
+
+  if (overload == NULL || !gst_object_has_as_ancestor (src, GST_OBJECT (overload->videosink)))
+    return;
+
+  gst_message_parse_qos_values (msg, &jitter, NULL, NULL);
+  overload->window_jitter = MAX (overload->window_jitter, jitter);
+
+  /* Cumulative counters, a smaller value means the sink was reset */
+  gst_message_parse_qos_stats (msg, &format, &processed, &dropped);
+  if (format != GST_FORMAT_BUFFERS || processed == (guint64) -1 || dropped == (guint64) -1)
+    return;
+  if (processed >= overload->processed && dropped >= overload->dropped) {
+    overload->window_processed += processed - overload->processed;
+    overload->window_dropped += dropped - overload->dropped;
+  }
+  overload->processed = processed;
+  overload->dropped = dropped;
+}
+
+static gboolean any_lowres (Overload *overload) {
+  gboolean found = FALSE;
+  guint i;
+
+  for (i = 0; i < overload->decoders->len && !found; i++)
+    found = ((OverloadDecoder *) g_ptr_array_index (overload->decoders, i))->has_lowres;
+  return found;
+}
+
+static void set_level (Overload *overload, gint level) {
+  guint i;
+
+  g_mutex_lock (&overload->lock);
+  /* Reduced resolution is not a step when no decoder can do it */
+  if (level == OVERLOAD_LOWRES && !any_lowres (overload))
+    level = level > atomic_load (&overload->level) ? OVERLOAD_KEYFRAMES : OVERLOAD_SKIP_NONREF;
+
+  atomic_store (&overload->level, level);
+  for (i = 0; i < overload->decoders->len; i++) {
+    OverloadDecoder *decoder = g_ptr_array_index (overload->decoders, i);
+    if (decoder->has_skip_frame)
+      g_object_set (decoder->element, "skip-frame", level >= OVERLOAD_SKIP_NONREF ? 1 : 0, NULL);
+    if (decoder->has_lowres)
+      g_object_set (decoder->element, "lowres", level >= OVERLOAD_LOWRES ? 1 : 0, NULL);
+  }
+  g_mutex_unlock (&overload->lock);
+
+  g_print ("\nVideo overload policy: %s\n", level_names[level]);
+}
+
+void overload_tick (Overload *overload) {
+  gint64 now = g_get_monotonic_time ();
+  gint level;
+  guint64 total;
+  gdouble drop_ratio;
+  gboolean overloaded, calm;
+
+  if (overload == NULL)
+    return;
+  if (overload->window_start == 0)
+    overload->window_start = overload->last_change = overload->calm_since = now;
+  if (now - overload->window_start < WINDOW_US)
+    return;
+
+  level = atomic_load (&overload->level);
+  total = overload->window_processed + overload->window_dropped;
+  drop_ratio = total > 0 ? overload->window_dropped / (gdouble) total : 0;
+  overloaded = drop_ratio > DROP_RATIO_HIGH || overload->window_jitter > JITTER_HIGH;
+  calm = overload->window_dropped == 0 && overload->window_jitter < JITTER_LOW;
+
+  overload->window_processed = 0;
+  overload->window_dropped = 0;
+  overload->window_jitter = 0;
+  overload->window_start = now;
+  if (!calm)
+    overload->calm_since = now;
+
+  if (now - overload->last_change < SETTLE_US)
+    return;
+
+  if (overloaded && level < OVERLOAD_KEYFRAMES) {
+    /* Overloaded again right after recovering, stay down longer next time */
+    if (now - overload->last_recover < overload->recover_after)
+      overload->recover_after = MIN (overload->recover_after * 2, RECOVER_MAX_US);
+    else if (now - overload->last_recover >= RECOVER_MAX_US)
+      overload->recover_after = RECOVER_MIN_US;
+    set_level (overload, level + 1);
+    overload->last_change = overload->calm_since = now;
+  } else if (calm && level > OVERLOAD_NORMAL && now - overload->calm_since >= overload->recover_after) {
+    set_level (overload, level - 1);
+    overload->last_change = overload->last_recover = overload->calm_since = now;
+  }
+}
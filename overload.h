@@ -0,0 +1,48 @@
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include <stdatomic.h>
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+/* Escalation steps, each one keeps the previous ones */
+typedef enum {
+  OVERLOAD_NORMAL,
+  OVERLOAD_SKIP_NONREF,         /* decoders skip non-reference frames */
+  OVERLOAD_LOWRES,              /* decoders that can decode at reduced resolution do */
+  OVERLOAD_KEYFRAMES,           /* only keyframes reach the video decoders */
+  OVERLOAD_N_LEVELS
+} OverloadLevel;
+
+typedef struct _Overload {
+  GstElement *videosink;
+  atomic_int level;             /* written by the control thread, read by the decoder probes */
+
+  GMutex lock;
+  GPtrArray *decoders;          /* OverloadDecoder */
+
+  /* Control thread only */
+  guint64 processed;
+  guint64 dropped;
+  guint64 window_processed;
+  guint64 window_dropped;
+  gint64 window_jitter;         /* worst lateness seen in the window, ns */
+  gint64 window_start;
+  gint64 last_change;
+  gint64 last_recover;
+  gint64 calm_since;
+  gint64 recover_after;         /* calm period before stepping down, backs off on flapping */
+} Overload;
+
+Overload *overload_new (void);
+void overload_free (Overload *overload);
+
+/* Track the video decoders and the video sink of the pipeline */
+void overload_attach (Overload *overload, CustomData *data);
+/* Control thread: account the video sink QoS stats */
+void overload_handle_qos (Overload *overload, GstMessage *msg);
+/* Control thread, called while PLAYING: escalate or recover once per window */
+void overload_tick (Overload *overload);
+
+#endif
@@ -0,0 +1,185 @@
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+
+#include "pacing.h"
+#include "player.h"
+
+#define PACING_REPORT_INTERVAL (5 * G_USEC_PER_SEC)
+/* Ahead of the paint of the refresh a frame is paced to */
+#define PAINT_MARGIN (GST_MSECOND)
+
+
+Pacing *pacing_new (void) {
+  Pacing *pacing = g_new0 (Pacing, 1);
+
+  gst_segment_init (&pacing->segment, GST_FORMAT_UNDEFINED);
+  return pacing;
+}
+
+void pacing_free (Pacing *pacing) {
+  if (pacing == NULL)
+    return;
+  if (pacing->base_sink != NULL)
+    gst_object_unref (pacing->base_sink);
+  g_free (pacing);
+}
+
+/* Streaming thread, before the sink waits for the clock.
+ * A frame is shown at the refresh nearest to its running time: it is retimed to
+ * reach the widget just before that refresh is painted, and a frame paced to the
+ * same refresh as the previous one is dropped unless it is the closer of the two */
+static GstPadProbeReturn sink_probe_cb (GstPad *pad, GstPadProbeInfo *info, Pacing *pacing) {
+  gint64 vblank, interval, running_time, now_clock, now_monotonic, intended, target, distance, shift, pts, stop;
+  GstClockTime base_time, latency = 0, render_delay = 0;
+  gint64 ts_offset = 0;
+  GstBuffer *buffer;
+  GstClock *clock;
+
+  if (!(info->type & GST_PAD_PROBE_TYPE_BUFFER)) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+      gst_event_copy_segment (event, &pacing->segment);
+    else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+      pacing->last_vblank = 0;
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  vblank = atomic_load (&pacing->next_vblank);
+  interval = atomic_load (&pacing->refresh_interval);
+  /* Trick modes and unknown refresh timing play as before */
+  if (vblank == 0 || interval <= 0 || !GST_BUFFER_PTS_IS_VALID (buffer) ||
+      pacing->segment.format != GST_FORMAT_TIME || pacing->segment.rate != 1.0)
+    return GST_PAD_PROBE_OK;
+
+  running_time = gst_segment_to_running_time (&pacing->segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+  clock = gst_element_get_clock (pacing->sink);
+  if (clock == NULL || !GST_CLOCK_TIME_IS_VALID (running_time)) {
+    if (clock != NULL)
+      gst_object_unref (clock);
+    return GST_PAD_PROBE_OK;
+  }
+  base_time = gst_element_get_base_time (pacing->sink);
+  now_clock = gst_clock_get_time (clock);
+  now_monotonic = g_get_monotonic_time () * GST_USECOND;
+  gst_object_unref (clock);
+  atomic_fetch_add (&pacing->frames, 1);
+
+  /* The sink renders at running time + latency + ts-offset - render delay: live latency and
+   * the A/V sync correction move the frame, pacing has to start from the same point */
+  if (pacing->base_sink != NULL) {
+    latency = gst_base_sink_get_latency (pacing->base_sink);
+    ts_offset = gst_base_sink_get_ts_offset (pacing->base_sink);
+    render_delay = gst_base_sink_get_render_delay (pacing->base_sink);
+  }
+
+  /* Pipeline clock to monotonic, the audio clock may run at its own rate but not within a frame */
+  intended = running_time + (gint64) latency + ts_offset - (gint64) render_delay + base_time - now_clock + now_monotonic;
+  target = vblank + (intended - vblank + (intended >= vblank ? interval / 2 : -interval / 2)) / interval * interval;
+  distance = ABS (intended - target);
+
+  if (target == pacing->last_vblank) {
+    if (distance >= pacing->last_distance) {
+      atomic_fetch_add (&pacing->skipped, 1);
+      return GST_PAD_PROBE_DROP;
+    }
+    /* Closer to the refresh, replaces the previous frame before it is painted */
+  }
+  pacing->last_vblank = target;
+  pacing->last_distance = distance;
+
+  /* GTK paints a refresh during the frame clock cycle before it. The new PTS stays inside
+   * the segment, the sink would clip the frame otherwise */
+  shift = target - interval - PAINT_MARGIN - intended;
+  pts = GST_BUFFER_PTS (buffer);
+  stop = GST_CLOCK_TIME_IS_VALID (pacing->segment.stop) ? (gint64) pacing->segment.stop : G_MAXINT64;
+  shift = CLAMP (pts + shift, MIN ((gint64) pacing->segment.start, pts), MAX (stop, pts)) - pts;
+  if (shift != 0) {
+    buffer = gst_buffer_make_writable (buffer);
+    GST_BUFFER_PTS (buffer) += shift;
+    if (GST_BUFFER_DTS_IS_VALID (buffer) && (gint64) GST_BUFFER_DTS (buffer) + shift >= 0)
+      GST_BUFFER_DTS (buffer) += shift;
+    GST_PAD_PROBE_INFO_DATA (info) = buffer;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* gtksink is a base sink itself, glsinkbin wraps one */
+static GstBaseSink *find_base_sink (GstElement *sink) {
+  GstIterator *it;
+  GValue value = G_VALUE_INIT;
+  GstBaseSink *base_sink = NULL;
+
+  if (GST_IS_BASE_SINK (sink))
+    return GST_BASE_SINK (gst_object_ref (sink));
+  if (!GST_IS_BIN (sink))
+    return NULL;
+
+  it = gst_bin_iterate_sinks (GST_BIN (sink));
+  while (base_sink == NULL && gst_iterator_next (it, &value) == GST_ITERATOR_OK) {
+    if (GST_IS_BASE_SINK (g_value_get_object (&value)))
+      base_sink = GST_BASE_SINK (g_value_dup_object (&value));
+    g_value_reset (&value);
+  }
+  g_value_unset (&value);
+  gst_iterator_free (it);
+  return base_sink;
+}
+
+void pacing_attach (Pacing *pacing, CustomData *data) {
+  GstPad *pad = gst_element_get_static_pad (data->videosink, "sink");
+
+  pacing->sink = data->videosink;
+  pacing->base_sink = find_base_sink (data->videosink);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+      (GstPadProbeCallback) sink_probe_cb, pacing, NULL);
+  gst_object_unref (pad);
+}
+
+/* Every refresh: publish the next presentation time and count the refreshes that were skipped */
+static gboolean tick_cb (GtkWidget *widget, GdkFrameClock *frame_clock, Pacing *pacing) {
+  gint64 frame_time = gdk_frame_clock_get_frame_time (frame_clock);
+  gint64 interval_us = 0, presentation_us = 0;
+
+  gdk_frame_clock_get_refresh_info (frame_clock, frame_time, &interval_us, &presentation_us);
+  if (interval_us > 0) {
+    if (pacing->last_frame_time != 0 && frame_time - pacing->last_frame_time > interval_us * 3 / 2)
+      pacing->missed += (frame_time - pacing->last_frame_time + interval_us / 2) / interval_us - 1;
+    atomic_store (&pacing->refresh_interval, interval_us * GST_USECOND);
+    /* Without presentation feedback the frame time is the best guess of the vblank */
+    atomic_store (&pacing->next_vblank, (presentation_us ? presentation_us : frame_time + interval_us) * GST_USECOND);
+  }
+  pacing->last_frame_time = frame_time;
+  pacing->ticks++;
+
+  if (g_get_monotonic_time () - pacing->last_report >= PACING_REPORT_INTERVAL)
+    pacing_report (pacing);
+  return G_SOURCE_CONTINUE;
+}
+
+static void draw_cb (GtkWidget *widget, cairo_t *cr, Pacing *pacing) {
+  pacing->draws++;
+}
+
+void pacing_connect_widget (Pacing *pacing, GtkWidget *widget) {
+  if (pacing == NULL || widget == NULL)
+    return;
+  pacing->widget = widget;
+  pacing->last_report = g_get_monotonic_time ();
+  gtk_widget_add_tick_callback (widget, (GtkTickCallback) tick_cb, pacing, NULL);
+  g_signal_connect_after (widget, "draw", G_CALLBACK (draw_cb), pacing);
+}
+
+void pacing_report (Pacing *pacing) {
+  gint64 interval;
+
+  if (pacing == NULL)
+    return;
+  pacing->last_report = g_get_monotonic_time ();
+  interval = atomic_load (&pacing->refresh_interval);
+
+  g_print ("\nPacing at %.2f Hz: %" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT " skipped before scan-out, %"
+      G_GUINT64_FORMAT " widget redraws, %" G_GUINT64_FORMAT " missed vblanks in %" G_GUINT64_FORMAT " refreshes\n",
+      interval > 0 ? GST_SECOND / (gdouble) interval : 0, (guint64) atomic_load (&pacing->frames),
+      (guint64) atomic_load (&pacing->skipped), pacing->draws, pacing->missed, pacing->ticks);
+}
@@ -0,0 +1,46 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <stdatomic.h>
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+#include <gst/base/gstbasesink.h>
+
+typedef struct _CustomData CustomData;
+
+typedef struct _Pacing {
+  GtkWidget *widget;
+
+  /* Frame clock, published by the UI thread */
+  _Atomic gint64 next_vblank;   /* predicted presentation, monotonic ns, 0 until known */
+  _Atomic gint64 refresh_interval;  /* ns */
+
+  /* Video sink streaming thread only */
+  GstElement *sink;
+  GstBaseSink *base_sink;       /* the sink inside a sink bin, owns ts-offset and latency */
+  GstSegment segment;
+  gint64 last_vblank;           /* the refresh the previous frame was paced to */
+  gint64 last_distance;
+
+  atomic_uint_fast64_t frames;
+  atomic_uint_fast64_t skipped; /* would have been overwritten before scan-out */
+
+  /* UI thread only */
+  gint64 last_frame_time;
+  guint64 ticks;
+  guint64 missed;               /* refreshes the frame clock did not run for */
+  guint64 draws;
+  gint64 last_report;
+} Pacing;
+
+Pacing *pacing_new (void);
+void pacing_free (Pacing *pacing);
+
+/* Retime and thin the frames reaching the video sink against the display refresh */
+void pacing_attach (Pacing *pacing, CustomData *data);
+/* UI thread: follow the frame clock of the video widget */
+void pacing_connect_widget (Pacing *pacing, GtkWidget *widget);
+/* UI thread: frames paced and skipped, vblanks missed, widget redraws */
+void pacing_report (Pacing *pacing);
+
+#endif
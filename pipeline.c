@@ -0,0 +1,326 @@
+#include <gst/gst.h>
+
+#include "pipeline.h"
+#include "player.h"
+#include "streaming.h"
+#include "wall.h"
+#include "audio.h"
+#include "record.h"
+#include "branches.h"
+
+static void pad_added_handler (GstElement *src, GstPad *pad, CustomData *data);
+
+static void discard_element (GstElement **element) {
+  if (*element != NULL) {
+    gst_object_unref (gst_object_ref_sink (*element));
+    *element = NULL;
+  }
+}
+
+void pipeline_set_threads (GstElement *element, guint n_threads) {
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), "n-threads"))
+    g_object_set (element, "n-threads", n_threads, NULL);
+}
+
+/* Add the non-NULL elements of the chain to the bin and link them in order */
+static gboolean add_and_link_chain (GstBin *bin, GstElement **chain, guint n) {
+  GstElement *prev = NULL;
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    if (chain[i] == NULL)
+      continue;
+    if (GST_OBJECT_PARENT (chain[i]) == NULL)
+      gst_bin_add (bin, chain[i]);
+    if (prev != NULL && !gst_element_link (prev, chain[i]))
+      return FALSE;
+    prev = chain[i];
+  }
+  return TRUE;
+}
+
+/* Benchmark and other headless modes measure the chain, not the display */
+static GstElement *make_headless_sink (const gchar *name) {
+  GstElement *sink = gst_element_factory_make ("fakesink", name);
+
+  if (sink != NULL)
+    g_object_set (sink, "sync", FALSE, NULL);
+  return sink;
+}
+
+/* Build the elements after video_queue, either the zero-copy GL path or the software one */
+static gboolean create_video_branch (CustomData *data, const PipelineConfig *config) {
+  if (config->accelerated) {
+    /* Frames stay as dmabuf/GLMemory, glupload imports them and conversion runs in shaders */
+    data->vupload = gst_element_factory_make ("glupload", "video-upload");
+    data->vconvert = gst_element_factory_make ("glcolorconvert", "video-convert");
+    if (config->headless) {
+      data->videosink = make_headless_sink ("video-sink");
+      if (data->vupload && data->vconvert && data->videosink)
+        return TRUE;
+    } else {
+      data->videosink = gst_element_factory_make ("glsinkbin", "glsinkbin");
+      data->gtkglsink = gst_element_factory_make ("gtkglsink", "gtkglsink");
+      if (data->vupload && data->vconvert && data->videosink && data->gtkglsink) {
+        g_printerr ("Successfully created GTK GL Sink \n");
+        g_object_set (data->videosink, "sink", data->gtkglsink, NULL);
+        g_object_get (data->gtkglsink, "widget", &data->sink_widget, NULL);
+        return TRUE;
+      }
+    }
+
+    g_printerr ("Could not create gtkglsink, falling back to gtksink.\n");
+    discard_element (&data->vupload);
+    discard_element (&data->vconvert);
+    discard_element (&data->videosink);
+    discard_element (&data->gtkglsink);
+  }
+
+  data->vconvert = gst_element_factory_make ("videoconvert", "video-convert");
+  data->videosink = config->headless ? make_headless_sink ("video-sink") : gst_element_factory_make ("gtksink", "gtksink");
+  if (!data->vconvert || !data->videosink)
+    return FALSE;
+  pipeline_set_threads (data->vconvert, config->convert_threads);
+
+  /* Shrink to the widget before converting so conversion touches fewer pixels */
+  if (config->scale_to_widget) {
+    data->vscale = gst_element_factory_make ("videoscale", "video-scale");
+    data->vscale_filter = gst_element_factory_make ("capsfilter", "video-scale-filter");
+    if (!data->vscale || !data->vscale_filter)
+      return FALSE;
+    pipeline_set_threads (data->vscale, config->convert_threads);
+  }
+
+  if (!config->headless)
+    g_object_get (data->videosink, "widget", &data->sink_widget, NULL);
+  return TRUE;
+}
+
+/* The configured video elements replace the built-in converters when they fit the sink */
+static GstElement *use_video_spec (CustomData *data, const PipelineConfig *config) {
+  GstElement *branch;
+
+  if (config->branches == NULL || config->branches->video.elements == NULL)
+    return NULL;
+  branch = branches_make (&config->branches->video, "video/x-raw(ANY)", data->videosink);
+  if (branch == NULL)
+    return NULL;
+
+  discard_element (&data->vscale);
+  discard_element (&data->vscale_filter);
+  discard_element (&data->vupload);
+  discard_element (&data->vconvert);
+  return branch;
+}
+
+/* audio.c tunes and watches the converters, the configured chain has to keep them */
+static GstElement *use_audio_spec (CustomData *data, const PipelineConfig *config) {
+  GstElement *branch, *aconvert, *resample;
+
+  if (config->branches == NULL || config->branches->audio.elements == NULL)
+    return NULL;
+  if (config->audio.passthrough) {
+    g_printerr ("Audio passthrough rewires the audio branch, using the built-in one.\n");
+    return NULL;
+  }
+  branch = branches_make (&config->branches->audio, "audio/x-raw", data->asink);
+  if (branch == NULL)
+    return NULL;
+
+  aconvert = branches_find (branch, "audioconvert");
+  resample = branches_find (branch, "audioresample");
+  if (aconvert == NULL || resample == NULL) {
+    g_printerr ("Ignoring audio branch without audioconvert and audioresample.\n");
+    gst_object_unref (gst_object_ref_sink (branch));
+    return NULL;
+  }
+  discard_element (&data->aconvert);
+  discard_element (&data->resample);
+  data->aconvert = aconvert;
+  data->resample = resample;
+  return branch;
+}
+
+/* uridecodebin3 only decodes the selected streams, see tracks.c. Compressed audio
+ * passthrough relies on uridecodebin's autoplug signals, recording on no-more-pads */
+static GstElement *make_source (const PipelineConfig *config) {
+  GstElement *source = NULL;
+
+  if (!config->legacy_decodebin && !config->audio.passthrough && config->record_path == NULL)
+    source = gst_element_factory_make ("uridecodebin3", "source");
+  if (source == NULL)
+    source = gst_element_factory_make ("uridecodebin", "source");
+  return source;
+}
+
+gboolean pipeline_build (CustomData *data, const gchar *uri, const PipelineConfig *config) {
+  GstElement *video_branch, *audio_branch;
+
+  /* Here and not in control_start(), the probe cache may know it before playback */
+  atomic_init (&data->duration, GST_CLOCK_TIME_NONE);
+  data->source = config->wall_tiles > 0 ? NULL : make_source (config);
+  data->aconvert = gst_element_factory_make ("audioconvert", "audio-convert");
+  data->resample = gst_element_factory_make ("audioresample", "resample");
+  data->audio_queue = gst_element_factory_make("queue", "audio_queue");
+  data->video_queue = gst_element_factory_make("queue", "video_queue");
+  data->asink = config->headless ? make_headless_sink ("audio-sink") : gst_element_factory_make ("autoaudiosink", "audio-sink");
+  
+  data->pipeline = gst_pipeline_new ("open-audio-video-pipeline");
+  
+  if (!data->pipeline || (!data->source && config->wall_tiles == 0) || !data->aconvert || !data->audio_queue || !data->video_queue || !data->resample || !data->asink || !create_video_branch (data, config)){
+    g_printerr ("Not all elements could be created.\n");
+    return FALSE;
+  }
+
+  /* Branches from the config file, each falls back to the built-in one on its own */
+  video_branch = use_video_spec (data, config);
+  audio_branch = use_audio_spec (data, config);
+
+  /* Link separate audio pipeline branch */
+  GstElement *audio_chain[] = { data->audio_queue, audio_branch ? audio_branch : data->aconvert, audio_branch ? NULL : data->resample, data->asink };
+  if (!add_and_link_chain (GST_BIN (data->pipeline), audio_chain, G_N_ELEMENTS (audio_chain))) {
+    g_printerr ("Elements could not be linked on audio brach.\n");
+    gst_object_unref (data->pipeline);
+    return FALSE;
+  }
+
+  /* Link separate video pipeline branch */
+  GstElement *video_chain[] = { data->video_queue, data->vscale, data->vscale_filter, data->vupload, video_branch ? video_branch : data->vconvert, data->videosink };
+  if (!add_and_link_chain (GST_BIN (data->pipeline), video_chain, G_N_ELEMENTS (video_chain))) {
+    g_printerr ("Elements could not be linked on video brach.\n");
+    gst_object_unref (data->pipeline);
+    return FALSE;
+  }
+
+  if (!audio_setup (data, &config->audio)) {
+    gst_object_unref (data->pipeline);
+    return FALSE;
+  }
+
+  if (config->wall_tiles > 0) {
+    data->wall = wall_build (data, config->wall_uris, config->wall_tiles, config->wall_width, config->wall_height,
+        config->convert_threads, config->wall_audio);
+    if (data->wall == NULL) {
+      gst_object_unref (data->pipeline);
+      return FALSE;
+    }
+  } else {
+    g_object_set (data->source, "uri", uri, NULL);
+    gst_bin_add (GST_BIN (data->pipeline), data->source);
+    /* Connect source pads to pipeline on the fly depending on the content of the source */
+    g_signal_connect(data->source, "pad-added", G_CALLBACK(pad_added_handler), data);
+  }
+
+  if (config->record_path != NULL) {
+    data->record = record_new (config->record_path, config->record_remux);
+    if (!record_setup (data->record, data)) {
+      gst_object_unref (data->pipeline);
+      return FALSE;
+    }
+  }
+
+  if (config->streaming && data->source != NULL)
+    streaming_setup (data, config->cache_size_mb, config->cache_dir);
+
+  if (config->buffering != BUFFERING_DEFAULT) {
+    data->buffering = buffering_new (config->buffering, config->adaptive_buffering);
+    buffering_attach (data->buffering, data);
+  }
+  /* Explicit queue settings win over the buffering preset, also when it resizes the queues */
+  if (config->branches != NULL) {
+    buffering_keep_limits (data->buffering, data->video_queue,
+        branches_configure_queue (&config->branches->video, data->video_queue));
+    buffering_keep_limits (data->buffering, data->audio_queue,
+        branches_configure_queue (&config->branches->audio, data->audio_queue));
+  }
+  /* Last, it only lowers what the settings above allow */
+  if (config->memory_limit_mb > 0) {
+    data->memlimit = memlimit_new (config->memory_limit_mb, config->queue_memory_mb);
+    memlimit_attach (data->memlimit, data);
+  }
+  return TRUE;
+}
+
+GstElement *pipeline_splice_tee (CustomData *data, GstElement *queue) {
+  GstPad *src = gst_element_get_static_pad (queue, "src");
+  GstPad *peer = gst_pad_get_peer (src);
+  GstElement *tee = gst_element_factory_make ("tee", NULL);
+  GstPad *tee_pad;
+
+  gst_bin_add (GST_BIN (data->pipeline), tee);
+  gst_pad_unlink (src, peer);
+  gst_element_link (queue, tee);
+  tee_pad = gst_element_request_pad_simple (tee, "src_%u");
+  gst_pad_link (tee_pad, peer);
+
+  gst_object_unref (tee_pad);
+  gst_object_unref (peer);
+  gst_object_unref (src);
+  return tee;
+}
+
+
+/* Link the pad to the branch of its media type */
+static void link_new_pad (CustomData *data, GstPad *new_pad, const gchar *new_pad_type) {
+  GstPadLinkReturn ret;
+  GstPad *sink_pad = NULL;
+
+  /* Only exposed undecoded when the sink accepted it, see audio.c. With --record-remux
+   * it is the recorder's, it decodes for playback itself */
+  if (audio_is_compressed (new_pad_type) && (data->record == NULL || !data->record->remux)) {
+    if (!audio_link_compressed (data, new_pad))
+      g_print ("Type is '%s' but link failed.\n", new_pad_type);
+    else
+      g_print ("Link succeeded (type '%s').\n", new_pad_type);
+    return;
+  }
+
+  if (g_str_has_prefix (new_pad_type, "video/x-raw"))
+    sink_pad = gst_element_get_static_pad (data->video_queue, "sink");
+  else if (g_str_has_prefix (new_pad_type, "audio/x-raw"))
+    sink_pad = gst_element_get_static_pad (data->audio_queue, "sink");
+  if (sink_pad == NULL)
+    return;
+
+  ret = gst_pad_link (new_pad, sink_pad);
+  if (GST_PAD_LINK_FAILED (ret))
+    g_print ("Type is '%s' but link failed.\n", new_pad_type);
+  else
+    g_print ("Link succeeded (type '%s').\n", new_pad_type);
+  gst_object_unref (sink_pad);
+}
+
+/* The pad had no caps when it was exposed, link it once they are known */
+static GstPadProbeReturn caps_event_cb (GstPad *pad, GstPadProbeInfo *info, CustomData *data) {
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstCaps *caps;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+  gst_event_parse_caps (event, &caps);
+  link_new_pad (data, pad, gst_structure_get_name (gst_caps_get_structure (caps, 0)));
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static void pad_added_handler (GstElement *src, GstPad *new_pad, CustomData *data) {
+  GstCaps *new_pad_caps = NULL;
+
+  g_print ("Received new pad '%s' from '%s':\n", GST_PAD_NAME (new_pad), GST_ELEMENT_NAME (src));
+
+  new_pad_caps = gst_pad_get_current_caps (new_pad);
+  /* decodebin3 may expose its pads before the decoder output is negotiated. A caps query
+   * then answers with templates that can be ANY, empty or mixed, only fixed caps are trusted */
+  if (new_pad_caps == NULL) {
+    new_pad_caps = gst_pad_query_caps (new_pad, NULL);
+    if (gst_caps_is_empty (new_pad_caps) || !gst_caps_is_fixed (new_pad_caps))
+      g_clear_pointer (&new_pad_caps, gst_caps_unref);
+  }
+  if (new_pad_caps == NULL) {
+    g_print ("No caps yet, linking on the caps event.\n");
+    gst_pad_add_probe (new_pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, (GstPadProbeCallback) caps_event_cb, data, NULL);
+    return;
+  }
+
+  link_new_pad (data, new_pad, gst_structure_get_name (gst_caps_get_structure (new_pad_caps, 0)));
+  gst_caps_unref (new_pad_caps);
+}
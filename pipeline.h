@@ -0,0 +1,44 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <gst/gst.h>
+
+#include "buffering.h"
+#include "audio.h"
+#include "branches.h"
+
+typedef struct _CustomData CustomData;
+
+typedef struct _PipelineConfig {
+  gboolean accelerated;         /* zero-copy GL video branch, see hwaccel.c */
+  guint convert_threads;
+  gboolean scale_to_widget;
+  gboolean headless;            /* end both branches in fakesink sync=false */
+  BufferingPreset buffering;
+  gboolean adaptive_buffering;
+  gboolean streaming;           /* ring-buffer download cache, see streaming.c */
+  guint cache_size_mb;
+  const gchar *cache_dir;
+  AudioConfig audio;
+  const Branches *branches;     /* elements from the pipeline config file, NULL for the built-in ones */
+  gboolean legacy_decodebin;    /* uridecodebin even when uridecodebin3 is available */
+  const gchar * const *wall_uris; /* decode all of them into a tiled wall, see wall.c */
+  guint wall_tiles;             /* 0 for the single uri */
+  gint wall_width;
+  gint wall_height;
+  gint wall_audio;              /* WALL_AUDIO_MIX or a tile index */
+  const gchar *record_path;     /* tee the streams into this file, see record.c */
+  gboolean record_remux;        /* keep the source codecs in the recording */
+  guint memory_limit_mb;        /* RSS ceiling of the bounded memory mode, 0 for none, see memlimit.c */
+  guint queue_memory_mb;        /* bytes shared by both queues in that mode */
+} PipelineConfig;
+
+/* Build uridecodebin -> audio/video queues -> convert -> sinks into data->pipeline,
+ * or the tiles -> compositor/audiomixer -> queues -> ... chain with wall_tiles */
+gboolean pipeline_build (CustomData *data, const gchar *uri, const PipelineConfig *config);
+/* Older videoconvert/videoscale releases have no n-threads property */
+void pipeline_set_threads (GstElement *element, guint n_threads);
+/* queue -> next becomes queue -> tee -> next, before any data flows. Returns the tee */
+GstElement *pipeline_splice_tee (CustomData *data, GstElement *queue);
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PLAYER_H
+#define PLAYER_H
+
+#include <stdatomic.h>
+
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+
+#include "control.h"
+#include "metrics.h"
+#include "buffering.h"
+#include "seek.h"
+#include "playlist.h"
+#include "startup.h"
+#include "wall.h"
+#include "live.h"
+#include "tracks.h"
+#include "overload.h"
+#include "record.h"
+#include "avsync.h"
+#include "frameexport.h"
+#include "pacing.h"
+#include "memlimit.h"
+
+typedef struct _CustomData {
+  GstElement *pipeline;
+  GstElement *source;           /* NULL in video wall mode, every tile has its own */
+  GstElement *aconvert;
+  GstElement *vscale;
+  GstElement *vscale_filter;
+  GstElement *vupload;
+  GstElement *vconvert;
+  GstElement *resample;
+  GstElement *audio_queue;
+  GstElement *video_queue;
+  GstElement *asink;
+  GstElement *vsink;
+  GstElement *videosink;
+  GstElement *gtkglsink;
+  GtkWidget *sink_widget;
+  gint widget_width;
+  gint widget_height;
+
+  /* Optional playback statistics, NULL when disabled */
+  Metrics *metrics;
+  /* Queue sizing policy, NULL with the default queue limits */
+  Buffering *buffering;
+  /* Seek bar and seek coalescing, NULL in headless modes */
+  SeekEngine *seek;
+  /* Gapless playlist, NULL for a single item */
+  Playlist *playlist;
+  /* Tiled multi-stream mode, NULL for a single source */
+  Wall *wall;
+  /* Track selection, NULL unless the source is uridecodebin3 */
+  Tracks *tracks;
+  /* Decoder skipping under CPU pressure, NULL with --overload=off */
+  Overload *overload;
+  /* Low-latency live playback, NULL for files and buffered streams */
+  Live *live;
+  /* A/V sync monitor and offset correction, NULL unless requested */
+  AvSync *avsync;
+  /* Display refresh frame pacing, NULL without --vsync */
+  Pacing *pacing;
+  /* Decoded frames shared with other processes, NULL without --export-frames */
+  FrameExport *frame_export;
+  /* Queue byte cap, bounded frame pools and RSS ceiling, NULL without --memory-limit */
+  MemLimit *memlimit;
+  /* Recording tee, NULL without --record */
+  Record *record;
+  /* Time-to-first-frame breakdown, NULL without --startup-trace */
+  StartupTrace *startup;
+
+  /* Owned by the control thread, never touched from the UI */
+  GThread *control_thread;
+  GMainContext *control_context;
+  GMainLoop *control_loop;
+  GSource *bus_source;
+  GSource *command_source;
+  GSource *position_source;
+  GMutex invoke_lock;           /* zero-initialised like a static GMutex */
+  gboolean control_stopped;     /* under invoke_lock, see control_invoke() */
+  gboolean seek_enabled;
+  GstState target_state;        /* last state requested by the user */
+  gboolean is_live;
+
+  /* Network streaming, see streaming.c (control thread) */
+  gboolean streaming;
+  gint buffering_percent;
+  gboolean buffering_paused;
+  gchar *buffered_ranges;
+
+  /* UI -> control thread */
+  ControlQueue commands;
+
+  /* Control thread -> UI, written by the control thread only */
+  atomic_int state;
+  atomic_bool playing;
+  atomic_bool terminate;
+  _Atomic gint64 duration;
+  _Atomic gint64 position;
+} CustomData;
+
+#endif
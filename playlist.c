@@ -0,0 +1,331 @@
+#include <gst/gst.h>
+
+#include "playlist.h"
+#include "player.h"
+
+static void playlist_pad_free (PlaylistPad *ppad) {
+  gst_object_unref (ppad->pad);
+  gst_object_unref (ppad->inner);
+  g_free (ppad);
+}
+
+static PlaylistPad *playlist_pad_new (GstPad *pad, GstPad *inner, gulong block_id) {
+  PlaylistPad *ppad = g_new0 (PlaylistPad, 1);
+
+  ppad->pad = gst_object_ref (pad);
+  ppad->inner = gst_object_ref (inner);
+  ppad->block_id = block_id;
+  return ppad;
+}
+
+Playlist *playlist_new (gchar **uris, guint n_uris, gboolean loop) {
+  Playlist *playlist = g_new0 (Playlist, 1);
+
+  playlist->uris = uris;
+  playlist->n_uris = n_uris;
+  playlist->loop = loop;
+  g_mutex_init (&playlist->lock);
+  playlist->current_pads = g_ptr_array_new_with_free_func ((GDestroyNotify) playlist_pad_free);
+  playlist->next_pads = g_ptr_array_new_with_free_func ((GDestroyNotify) playlist_pad_free);
+  return playlist;
+}
+
+void playlist_free (Playlist *playlist) {
+  if (playlist == NULL)
+    return;
+  g_ptr_array_unref (playlist->current_pads);
+  g_ptr_array_unref (playlist->next_pads);
+  g_mutex_clear (&playlist->lock);
+  g_free (playlist);
+}
+
+static gboolean has_next (Playlist *playlist, guint *index) {
+  if (playlist->current + 1 < playlist->n_uris) {
+    *index = playlist->current + 1;
+    return TRUE;
+  }
+  if (playlist->loop) {
+    *index = 0;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+static gboolean branch_finished (PlaylistBranch *branch) {
+  GstPad *sinkpad;
+  gboolean linked;
+
+  if (branch->eos)
+    return TRUE;
+  sinkpad = gst_element_get_static_pad (branch->queue, "sink");
+  linked = gst_pad_is_linked (sinkpad);
+  gst_object_unref (sinkpad);
+  return !linked;
+}
+
+static GstPad *queue_sink_pad (Playlist *playlist, GstPad *pad) {
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  const gchar *type;
+  GstElement *queue = NULL;
+
+  if (caps == NULL)
+    return NULL;
+  type = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+  if (g_str_has_prefix (type, "video/x-raw"))
+    queue = playlist->data->video_queue;
+  else if (g_str_has_prefix (type, "audio/x-raw"))
+    queue = playlist->data->audio_queue;
+  gst_caps_unref (caps);
+
+  return queue ? gst_element_get_static_pad (queue, "sink") : NULL;
+}
+
+
+/* Swap the prerolled item in: relink the queues, continue running time where
+ * the last item ended and release the blocked pads. Sinks stay untouched. */
+static gboolean do_switch (Playlist *playlist) {
+  CustomData *data = playlist->data;
+  PlaylistBranch *branches[] = { &playlist->video, &playlist->audio };
+  GstClockTime offset = 0;
+  GstElement *old;
+  guint i, index;
+
+  g_mutex_lock (&playlist->lock);
+  if (!playlist->next_ready) {
+    /* Picked up again from no-more-pads of the next item */
+    playlist->switch_pending = TRUE;
+    g_mutex_unlock (&playlist->lock);
+    return G_SOURCE_REMOVE;
+  }
+  playlist->switch_pending = FALSE;
+  for (i = 0; i < G_N_ELEMENTS (branches); i++) {
+    offset = MAX (offset, branches[i]->end_running_time);
+    branches[i]->eos = FALSE;
+  }
+  g_mutex_unlock (&playlist->lock);
+
+  for (i = 0; i < G_N_ELEMENTS (branches); i++) {
+    GstPad *sinkpad = gst_element_get_static_pad (branches[i]->queue, "sink");
+    GstPad *peer = gst_pad_get_peer (sinkpad);
+    if (peer != NULL) {
+      gst_pad_unlink (peer, sinkpad);
+      gst_object_unref (peer);
+    }
+    gst_object_unref (sinkpad);
+  }
+
+  for (i = 0; i < playlist->next_pads->len; i++) {
+    PlaylistPad *ppad = g_ptr_array_index (playlist->next_pads, i);
+    GstPad *sinkpad = queue_sink_pad (playlist, ppad->inner);
+    if (sinkpad != NULL && !gst_pad_is_linked (sinkpad) && GST_PAD_LINK_SUCCESSFUL (gst_pad_link (ppad->pad, sinkpad)))
+      gst_pad_set_offset (ppad->pad, offset);
+    if (sinkpad != NULL)
+      gst_object_unref (sinkpad);
+  }
+
+  /* The item is current from here on: on the last one branch_probe_cb() must let
+   * the EOS below through instead of waiting for yet another item */
+  g_mutex_lock (&playlist->lock);
+  has_next (playlist, &index);
+  playlist->current = index;
+  g_mutex_unlock (&playlist->lock);
+
+  /* A branch the new item does not feed still has to reach EOS eventually */
+  for (i = 0; i < G_N_ELEMENTS (branches); i++) {
+    GstPad *sinkpad = gst_element_get_static_pad (branches[i]->queue, "sink");
+    if (!gst_pad_is_linked (sinkpad))
+      gst_pad_send_event (sinkpad, gst_event_new_eos ());
+    gst_object_unref (sinkpad);
+  }
+
+  for (i = 0; i < playlist->next_pads->len; i++) {
+    PlaylistPad *ppad = g_ptr_array_index (playlist->next_pads, i);
+    gst_pad_remove_probe (ppad->inner, ppad->block_id);
+    ppad->block_id = 0;
+  }
+
+  old = playlist->current_element;
+  gst_element_set_locked_state (old, TRUE);
+  gst_element_set_state (old, GST_STATE_NULL);
+  gst_bin_remove (GST_BIN (data->pipeline), old);
+
+  g_mutex_lock (&playlist->lock);
+  playlist->current_element = playlist->next_element;
+  data->source = playlist->next_decoder;
+  g_ptr_array_unref (playlist->current_pads);
+  playlist->current_pads = playlist->next_pads;
+  playlist->next_pads = g_ptr_array_new_with_free_func ((GDestroyNotify) playlist_pad_free);
+  playlist->next_element = NULL;
+  playlist->next_decoder = NULL;
+  playlist->next_ready = FALSE;
+  g_mutex_unlock (&playlist->lock);
+
+  atomic_store (&data->duration, GST_CLOCK_TIME_NONE);
+  if (data->seek != NULL)
+    seek_engine_reset_index (data->seek);
+  g_print ("\nNow playing %s\n", playlist->uris[playlist->current]);
+
+  playlist_prepare_next (playlist);
+  return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn branch_probe_cb (GstPad *pad, GstPadProbeInfo *info, PlaylistBranch *branch) {
+  Playlist *playlist = g_object_get_data (G_OBJECT (pad), "playlist");
+  GstEvent *event;
+  gboolean done;
+  guint index;
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    GstClockTime end;
+
+    if (!GST_BUFFER_PTS_IS_VALID (buffer) || branch->segment.format != GST_FORMAT_TIME)
+      return GST_PAD_PROBE_OK;
+    end = gst_segment_to_running_time (&branch->segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+    if (GST_CLOCK_TIME_IS_VALID (end) && GST_BUFFER_DURATION_IS_VALID (buffer))
+      end += GST_BUFFER_DURATION (buffer);
+    if (GST_CLOCK_TIME_IS_VALID (end)) {
+      g_mutex_lock (&playlist->lock);
+      branch->end_running_time = MAX (branch->end_running_time, end);
+      g_mutex_unlock (&playlist->lock);
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  event = GST_PAD_PROBE_INFO_EVENT (info);
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_SEGMENT:
+      gst_event_copy_segment (event, &branch->segment);
+      return GST_PAD_PROBE_OK;
+    case GST_EVENT_FLUSH_STOP:
+      g_mutex_lock (&playlist->lock);
+      branch->end_running_time = 0;
+      branch->eos = FALSE;
+      g_mutex_unlock (&playlist->lock);
+      return GST_PAD_PROBE_OK;
+    case GST_EVENT_EOS:
+      break;
+    default:
+      return GST_PAD_PROBE_OK;
+  }
+
+  /* Last item: let EOS through so the pipeline finishes */
+  g_mutex_lock (&playlist->lock);
+  if (!has_next (playlist, &index)) {
+    g_mutex_unlock (&playlist->lock);
+    return GST_PAD_PROBE_OK;
+  }
+  branch->eos = TRUE;
+  done = branch_finished (&playlist->video) && branch_finished (&playlist->audio);
+  g_mutex_unlock (&playlist->lock);
+
+  if (done)
+    control_invoke (playlist->data, (GSourceFunc) do_switch, playlist, NULL);
+  return GST_PAD_PROBE_DROP;
+}
+
+static void attach_branch (Playlist *playlist, PlaylistBranch *branch, GstElement *queue) {
+  GstPad *pad = gst_element_get_static_pad (queue, "sink");
+
+  branch->queue = queue;
+  gst_segment_init (&branch->segment, GST_FORMAT_UNDEFINED);
+  g_object_set_data (G_OBJECT (pad), "playlist", playlist);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+      (GstPadProbeCallback) branch_probe_cb, branch, NULL);
+  gst_object_unref (pad);
+}
+
+static void current_pad_added_cb (GstElement *decoder, GstPad *pad, Playlist *playlist) {
+  g_mutex_lock (&playlist->lock);
+  g_ptr_array_add (playlist->current_pads, playlist_pad_new (pad, pad, 0));
+  g_mutex_unlock (&playlist->lock);
+}
+
+void playlist_attach (Playlist *playlist, CustomData *data) {
+  playlist->data = data;
+  playlist->current_element = data->source;
+  attach_branch (playlist, &playlist->video, data->video_queue);
+  attach_branch (playlist, &playlist->audio, data->audio_queue);
+  g_signal_connect (data->source, "pad-added", G_CALLBACK (current_pad_added_cb), playlist);
+}
+
+
+static GstPadProbeReturn block_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  return GST_PAD_PROBE_OK;
+}
+
+static void next_pad_added_cb (GstElement *decoder, GstPad *pad, Playlist *playlist) {
+  GstElement *bin = GST_ELEMENT (gst_object_get_parent (GST_OBJECT (decoder)));
+  GstPad *ghost;
+  gulong block_id;
+
+  /* Hold the decoded data until the switch, the decoder stays prerolled meanwhile */
+  block_id = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM, block_cb, NULL, NULL);
+  ghost = gst_ghost_pad_new (NULL, pad);
+  gst_pad_set_active (ghost, TRUE);
+  gst_element_add_pad (bin, ghost);
+  gst_object_unref (bin);
+
+  g_mutex_lock (&playlist->lock);
+  g_ptr_array_add (playlist->next_pads, playlist_pad_new (ghost, pad, block_id));
+  g_mutex_unlock (&playlist->lock);
+}
+
+static void next_no_more_pads_cb (GstElement *decoder, Playlist *playlist) {
+  gboolean pending;
+
+  g_mutex_lock (&playlist->lock);
+  playlist->next_ready = TRUE;
+  pending = playlist->switch_pending;
+  g_mutex_unlock (&playlist->lock);
+
+  g_print ("\nNext item prerolled\n");
+  if (pending)
+    control_invoke (playlist->data, (GSourceFunc) do_switch, playlist, NULL);
+}
+
+void playlist_prepare_next (Playlist *playlist) {
+  CustomData *data = playlist->data;
+  GstElement *bin, *decoder;
+  gboolean download, use_buffering;
+  guint64 ring_buffer_max_size;
+  guint index;
+
+  if (playlist->next_element != NULL || !has_next (playlist, &index))
+    return;
+
+  decoder = gst_element_factory_make ("uridecodebin", NULL);
+  if (decoder == NULL)
+    return;
+  g_object_get (data->source, "download", &download, "use-buffering", &use_buffering,
+      "ring-buffer-max-size", &ring_buffer_max_size, NULL);
+  g_object_set (decoder, "uri", playlist->uris[index], "download", download, "use-buffering", use_buffering,
+      "ring-buffer-max-size", ring_buffer_max_size, NULL);
+  g_signal_connect (decoder, "pad-added", G_CALLBACK (next_pad_added_cb), playlist);
+  g_signal_connect (decoder, "no-more-pads", G_CALLBACK (next_no_more_pads_cb), playlist);
+
+  /* The wrapper keeps the decoder's async preroll from taking the running pipeline back to PAUSED */
+  bin = gst_bin_new (NULL);
+  g_object_set (bin, "async-handling", TRUE, NULL);
+  gst_bin_add (GST_BIN (bin), decoder);
+
+  playlist->next_element = bin;
+  playlist->next_decoder = decoder;
+  playlist->next_ready = FALSE;
+  gst_bin_add (GST_BIN (data->pipeline), bin);
+  gst_element_sync_state_with_parent (bin);
+}
+
+void playlist_reset_offsets (Playlist *playlist) {
+  guint i;
+
+  if (playlist == NULL)
+    return;
+
+  g_mutex_lock (&playlist->lock);
+  for (i = 0; i < playlist->current_pads->len; i++) {
+    PlaylistPad *ppad = g_ptr_array_index (playlist->current_pads, i);
+    gst_pad_set_offset (ppad->pad, 0);
+  }
+  g_mutex_unlock (&playlist->lock);
+}
@@ -0,0 +1,55 @@
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+/* Decoder branch of one item; pads are linked to the branch queues */
+typedef struct _PlaylistPad {
+  GstPad *pad;                  /* pad linked to a queue (ghost pad for prerolled items) */
+  GstPad *inner;                /* uridecodebin pad holding the block probe */
+  gulong block_id;
+} PlaylistPad;
+
+/* What feeds one branch queue */
+typedef struct _PlaylistBranch {
+  GstElement *queue;
+  GstSegment segment;           /* queue streaming thread only */
+  GstClockTime end_running_time;
+  gboolean eos;
+} PlaylistBranch;
+
+typedef struct _Playlist {
+  CustomData *data;
+  gchar **uris;
+  guint n_uris;
+  guint current;
+  gboolean loop;
+
+  GMutex lock;
+  PlaylistBranch video;
+  PlaylistBranch audio;
+  GstElement *current_element;  /* uridecodebin or its wrapper bin */
+  GPtrArray *current_pads;      /* PlaylistPad */
+
+  /* Next item, prerolled with its output pads blocked */
+  GstElement *next_element;
+  GstElement *next_decoder;
+  GPtrArray *next_pads;
+  gboolean next_ready;
+  gboolean switch_pending;
+} Playlist;
+
+Playlist *playlist_new (gchar **uris, guint n_uris, gboolean loop);
+void playlist_free (Playlist *playlist);
+
+/* Take over data->source as the first item and track EOS on the branch queues */
+void playlist_attach (Playlist *playlist, CustomData *data);
+
+/* Control thread: preroll the next item in the background */
+void playlist_prepare_next (Playlist *playlist);
+/* Control thread: a flushing seek restarts running time, drop the item offsets */
+void playlist_reset_offsets (Playlist *playlist);
+
+#endif
@@ -0,0 +1,269 @@
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include <gst/gst.h>
+
+#include "probecache.h"
+#include "player.h"
+
+/* Oldest entries are dropped beyond this */
+#define MAX_ENTRIES 64
+
+static const gchar *stream_keys[] = { "video", "audio" };
+
+
+ProbeCache *probe_cache_open (const gchar *uri) {
+  ProbeCache *cache = g_new0 (ProbeCache, 1);
+  gchar *filename;
+  GStatBuf st;
+
+  g_mutex_init (&cache->lock);
+  cache->found_factories = g_ptr_array_new_with_free_func (g_free);
+  cache->path = g_build_filename (g_get_user_cache_dir (), "open-pipe", "probe-cache.ini", NULL);
+  cache->keyfile = g_key_file_new ();
+  g_key_file_load_from_file (cache->keyfile, cache->path, G_KEY_FILE_NONE, NULL);
+
+  filename = g_filename_from_uri (uri, NULL, NULL);
+  if (filename == NULL || g_stat (filename, &st) != 0) {
+    g_free (filename);
+    return cache;
+  }
+  g_free (filename);
+
+  /* Group names cannot hold every URI character */
+  cache->group = g_compute_checksum_for_string (G_CHECKSUM_SHA1, uri, -1);
+  cache->size = st.st_size;
+  cache->mtime = st.st_mtime;
+  g_key_file_set_string (cache->keyfile, cache->group, "uri", uri);
+
+  /* A rewritten file has to be probed again */
+  if (g_key_file_get_int64 (cache->keyfile, cache->group, "size", NULL) != cache->size ||
+      g_key_file_get_int64 (cache->keyfile, cache->group, "mtime", NULL) != cache->mtime)
+    return cache;
+
+  gchar *container = g_key_file_get_string (cache->keyfile, cache->group, "container", NULL);
+  if (container != NULL)
+    cache->container = gst_caps_from_string (container);
+  g_free (container);
+  if (cache->container == NULL)
+    return cache;
+
+  cache->factories = g_key_file_get_string_list (cache->keyfile, cache->group, "factories", NULL, NULL);
+  cache->duration = g_key_file_get_int64 (cache->keyfile, cache->group, "duration", NULL);
+  cache->hit = TRUE;
+  return cache;
+}
+
+void probe_cache_free (ProbeCache *cache) {
+  if (cache == NULL)
+    return;
+  g_free (cache->path);
+  g_key_file_free (cache->keyfile);
+  g_free (cache->group);
+  if (cache->container != NULL)
+    gst_caps_unref (cache->container);
+  g_strfreev (cache->factories);
+  g_free (cache->found_container);
+  g_free (cache->found_streams[0]);
+  g_free (cache->found_streams[1]);
+  g_ptr_array_unref (cache->found_factories);
+  g_mutex_clear (&cache->lock);
+  g_free (cache);
+}
+
+static void have_type_cb (GstElement *typefind, guint probability, GstCaps *caps, ProbeCache *cache) {
+  g_mutex_lock (&cache->lock);
+  g_free (cache->found_container);
+  cache->found_container = gst_caps_to_string (caps);
+  g_mutex_unlock (&cache->lock);
+}
+
+static gboolean is_plugged_factory (GstElementFactory *factory) {
+  const gchar *klass = gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS);
+
+  return klass != NULL && (strstr (klass, "Demuxer") || strstr (klass, "Decoder") || strstr (klass, "Parser"));
+}
+
+static gboolean has_factory (GPtrArray *names, const gchar *name) {
+  guint i;
+
+  for (i = 0; i < names->len; i++) {
+    if (g_strcmp0 (g_ptr_array_index (names, i), name) == 0)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+static GValueArray *autoplug_sort_cb (GstElement *source, GstPad *pad, GstCaps *caps,
+    GValueArray *factories, ProbeCache *cache);
+
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, ProbeCache *cache) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *name;
+
+  if (factory == NULL)
+    return;
+  name = GST_OBJECT_NAME (factory);
+
+  if (g_strcmp0 (name, "decodebin") == 0 && cache->hit) {
+    /* Known container: decodebin hands the caps to its typefind, no data is read to guess it */
+    g_object_set (element, "sink-caps", cache->container, NULL);
+  } else if (g_strcmp0 (name, "parsebin") == 0 && cache->hit && cache->factories != NULL) {
+    /* uridecodebin3 autoplugs inside parsebin */
+    g_signal_connect (element, "autoplug-sort", G_CALLBACK (autoplug_sort_cb), cache);
+  } else if (g_strcmp0 (name, "typefind") == 0) {
+    /* The parsebin of uridecodebin3 has no sink-caps, its typefind takes the caps instead */
+    if (cache->hit)
+      g_object_set (element, "force-caps", cache->container, NULL);
+    g_signal_connect (element, "have-type", G_CALLBACK (have_type_cb), cache);
+  } else if (is_plugged_factory (factory)) {
+    g_mutex_lock (&cache->lock);
+    if (!has_factory (cache->found_factories, name))
+      g_ptr_array_add (cache->found_factories, g_strdup (name));
+    g_mutex_unlock (&cache->lock);
+  }
+}
+
+static gboolean is_cached_factory (ProbeCache *cache, GstElementFactory *factory) {
+  return g_strv_contains ((const gchar * const *) cache->factories, GST_OBJECT_NAME (factory));
+}
+
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+/* Stable sort putting the factories that worked last time in front */
+static GValueArray *autoplug_sort_cb (GstElement *source, GstPad *pad, GstCaps *caps,
+    GValueArray *factories, ProbeCache *cache) {
+  GValueArray *sorted;
+  gboolean any = FALSE;
+  guint i, pass;
+
+  for (i = 0; i < factories->n_values && !any; i++)
+    any = is_cached_factory (cache, g_value_get_object (g_value_array_get_nth (factories, i)));
+  if (!any)
+    return NULL;
+
+  sorted = g_value_array_new (factories->n_values);
+  for (pass = 0; pass < 2; pass++) {
+    for (i = 0; i < factories->n_values; i++) {
+      GValue *value = g_value_array_get_nth (factories, i);
+      if (is_cached_factory (cache, g_value_get_object (value)) == (pass == 0))
+        g_value_array_append (sorted, value);
+    }
+  }
+  return sorted;
+}
+G_GNUC_END_IGNORE_DEPRECATIONS
+
+static void store_stream_caps (ProbeCache *cache, GstCaps *caps) {
+  const gchar *type = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (stream_keys); i++) {
+    if (g_str_has_prefix (type, stream_keys[i])) {
+      g_mutex_lock (&cache->lock);
+      g_free (cache->found_streams[i]);
+      cache->found_streams[i] = gst_caps_to_string (caps);
+      g_mutex_unlock (&cache->lock);
+    }
+  }
+}
+
+static GstPadProbeReturn caps_event_cb (GstPad *pad, GstPadProbeInfo *info, ProbeCache *cache) {
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstCaps *caps;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+  gst_event_parse_caps (event, &caps);
+  store_stream_caps (cache, caps);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static void pad_added_cb (GstElement *source, GstPad *pad, ProbeCache *cache) {
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+
+  /* uridecodebin3 exposes pads before their caps are negotiated, take them from the caps event */
+  if (caps == NULL) {
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, (GstPadProbeCallback) caps_event_cb, cache, NULL);
+    return;
+  }
+  store_stream_caps (cache, caps);
+  gst_caps_unref (caps);
+}
+
+void probe_cache_attach (ProbeCache *cache, CustomData *data) {
+  if (cache->group == NULL)
+    return;
+
+  g_signal_connect (data->source, "deep-element-added", G_CALLBACK (deep_element_added_cb), cache);
+  g_signal_connect (data->source, "pad-added", G_CALLBACK (pad_added_cb), cache);
+  if (!cache->hit)
+    return;
+
+  if (cache->factories != NULL && g_signal_lookup ("autoplug-sort", G_OBJECT_TYPE (data->source)) != 0)
+    g_signal_connect (data->source, "autoplug-sort", G_CALLBACK (autoplug_sort_cb), cache);
+  /* The seek bar gets its range before the duration query can answer */
+  if (cache->duration > 0)
+    atomic_store (&data->duration, cache->duration);
+  g_print ("Probe cache hit, skipping typefind\n");
+}
+
+/* Keep the file small, forget the least recently opened entries */
+static void prune (GKeyFile *keyfile) {
+  gchar **groups;
+  gsize n;
+
+  groups = g_key_file_get_groups (keyfile, &n);
+  while (n > MAX_ENTRIES) {
+    gsize i, oldest = 0;
+    for (i = 1; i < n; i++) {
+      if (g_key_file_get_int64 (keyfile, groups[i], "used", NULL) <
+          g_key_file_get_int64 (keyfile, groups[oldest], "used", NULL))
+        oldest = i;
+    }
+    g_key_file_remove_group (keyfile, groups[oldest], NULL);
+    g_free (groups[oldest]);
+    groups[oldest] = groups[--n];
+    groups[n] = NULL;
+  }
+  g_strfreev (groups);
+}
+
+void probe_cache_store (ProbeCache *cache, gint64 duration) {
+  GError *error = NULL;
+  gchar *dir;
+  guint i;
+
+  if (cache == NULL || cache->group == NULL)
+    return;
+
+  g_mutex_lock (&cache->lock);
+  /* Nothing new learned, e.g. quit before typefinding */
+  if (cache->found_container == NULL && !cache->hit) {
+    g_mutex_unlock (&cache->lock);
+    return;
+  }
+  g_key_file_set_int64 (cache->keyfile, cache->group, "size", cache->size);
+  g_key_file_set_int64 (cache->keyfile, cache->group, "mtime", cache->mtime);
+  g_key_file_set_int64 (cache->keyfile, cache->group, "used", g_get_real_time () / G_USEC_PER_SEC);
+  if (cache->found_container != NULL)
+    g_key_file_set_string (cache->keyfile, cache->group, "container", cache->found_container);
+  for (i = 0; i < G_N_ELEMENTS (stream_keys); i++) {
+    if (cache->found_streams[i] != NULL)
+      g_key_file_set_string (cache->keyfile, cache->group, stream_keys[i], cache->found_streams[i]);
+  }
+  if (cache->found_factories->len > 0)
+    g_key_file_set_string_list (cache->keyfile, cache->group, "factories",
+        (const gchar * const *) cache->found_factories->pdata, cache->found_factories->len);
+  g_mutex_unlock (&cache->lock);
+  if (GST_CLOCK_TIME_IS_VALID (duration))
+    g_key_file_set_int64 (cache->keyfile, cache->group, "duration", duration);
+
+  prune (cache->keyfile);
+  dir = g_path_get_dirname (cache->path);
+  g_mkdir_with_parents (dir, 0700);
+  g_free (dir);
+  if (!g_key_file_save_to_file (cache->keyfile, cache->path, &error)) {
+    g_printerr ("Could not write the probe cache: %s\n", error->message);
+    g_clear_error (&error);
+  }
+}
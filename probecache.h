@@ -0,0 +1,38 @@
+#ifndef PROBECACHE_H
+#define PROBECACHE_H
+
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+/* What uridecodebin found out about a local file the last time it was opened */
+typedef struct _ProbeCache {
+  gchar *path;
+  GKeyFile *keyfile;
+  gchar *group;                 /* entry for the current file, NULL when not cacheable */
+  gint64 size;
+  gint64 mtime;
+
+  /* Cached entry, valid when hit */
+  gboolean hit;
+  GstCaps *container;
+  gchar **factories;
+  gint64 duration;
+
+  /* Recorded from the streaming threads for the next start */
+  GMutex lock;
+  gchar *found_container;
+  gchar *found_streams[2];      /* video, audio */
+  GPtrArray *found_factories;
+} ProbeCache;
+
+/* Look the URI up in the user cache directory, only file URIs are cached */
+ProbeCache *probe_cache_open (const gchar *uri);
+void probe_cache_free (ProbeCache *cache);
+
+/* Skip typefinding, try the decoders used last time first and record what gets plugged */
+void probe_cache_attach (ProbeCache *cache, CustomData *data);
+/* Write the entry back, duration is GST_CLOCK_TIME_NONE when unknown */
+void probe_cache_store (ProbeCache *cache, gint64 duration);
+
+#endif
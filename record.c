@@ -0,0 +1,426 @@
+#include <string.h>
+
+#include <gst/gst.h>
+
+#include "record.h"
+#include "player.h"
+#include "pipeline.h"
+
+/* Longest backlog the record branches absorb before dropping the oldest data */
+#define RECORD_QUEUE_TIME (2 * GST_SECOND)
+
+/* Formats kept as they are with --record-remux, matroskamux takes all of them */
+static const gchar *remux_caps =
+    "video/x-raw(ANY); audio/x-raw(ANY); text/x-raw(ANY);"
+    "video/x-h264; video/x-h265; video/x-vp8; video/x-vp9; video/x-av1;"
+    "audio/mpeg; audio/x-opus; audio/x-vorbis; audio/x-flac; audio/x-ac3; audio/x-eac3";
+
+/* First available encoder wins */
+static const gchar *video_encoders[] = { "x264enc", "openh264enc", "vp8enc", NULL };
+static const gchar *audio_encoders[] = { "opusenc", "vorbisenc", NULL };
+
+
+Record *record_new (const gchar *path, gboolean remux) {
+  Record *record = g_new0 (Record, 1);
+
+  record->path = g_strdup (path);
+  record->remux = remux;
+  record->video.record = record->audio.record = record;
+  record->video.name = "video";
+  record->audio.name = "audio";
+  g_mutex_init (&record->lock);
+  g_cond_init (&record->cond);
+  return record;
+}
+
+void record_free (Record *record) {
+  if (record == NULL)
+    return;
+  g_free (record->path);
+  g_mutex_clear (&record->lock);
+  g_cond_clear (&record->cond);
+  g_free (record);
+}
+
+static GstPadProbeReturn count_in_cb (GstPad *pad, GstPadProbeInfo *info, RecordBranch *branch) {
+  atomic_fetch_add (&branch->in, 1);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn count_out_cb (GstPad *pad, GstPadProbeInfo *info, RecordBranch *branch) {
+  atomic_fetch_add (&branch->out, 1);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn block_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn file_probe_cb (GstPad *pad, GstPadProbeInfo *info, Record *record) {
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    atomic_fetch_add (&record->bytes, gst_buffer_get_size (GST_PAD_PROBE_INFO_BUFFER (info)));
+  } else if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) == GST_EVENT_EOS) {
+    g_mutex_lock (&record->lock);
+    record->finished = TRUE;
+    g_cond_broadcast (&record->cond);
+    g_mutex_unlock (&record->lock);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+static GstElement *make_first (const gchar **factories) {
+  GstElement *element = NULL;
+
+  for (; *factories != NULL && element == NULL; factories++)
+    element = gst_element_factory_make (*factories, NULL);
+  return element;
+}
+
+/* Highest ranked parser for the caps, muxers want aligned and complete headers */
+static GstElement *make_parser (GstCaps *caps) {
+  GList *parsers = gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_PARSER, GST_RANK_MARGINAL);
+  GList *usable = gst_element_factory_list_filter (parsers, caps, GST_PAD_SINK, FALSE);
+  GstElement *parser = NULL;
+
+  usable = g_list_sort (usable, gst_plugin_feature_rank_compare_func);
+  if (usable != NULL)
+    parser = gst_element_factory_create (GST_ELEMENT_FACTORY (usable->data), NULL);
+  gst_plugin_feature_list_free (usable);
+  gst_plugin_feature_list_free (parsers);
+  return parser;
+}
+
+/* Encoders run with low latency so the leaky queue is what absorbs stalls */
+static GstElement *make_encoder (gboolean video) {
+  GstElement *encoder = make_first (video ? video_encoders : audio_encoders);
+
+  if (encoder == NULL)
+    return NULL;
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (encoder), "tune"))
+    gst_util_set_object_arg (G_OBJECT (encoder), "tune", "zerolatency");
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (encoder), "speed-preset"))
+    gst_util_set_object_arg (G_OBJECT (encoder), "speed-preset", "superfast");
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (encoder), "deadline"))
+    g_object_set (encoder, "deadline", (gint64) 1, NULL);
+  return encoder;
+}
+
+/* Drop a chain added to the bin before any data reached it */
+static void discard_chain (RecordBranch *branch, GstBin *bin, GstElement **chain, guint n) {
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    gst_element_set_state (chain[i], GST_STATE_NULL);
+    gst_bin_remove (bin, chain[i]);
+  }
+  branch->queue = NULL;
+}
+
+/* Streaming thread: build queue -> processing -> muxer pad and link the upstream pad to it,
+ * FALSE with nothing left in the pipeline when any link fails */
+static gboolean build_branch (Record *record, RecordBranch *branch, GstPad *upstream, GstCaps *caps, gboolean video) {
+  GstElement *chain[4] = { NULL };
+  GstBin *bin = GST_BIN (record->data->pipeline);
+  GstPad *pad, *mux_pad;
+  gboolean linked = TRUE;
+  guint i, n = 0;
+
+  branch->queue = gst_element_factory_make ("queue", NULL);
+  chain[n++] = branch->queue;
+  if (branch->remux) {
+    chain[n++] = make_parser (caps);
+  } else if (video) {
+    chain[n++] = gst_element_factory_make ("videoconvert", NULL);
+    chain[n++] = make_encoder (TRUE);
+  } else {
+    chain[n++] = gst_element_factory_make ("audioconvert", NULL);
+    chain[n++] = gst_element_factory_make ("audioresample", NULL);
+    chain[n++] = make_encoder (FALSE);
+  }
+  for (i = 0; i < n; i++) {
+    if (chain[i] == NULL) {
+      g_printerr ("No %s for recording the %s stream.\n", i == n - 1 ? (branch->remux ? "parser" : "encoder") : "element", branch->name);
+      for (i = 0; i < n; i++) {
+        if (chain[i] != NULL)
+          gst_object_unref (gst_object_ref_sink (chain[i]));
+      }
+      branch->queue = NULL;
+      return FALSE;
+    }
+  }
+
+  /* A slow disk or encoder drops the oldest recorded data, playback never waits */
+  g_object_set (branch->queue, "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0,
+      "max-size-time", RECORD_QUEUE_TIME, NULL);
+
+  for (i = 0; i < n; i++)
+    gst_bin_add (bin, chain[i]);
+  for (i = 0; i + 1 < n && linked; i++)
+    linked = gst_element_link (chain[i], chain[i + 1]);
+  if (!linked) {
+    g_printerr ("Could not link the recording chain of the %s stream.\n", branch->name);
+    discard_chain (branch, bin, chain, n);
+    return FALSE;
+  }
+
+  mux_pad = gst_element_request_pad_simple (record->mux, video ? "video_%u" : "audio_%u");
+  pad = gst_element_get_static_pad (chain[n - 1], "src");
+  linked = mux_pad != NULL && GST_PAD_LINK_SUCCESSFUL (gst_pad_link (pad, mux_pad));
+  gst_object_unref (pad);
+  if (linked) {
+    pad = gst_element_get_static_pad (branch->queue, "sink");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) count_in_cb, branch, NULL);
+    linked = GST_PAD_LINK_SUCCESSFUL (gst_pad_link (upstream, pad));
+    gst_object_unref (pad);
+  }
+  /* An unlinked branch would post a not-linked flow error and stop playback */
+  if (!linked) {
+    g_printerr ("The recorded %s stream could not be linked to the muxer.\n", branch->name);
+    if (mux_pad != NULL) {
+      gst_element_release_request_pad (record->mux, mux_pad);
+      gst_object_unref (mux_pad);
+    }
+    discard_chain (branch, bin, chain, n);
+    return FALSE;
+  }
+  gst_object_unref (mux_pad);
+
+  pad = gst_element_get_static_pad (branch->queue, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) count_out_cb, branch, NULL);
+  /* The muxer writes its header on the first data, it must know all streams by then */
+  g_mutex_lock (&record->lock);
+  if (!record->released)
+    branch->block_id = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM, block_cb, NULL, NULL);
+  g_mutex_unlock (&record->lock);
+  gst_object_unref (pad);
+
+  for (i = 0; i < n; i++)
+    gst_element_sync_state_with_parent (chain[i]);
+  g_print ("Recording %s stream (%s)\n", branch->name, branch->remux ? "remuxed" : "encoded");
+  return TRUE;
+}
+
+/* Remuxed streams: the compressed pad feeds a tee, one side decodes for playback */
+static void decoder_pad_added_cb (GstElement *decoder, GstPad *pad, CustomData *data) {
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  const gchar *type;
+  GstElement *queue = NULL;
+  GstPad *sinkpad;
+
+  if (caps == NULL)
+    return;
+  type = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+  if (g_str_has_prefix (type, "video/x-raw"))
+    queue = data->video_queue;
+  else if (g_str_has_prefix (type, "audio/x-raw"))
+    queue = data->audio_queue;
+  gst_caps_unref (caps);
+  if (queue == NULL)
+    return;
+
+  sinkpad = gst_element_get_static_pad (queue, "sink");
+  if (!gst_pad_is_linked (sinkpad) && GST_PAD_LINK_FAILED (gst_pad_link (pad, sinkpad)))
+    g_printerr ("Type is '%s' but link failed.\n", type);
+  gst_object_unref (sinkpad);
+}
+
+static void remux_pad (Record *record, RecordBranch *branch, GstPad *pad, GstCaps *caps, gboolean video) {
+  GstElement *tee = gst_element_factory_make ("tee", NULL);
+  GstElement *decoder = gst_element_factory_make ("decodebin", NULL);
+  GstPad *tee_pad, *sinkpad;
+
+  if (tee == NULL || decoder == NULL)
+    return;
+  gst_bin_add_many (GST_BIN (record->data->pipeline), tee, decoder, NULL);
+  g_signal_connect (decoder, "pad-added", G_CALLBACK (decoder_pad_added_cb), record->data);
+  gst_element_link (tee, decoder);
+
+  sinkpad = gst_element_get_static_pad (tee, "sink");
+  gst_pad_link (pad, sinkpad);
+  gst_object_unref (sinkpad);
+
+  branch->remux = TRUE;
+  tee_pad = gst_element_request_pad_simple (tee, "src_%u");
+  if (!build_branch (record, branch, tee_pad, caps, video)) {
+    /* Playback still goes through the decoder side of the tee */
+    gst_element_release_request_pad (tee, tee_pad);
+    branch->remux = FALSE;
+  }
+  gst_object_unref (tee_pad);
+  gst_element_sync_state_with_parent (decoder);
+  gst_element_sync_state_with_parent (tee);
+}
+
+static void source_pad_added_cb (GstElement *source, GstPad *pad, Record *record) {
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  const gchar *type;
+  gboolean video, raw;
+  RecordBranch *branch;
+  GstPad *tee_pad;
+
+  if (caps == NULL)
+    return;
+  type = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+  video = g_str_has_prefix (type, "video/");
+  raw = g_str_has_suffix (type, "/x-raw");
+  branch = video ? &record->video : &record->audio;
+  if ((!video && !g_str_has_prefix (type, "audio/")) || branch->queue != NULL) {
+    gst_caps_unref (caps);
+    return;
+  }
+
+  if (raw) {
+    /* Decoded by the source, encode from the tee after the playback queue */
+    GstElement *tee = video ? record->vtee : record->atee;
+
+    tee_pad = gst_element_request_pad_simple (tee, "src_%u");
+    if (!build_branch (record, branch, tee_pad, caps, video))
+      gst_element_release_request_pad (tee, tee_pad);
+    gst_object_unref (tee_pad);
+  } else if (record->remux) {
+    remux_pad (record, branch, pad, caps, video);
+  }
+  gst_caps_unref (caps);
+}
+
+static void release_branch (RecordBranch *branch) {
+  GstPad *pad;
+
+  if (branch->block_id == 0)
+    return;
+  pad = gst_element_get_static_pad (branch->queue, "src");
+  gst_pad_remove_probe (pad, branch->block_id);
+  gst_object_unref (pad);
+  branch->block_id = 0;
+}
+
+static void source_no_more_pads_cb (GstElement *source, Record *record) {
+  g_mutex_lock (&record->lock);
+  record->released = TRUE;
+  g_mutex_unlock (&record->lock);
+
+  if (record->video.queue == NULL && record->audio.queue == NULL) {
+    GstPad *pad = gst_element_get_static_pad (record->filesink, "sink");
+
+    /* The muxer has no input and would hold the pipeline EOS back forever */
+    g_printerr ("Nothing to record in this stream.\n");
+    gst_pad_send_event (pad, gst_event_new_eos ());
+    gst_object_unref (pad);
+  }
+  release_branch (&record->video);
+  release_branch (&record->audio);
+}
+
+gboolean record_setup (Record *record, CustomData *data) {
+  GstPad *pad;
+
+  record->data = data;
+  record->mux = gst_element_factory_make ("matroskamux", "record-mux");
+  record->filesink = gst_element_factory_make ("filesink", "record-sink");
+  if (!record->mux || !record->filesink || data->source == NULL) {
+    g_printerr ("Recording needs matroskamux, filesink and a single source.\n");
+    return FALSE;
+  }
+
+  /* Preroll comes from the playback sinks, the file is written as data arrives */
+  g_object_set (record->filesink, "location", record->path, "async", FALSE, NULL);
+  gst_bin_add_many (GST_BIN (data->pipeline), record->mux, record->filesink, NULL);
+  gst_element_link (record->mux, record->filesink);
+
+  record->vtee = pipeline_splice_tee (data, data->video_queue);
+  record->atee = pipeline_splice_tee (data, data->audio_queue);
+
+  pad = gst_element_get_static_pad (record->filesink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      (GstPadProbeCallback) file_probe_cb, record, NULL);
+  gst_object_unref (pad);
+
+  if (record->remux) {
+    GstCaps *caps = gst_caps_from_string (remux_caps);
+    g_object_set (data->source, "caps", caps, NULL);
+    gst_caps_unref (caps);
+  }
+  g_signal_connect (data->source, "pad-added", G_CALLBACK (source_pad_added_cb), record);
+  g_signal_connect (data->source, "no-more-pads", G_CALLBACK (source_no_more_pads_cb), record);
+  g_print ("Recording to %s\n", record->path);
+  return TRUE;
+}
+
+static void send_eos (RecordBranch *branch) {
+  GstPad *pad;
+
+  if (branch->queue == NULL)
+    return;
+  pad = gst_element_get_static_pad (branch->queue, "sink");
+  gst_pad_send_event (pad, gst_event_new_eos ());
+  gst_object_unref (pad);
+}
+
+void record_finish (Record *record, guint timeout_ms) {
+  gint64 end_time = g_get_monotonic_time () + timeout_ms * G_TIME_SPAN_MILLISECOND;
+  GstState state = GST_STATE_NULL;
+
+  if (record == NULL)
+    return;
+
+  /* Below PAUSED nothing flows, the EOS would never reach the file */
+  gst_element_get_state (record->data->pipeline, &state, NULL, 0);
+
+  g_mutex_lock (&record->lock);
+  if (!record->finished && state >= GST_STATE_PAUSED &&
+      (record->video.queue != NULL || record->audio.queue != NULL)) {
+    g_mutex_unlock (&record->lock);
+    /* Lets the muxer write its index, the queues drop whatever still waits */
+    release_branch (&record->video);
+    release_branch (&record->audio);
+    send_eos (&record->video);
+    send_eos (&record->audio);
+    g_mutex_lock (&record->lock);
+    while (!record->finished && g_cond_wait_until (&record->cond, &record->lock, end_time));
+  }
+  if (!record->finished)
+    g_printerr ("Recording to %s was not finalized.\n", record->path);
+  g_mutex_unlock (&record->lock);
+}
+
+static guint64 branch_dropped (RecordBranch *branch) {
+  guint level = 0;
+  guint64 in = atomic_load (&branch->in), out = atomic_load (&branch->out);
+
+  if (branch->queue != NULL)
+    g_object_get (branch->queue, "current-level-buffers", &level, NULL);
+  return in > out + level ? in - out - level : 0;
+}
+
+void record_report (Record *record) {
+  RecordBranch *branches[] = { &record->video, &record->audio };
+  guint i;
+
+  if (record == NULL)
+    return;
+
+  for (i = 0; i < G_N_ELEMENTS (branches); i++) {
+    if (branches[i]->queue == NULL)
+      continue;
+    g_print ("Recorded %s: %" G_GUINT64_FORMAT " buffers, %" G_GUINT64_FORMAT " dropped\n", branches[i]->name,
+        (guint64) atomic_load (&branches[i]->out), branch_dropped (branches[i]));
+  }
+  g_print ("Recorded %" G_GUINT64_FORMAT " bytes to %s\n", (guint64) atomic_load (&record->bytes), record->path);
+}
+
+void record_append_json (Record *record, GString *str, gdouble wall_s) {
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+  guint64 bytes;
+
+  if (record == NULL)
+    return;
+
+  bytes = atomic_load (&record->bytes);
+  g_string_append_printf (str, ",\"record\":{\"mode\":\"%s\",\"bytes\":%" G_GUINT64_FORMAT ",\"mb_per_s\":%s",
+      record->remux ? "remux" : "encode", bytes,
+      g_ascii_formatd (buf, sizeof (buf), "%.2f", wall_s > 0 ? bytes / wall_s / (1024 * 1024) : 0));
+  g_string_append_printf (str, ",\"video_buffers\":%" G_GUINT64_FORMAT ",\"video_dropped\":%" G_GUINT64_FORMAT,
+      (guint64) atomic_load (&record->video.out), branch_dropped (&record->video));
+  g_string_append_printf (str, ",\"audio_buffers\":%" G_GUINT64_FORMAT ",\"audio_dropped\":%" G_GUINT64_FORMAT "}",
+      (guint64) atomic_load (&record->audio.out), branch_dropped (&record->audio));
+}
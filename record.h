@@ -0,0 +1,50 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdatomic.h>
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+typedef struct _Record Record;
+
+/* One recorded stream: tee -> leaky queue -> [encoder | parser] -> muxer */
+typedef struct _RecordBranch {
+  Record *record;
+  const gchar *name;
+  gboolean remux;
+  GstElement *queue;
+  gulong block_id;              /* held until every stream has its muxer pad */
+  atomic_uint_fast64_t in;
+  atomic_uint_fast64_t out;
+} RecordBranch;
+
+struct _Record {
+  gchar *path;
+  gboolean remux;               /* keep the source codecs when the muxer takes them */
+  CustomData *data;
+  GstElement *vtee;
+  GstElement *atee;
+  GstElement *mux;
+  GstElement *filesink;
+
+  GMutex lock;
+  GCond cond;
+  RecordBranch video;
+  RecordBranch audio;
+  gboolean released;
+  gboolean finished;            /* EOS reached the file */
+  atomic_uint_fast64_t bytes;
+};
+
+Record *record_new (const gchar *path, gboolean remux);
+void record_free (Record *record);
+
+/* Splice tees after the branch queues and add the muxer; call before the source exposes pads */
+gboolean record_setup (Record *record, CustomData *data);
+/* Finish the file when playback stops before EOS, waits at most timeout_ms */
+void record_finish (Record *record, guint timeout_ms);
+/* Frames written and dropped per stream */
+void record_report (Record *record);
+void record_append_json (Record *record, GString *str, gdouble wall_s);
+
+#endif
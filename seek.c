@@ -0,0 +1,285 @@
+#include <string.h>
+
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+
+#include "seek.h"
+#include "player.h"
+#include "playlist.h"
+
+/* Keep the index bounded on very long files */
+#define MAX_KEYFRAMES 100000
+
+typedef struct _DecoderProbe {
+  SeekEngine *seek;
+  GstSegment segment;
+  GstClockTime last_keyframe;   /* since the last flush, NONE when unknown */
+} DecoderProbe;
+
+typedef struct _PositionUpdate {
+  CustomData *data;
+  gint64 position;
+  gint64 duration;
+} PositionUpdate;
+
+
+SeekEngine *seek_engine_new (void) {
+  SeekEngine *seek = g_new0 (SeekEngine, 1);
+
+  g_mutex_init (&seek->index_lock);
+  seek->keyframes = g_array_new (FALSE, FALSE, sizeof (KeyframeEntry));
+  seek->shown_keyframe = GST_CLOCK_TIME_NONE;
+  return seek;
+}
+
+void seek_engine_free (SeekEngine *seek) {
+  if (seek == NULL)
+    return;
+  g_array_unref (seek->keyframes);
+  g_mutex_clear (&seek->index_lock);
+  g_free (seek);
+}
+
+void seek_engine_reset_index (SeekEngine *seek) {
+  g_mutex_lock (&seek->index_lock);
+  g_array_set_size (seek->keyframes, 0);
+  g_mutex_unlock (&seek->index_lock);
+  seek->shown_keyframe = GST_CLOCK_TIME_NONE;
+}
+
+/* Index of the last entry at or before time, -1 if none. Call with index_lock held */
+static gint find_entry (GArray *keyframes, GstClockTime time) {
+  gint lo = 0, hi = (gint) keyframes->len - 1, found = -1;
+
+  while (lo <= hi) {
+    gint mid = (lo + hi) / 2;
+    if (g_array_index (keyframes, KeyframeEntry, mid).time <= time) {
+      found = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return found;
+}
+
+static void index_keyframe (SeekEngine *seek, GstClockTime time, GstClockTime previous) {
+  gint i;
+
+  g_mutex_lock (&seek->index_lock);
+  i = find_entry (seek->keyframes, time);
+  if (i < 0 || g_array_index (seek->keyframes, KeyframeEntry, i).time != time) {
+    KeyframeEntry entry = { time, FALSE };
+    if (seek->keyframes->len >= MAX_KEYFRAMES) {
+      g_mutex_unlock (&seek->index_lock);
+      return;
+    }
+    g_array_insert_val (seek->keyframes, i + 1, entry);
+    i++;
+  }
+
+  /* Seen back to back while decoding: no keyframe hides between the two */
+  if (GST_CLOCK_TIME_IS_VALID (previous) && i > 0 &&
+      g_array_index (seek->keyframes, KeyframeEntry, i - 1).time == previous)
+    g_array_index (seek->keyframes, KeyframeEntry, i - 1).contiguous = TRUE;
+  g_mutex_unlock (&seek->index_lock);
+}
+
+/* Keyframe a decode of target has to start from, if the index knows it for sure */
+static gboolean lookup_keyframe (SeekEngine *seek, GstClockTime target, GstClockTime *keyframe) {
+  gboolean known = FALSE;
+  gint i;
+
+  g_mutex_lock (&seek->index_lock);
+  i = find_entry (seek->keyframes, target);
+  if (i >= 0) {
+    KeyframeEntry *entry = &g_array_index (seek->keyframes, KeyframeEntry, i);
+    known = entry->time == target || entry->contiguous;
+    *keyframe = entry->time;
+  }
+  g_mutex_unlock (&seek->index_lock);
+  return known;
+}
+
+static GstPadProbeReturn decoder_probe_cb (GstPad *pad, GstPadProbeInfo *info, DecoderProbe *probe) {
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT) {
+      gst_event_copy_segment (event, &probe->segment);
+      probe->last_keyframe = GST_CLOCK_TIME_NONE;
+    } else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+      probe->last_keyframe = GST_CLOCK_TIME_NONE;
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime ts = GST_BUFFER_PTS_IS_VALID (buffer) ? GST_BUFFER_PTS (buffer) : GST_BUFFER_DTS (buffer);
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT) || !GST_CLOCK_TIME_IS_VALID (ts) ||
+      probe->segment.format != GST_FORMAT_TIME)
+    return GST_PAD_PROBE_OK;
+
+  ts = gst_segment_to_stream_time (&probe->segment, GST_FORMAT_TIME, ts);
+  if (GST_CLOCK_TIME_IS_VALID (ts)) {
+    index_keyframe (probe->seek, ts, probe->last_keyframe);
+    probe->last_keyframe = ts;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, SeekEngine *seek) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *klass;
+  DecoderProbe *probe;
+  GstPad *pad;
+
+  if (factory == NULL)
+    return;
+  klass = gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS);
+  if (klass == NULL || strstr (klass, "Decoder") == NULL || strstr (klass, "Video") == NULL)
+    return;
+
+  pad = gst_element_get_static_pad (element, "sink");
+  if (pad == NULL)
+    return;
+
+  probe = g_new0 (DecoderProbe, 1);
+  probe->seek = seek;
+  probe->last_keyframe = GST_CLOCK_TIME_NONE;
+  gst_segment_init (&probe->segment, GST_FORMAT_UNDEFINED);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+      (GstPadProbeCallback) decoder_probe_cb, probe, g_free);
+  gst_object_unref (pad);
+}
+
+void seek_engine_attach (SeekEngine *seek, CustomData *data) {
+  g_signal_connect (data->pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), seek);
+}
+
+
+static void issue_seek (CustomData *data, GstClockTime target, gboolean accurate) {
+  SeekEngine *seek = data->seek;
+  GstSeekFlags flags = GST_SEEK_FLAG_FLUSH;
+  GstClockTime keyframe;
+  gboolean known = lookup_keyframe (seek, target, &keyframe);
+
+  if (accurate) {
+    flags |= GST_SEEK_FLAG_ACCURATE;
+    seek->shown_keyframe = GST_CLOCK_TIME_NONE;
+  } else if (known) {
+    /* The frame this scrub would show is already on screen */
+    if (keyframe == seek->shown_keyframe) {
+      seek->skipped++;
+      return;
+    }
+    /* Exact keyframe position: no snapping search, decoding starts right there */
+    flags |= GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE;
+    target = keyframe;
+    seek->shown_keyframe = keyframe;
+  } else {
+    flags |= GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST;
+    seek->shown_keyframe = GST_CLOCK_TIME_NONE;
+  }
+
+  /* The flush restarts running time at zero for the item being played */
+  playlist_reset_offsets (data->playlist);
+  if (gst_element_seek_simple (data->pipeline, GST_FORMAT_TIME, flags, target)) {
+    seek->in_flight = TRUE;
+    seek->issued++;
+  } else {
+    g_printerr ("Seek to %" GST_TIME_FORMAT " failed.\n", GST_TIME_ARGS (target));
+  }
+}
+
+void seek_request (CustomData *data, GstClockTime target, gboolean accurate) {
+  SeekEngine *seek = data->seek;
+
+  if (seek == NULL || !data->seek_enabled)
+    return;
+
+  if (seek->in_flight) {
+    if (seek->has_pending)
+      seek->coalesced++;
+    seek->has_pending = TRUE;
+    seek->pending_target = target;
+    seek->pending_accurate = accurate;
+    return;
+  }
+  issue_seek (data, target, accurate);
+}
+
+/* The flushing seek has prerolled, start the latest request that arrived meanwhile */
+void seek_handle_async_done (CustomData *data) {
+  SeekEngine *seek = data->seek;
+
+  if (seek == NULL || !seek->in_flight)
+    return;
+
+  seek->in_flight = FALSE;
+  if (seek->has_pending) {
+    seek->has_pending = FALSE;
+    issue_seek (data, seek->pending_target, seek->pending_accurate);
+  }
+}
+
+
+static gboolean update_bar (PositionUpdate *update) {
+  SeekEngine *seek = update->data->seek;
+  gdouble duration_s = update->duration / (gdouble) GST_SECOND;
+
+  if (seek->dragging)
+    return G_SOURCE_REMOVE;
+
+  if (update->duration > 0 && duration_s != seek->duration_s) {
+    seek->duration_s = duration_s;
+    gtk_range_set_range (GTK_RANGE (seek->scale), 0, duration_s);
+  }
+  if (update->position >= 0)
+    gtk_range_set_value (GTK_RANGE (seek->scale), update->position / (gdouble) GST_SECOND);
+  return G_SOURCE_REMOVE;
+}
+
+void seek_publish_position (CustomData *data, gint64 position, gint64 duration) {
+  PositionUpdate *update;
+
+  if (data->seek == NULL || data->seek->scale == NULL)
+    return;
+
+  update = g_new (PositionUpdate, 1);
+  update->data = data;
+  update->position = position;
+  update->duration = GST_CLOCK_TIME_IS_VALID (duration) ? duration : -1;
+  g_main_context_invoke_full (NULL, G_PRIORITY_DEFAULT, (GSourceFunc) update_bar, update, g_free);
+}
+
+static gboolean change_value_cb (GtkRange *range, GtkScrollType scroll, gdouble value, CustomData *data) {
+  value = CLAMP (value, 0, data->seek->duration_s);
+  /* Drags scrub on keyframes, clicks and keys seek accurately */
+  control_send (data, data->seek->dragging ? CONTROL_CMD_SCRUB : CONTROL_CMD_SEEK, (gint64) (value * GST_SECOND));
+  return FALSE;
+}
+
+static gboolean button_press_cb (GtkWidget *widget, GdkEventButton *event, CustomData *data) {
+  data->seek->dragging = TRUE;
+  return FALSE;
+}
+
+static gboolean button_release_cb (GtkWidget *widget, GdkEventButton *event, CustomData *data) {
+  gdouble value = gtk_range_get_value (GTK_RANGE (widget));
+
+  data->seek->dragging = FALSE;
+  control_send (data, CONTROL_CMD_SEEK, (gint64) (value * GST_SECOND));
+  return FALSE;
+}
+
+GtkWidget *seek_create_bar (CustomData *data) {
+  SeekEngine *seek = data->seek;
+
+  seek->scale = gtk_scale_new_with_range (GTK_ORIENTATION_HORIZONTAL, 0, 1, 0.1);
+  gtk_scale_set_draw_value (GTK_SCALE (seek->scale), FALSE);
+  g_signal_connect (G_OBJECT (seek->scale), "change-value", G_CALLBACK (change_value_cb), data);
+  g_signal_connect (G_OBJECT (seek->scale), "button-press-event", G_CALLBACK (button_press_cb), data);
+  g_signal_connect (G_OBJECT (seek->scale), "button-release-event", G_CALLBACK (button_release_cb), data);
+  return seek->scale;
+}
@@ -0,0 +1,53 @@
+#ifndef SEEK_H
+#define SEEK_H
+
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+/* A keyframe seen in the bitstream; contiguous when the next entry is
+ * known to be the very next keyframe, i.e. nothing was skipped in between */
+typedef struct _KeyframeEntry {
+  GstClockTime time;
+  gboolean contiguous;
+} KeyframeEntry;
+
+typedef struct _SeekEngine {
+  /* UI thread */
+  GtkWidget *scale;
+  gboolean dragging;
+  gdouble duration_s;
+
+  /* Control thread: at most one flushing seek in flight, newer requests replace the pending one */
+  gboolean in_flight;
+  gboolean has_pending;
+  GstClockTime pending_target;
+  gboolean pending_accurate;
+  GstClockTime shown_keyframe;
+  guint issued;
+  guint coalesced;
+  guint skipped;
+
+  /* Keyframe index, filled lazily from the video decoder input */
+  GMutex index_lock;
+  GArray *keyframes;
+} SeekEngine;
+
+SeekEngine *seek_engine_new (void);
+void seek_engine_free (SeekEngine *seek);
+
+/* Watch video decoders as they are autoplugged to index their keyframes */
+void seek_engine_attach (SeekEngine *seek, CustomData *data);
+/* Forget the index, for a new file */
+void seek_engine_reset_index (SeekEngine *seek);
+
+/* UI thread */
+GtkWidget *seek_create_bar (CustomData *data);
+
+/* Control thread */
+void seek_publish_position (CustomData *data, gint64 position, gint64 duration);
+void seek_request (CustomData *data, GstClockTime target, gboolean accurate);
+void seek_handle_async_done (CustomData *data);
+
+#endif
@@ -0,0 +1,101 @@
+#include <gst/gst.h>
+
+#include "startup.h"
+#include "player.h"
+
+static const gchar *phase_names[STARTUP_N_PHASES] = {
+  "options+gst_init", "hwaccel", "gtk_init", "pipeline", "ui",
+  "typefind", "pads", "first frame", "preroll", "playing"
+};
+
+
+StartupTrace *startup_trace_new (gint64 start) {
+  StartupTrace *trace = g_new0 (StartupTrace, 1);
+
+  trace->start = start;
+  return trace;
+}
+
+void startup_trace_free (StartupTrace *trace) {
+  g_free (trace);
+}
+
+void startup_mark (StartupTrace *trace, StartupPhase phase) {
+  gint64 unset = 0;
+
+  if (trace == NULL)
+    return;
+  atomic_compare_exchange_strong (&trace->marks[phase], &unset, g_get_monotonic_time ());
+}
+
+static void have_type_cb (GstElement *typefind, guint probability, GstCaps *caps, StartupTrace *trace) {
+  startup_mark (trace, STARTUP_PHASE_TYPEFIND);
+}
+
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, StartupTrace *trace) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  if (factory != NULL && g_strcmp0 (GST_OBJECT_NAME (factory), "typefind") == 0)
+    g_signal_connect (element, "have-type", G_CALLBACK (have_type_cb), trace);
+}
+
+static void no_more_pads_cb (GstElement *source, StartupTrace *trace) {
+  startup_mark (trace, STARTUP_PHASE_PADS);
+}
+
+static GstPadProbeReturn first_buffer_cb (GstPad *pad, GstPadProbeInfo *info, StartupTrace *trace) {
+  startup_mark (trace, STARTUP_PHASE_FIRST_FRAME);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static void probe_first_buffer (StartupTrace *trace, GstElement *sink) {
+  GstPad *pad = gst_element_get_static_pad (sink, "sink");
+
+  if (pad == NULL)
+    return;
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) first_buffer_cb, trace, NULL);
+  gst_object_unref (pad);
+}
+
+void startup_attach (StartupTrace *trace, CustomData *data) {
+  if (trace == NULL)
+    return;
+  if (data->source != NULL) {
+    g_signal_connect (data->source, "deep-element-added", G_CALLBACK (deep_element_added_cb), trace);
+    g_signal_connect (data->source, "no-more-pads", G_CALLBACK (no_more_pads_cb), trace);
+  }
+  probe_first_buffer (trace, data->videosink);
+  probe_first_buffer (trace, data->asink);
+}
+
+/* Phases overlap with --fast-start, so list them in the order they completed */
+void startup_report (StartupTrace *trace) {
+  gint order[STARTUP_N_PHASES];
+  gint64 prev;
+  gint i, j, n = 0;
+
+  if (trace == NULL || atomic_exchange (&trace->reported, TRUE))
+    return;
+
+  for (i = 0; i < STARTUP_N_PHASES; i++) {
+    if (atomic_load (&trace->marks[i]) == 0)
+      continue;
+    for (j = n; j > 0 && atomic_load (&trace->marks[order[j - 1]]) > atomic_load (&trace->marks[i]); j--)
+      order[j] = order[j - 1];
+    order[j] = i;
+    n++;
+  }
+
+  g_print ("Startup trace (%s, probe cache %s):\n", trace->fast_start ? "fast start" : "sequential",
+      trace->cache_hit ? "hit" : "miss");
+  prev = trace->start;
+  for (i = 0; i < n; i++) {
+    gint64 mark = atomic_load (&trace->marks[order[i]]);
+    g_print ("  %-16s at %8.1f ms (+%.1f ms)\n", phase_names[order[i]],
+        (mark - trace->start) / 1000.0, (mark - prev) / 1000.0);
+    prev = mark;
+  }
+  if (atomic_load (&trace->marks[STARTUP_PHASE_FIRST_FRAME]) != 0)
+    g_print ("  time to first frame: %.1f ms\n",
+        (atomic_load (&trace->marks[STARTUP_PHASE_FIRST_FRAME]) - trace->start) / 1000.0);
+}
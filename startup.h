@@ -0,0 +1,42 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <stdatomic.h>
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+/* Steps on the way to the first frame, in the order a cold start runs them */
+typedef enum {
+  STARTUP_PHASE_OPTIONS,        /* option parsing, gst_init and the registry */
+  STARTUP_PHASE_HWACCEL,
+  STARTUP_PHASE_GTK_INIT,
+  STARTUP_PHASE_PIPELINE,       /* element creation and linking */
+  STARTUP_PHASE_UI,
+  STARTUP_PHASE_TYPEFIND,       /* container known */
+  STARTUP_PHASE_PADS,           /* decoders plugged, all pads exposed: no-more-pads or streams-selected */
+  STARTUP_PHASE_FIRST_FRAME,    /* first buffer reached a sink */
+  STARTUP_PHASE_PREROLL,        /* first ASYNC_DONE */
+  STARTUP_PHASE_PLAYING,
+  STARTUP_N_PHASES
+} StartupPhase;
+
+typedef struct _StartupTrace {
+  gint64 start;                 /* monotonic time at main() entry */
+  _Atomic gint64 marks[STARTUP_N_PHASES];  /* 0 while not reached */
+  gboolean fast_start;
+  gboolean cache_hit;
+  atomic_bool reported;
+} StartupTrace;
+
+StartupTrace *startup_trace_new (gint64 start);
+void startup_trace_free (StartupTrace *trace);
+
+/* Any thread, the first mark of a phase wins. NULL trace is a no-op */
+void startup_mark (StartupTrace *trace, StartupPhase phase);
+/* Mark typefinding, pad exposure and the first buffer of the built pipeline */
+void startup_attach (StartupTrace *trace, CustomData *data);
+/* Print the time-to-first-frame breakdown once */
+void startup_report (StartupTrace *trace);
+
+#endif
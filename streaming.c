@@ -0,0 +1,93 @@
+#include <gst/gst.h>
+
+#include "streaming.h"
+#include "player.h"
+
+static gchar *cache_template = NULL;
+
+
+gboolean streaming_uri_is_network (const gchar *uri) {
+  gchar *protocol = gst_uri_get_protocol (uri);
+  gboolean network = protocol != NULL && g_strcmp0 (protocol, "file") != 0;
+
+  g_free (protocol);
+  return network;
+}
+
+/* queue2 lives inside uridecodebin, point its temp file at the cache directory */
+static void deep_element_added_cb (GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data) {
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  if (factory != NULL && g_strcmp0 (GST_OBJECT_NAME (factory), "queue2") == 0)
+    g_object_set (element, "temp-template", cache_template, NULL);
+}
+
+void streaming_setup (CustomData *data, guint cache_mb, const gchar *cache_dir) {
+  g_object_set (data->source, "download", TRUE, "use-buffering", TRUE,
+      "ring-buffer-max-size", (guint64) cache_mb * 1024 * 1024, NULL);
+
+  if (cache_dir != NULL) {
+    g_mkdir_with_parents (cache_dir, 0700);
+    cache_template = g_build_filename (cache_dir, "open-pipe-cache-XXXXXX", NULL);
+    g_signal_connect (data->pipeline, "deep-element-added", G_CALLBACK (deep_element_added_cb), NULL);
+  }
+  data->streaming = TRUE;
+  g_print ("Streaming with a %u MB ring buffer cache\n", cache_mb);
+}
+
+void streaming_handle_buffering (CustomData *data, GstMessage *msg) {
+  gint percent;
+
+  /* Live sources cannot be paused to refill */
+  if (data->is_live)
+    return;
+
+  gst_message_parse_buffering (msg, &percent);
+  data->buffering_percent = percent;
+
+  if (percent < 100) {
+    g_print ("Buffering (%3d%%)\r", percent);
+    if (!data->buffering_paused && data->target_state == GST_STATE_PLAYING) {
+      gst_element_set_state (data->pipeline, GST_STATE_PAUSED);
+      data->buffering_paused = TRUE;
+    }
+  } else {
+    if (data->buffering_paused && data->target_state == GST_STATE_PLAYING)
+      gst_element_set_state (data->pipeline, GST_STATE_PLAYING);
+    data->buffering_paused = FALSE;
+    streaming_report_ranges (data);
+  }
+}
+
+void streaming_report_ranges (CustomData *data) {
+  GstQuery *query;
+  GString *ranges;
+  guint i, n;
+
+  if (!data->streaming)
+    return;
+
+  query = gst_query_new_buffering (GST_FORMAT_PERCENT);
+  if (!gst_element_query (data->pipeline, query)) {
+    gst_query_unref (query);
+    return;
+  }
+
+  ranges = g_string_new (NULL);
+  n = gst_query_get_n_buffering_ranges (query);
+  for (i = 0; i < n; i++) {
+    gint64 start, stop;
+    gst_query_parse_nth_buffering_range (query, i, &start, &stop);
+    g_string_append_printf (ranges, " %" G_GINT64_FORMAT "-%" G_GINT64_FORMAT "%%",
+        start * 100 / GST_FORMAT_PERCENT_MAX, stop * 100 / GST_FORMAT_PERCENT_MAX);
+  }
+  gst_query_unref (query);
+
+  if (g_strcmp0 (ranges->str, data->buffered_ranges) != 0) {
+    g_print ("\nBuffered ranges:%s\n", ranges->len ? ranges->str : " none");
+    g_free (data->buffered_ranges);
+    data->buffered_ranges = g_string_free (ranges, FALSE);
+  } else {
+    g_string_free (ranges, TRUE);
+  }
+}
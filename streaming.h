@@ -0,0 +1,19 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+gboolean streaming_uri_is_network (const gchar *uri);
+
+/* Progressive download into an on-disk ring buffer of cache_mb megabytes,
+ * backward seeks inside the cached range are served without the network */
+void streaming_setup (CustomData *data, guint cache_mb, const gchar *cache_dir);
+
+/* Control thread: pause while the cache refills, resume when it is full */
+void streaming_handle_buffering (CustomData *data, GstMessage *msg);
+/* Control thread: print the buffered ranges when they change */
+void streaming_report_ranges (CustomData *data);
+
+#endif
@@ -0,0 +1,52 @@
+#!/bin/sh
+# A playlist whose last item has no audio must still end: the player has to
+# exit on its own once the video of that item is done.
+#
+#   playlist-eos.sh PLAYER WORK_DIR
+#
+# Exits 77 (skipped) without gst-launch-1.0, the encoders or a display.
+set -eu
+
+PLAYER=$1
+WORK=$2
+TIMEOUT=${PLAYLIST_TIMEOUT:-60}
+
+for element in videotestsrc audiotestsrc vp8enc opusenc matroskamux; do
+    gst-inspect-1.0 --exists "$element" || exit 77
+done
+if [ -z "${DISPLAY:-}${WAYLAND_DISPLAY:-}" ]; then
+    command -v xvfb-run > /dev/null || exit 77
+    RUN="xvfb-run -a"
+else
+    RUN=""
+fi
+
+mkdir -p "$WORK"
+with_audio="$WORK/with-audio.mkv"
+video_only="$WORK/video-only.mkv"
+
+gst-launch-1.0 -q \
+    videotestsrc num-buffers=60 ! video/x-raw,width=320,height=240,framerate=30/1 \
+    ! vp8enc deadline=1 ! queue ! mux. \
+    audiotestsrc num-buffers=94 samplesperbuffer=1024 ! audio/x-raw,rate=48000 \
+    ! opusenc ! queue ! mux. \
+    matroskamux name=mux ! filesink location="$with_audio"
+gst-launch-1.0 -q \
+    videotestsrc num-buffers=60 ! video/x-raw,width=320,height=240,framerate=30/1 \
+    ! vp8enc deadline=1 ! matroskamux ! filesink location="$video_only"
+
+status=0
+# shellcheck disable=SC2086
+timeout "$TIMEOUT" $RUN "$PLAYER" "$with_audio" "$video_only" > "$WORK/player.log" 2>&1 || status=$?
+if [ "$status" -eq 124 ]; then
+    echo "FAIL: the player did not exit within ${TIMEOUT}s after the last item"
+    tail -n 20 "$WORK/player.log"
+    exit 1
+fi
+if [ "$status" -ne 0 ]; then
+    echo "FAIL: the player exited with $status"
+    tail -n 20 "$WORK/player.log"
+    exit 1
+fi
+grep -q "End-Of-Stream reached" "$WORK/player.log" || { echo "FAIL: no EOS"; exit 1; }
+echo "PASS"
@@ -0,0 +1,253 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#include "thumbnails.h"
+
+/* Longest wait for one seek to preroll before the thumbnail is skipped */
+#define PREROLL_TIMEOUT (10 * GST_SECOND)
+
+typedef struct _ThumbnailJob {
+  const ThumbnailConfig *config;
+  atomic_uint failed;
+} ThumbnailJob;
+
+typedef struct _SpriteSheet {
+  GdkPixbuf *pixbuf;
+  guint columns;
+  gint frame_width;
+  gint frame_height;
+  GString *index;               /* JSON entries of the written frames */
+  guint frames;
+} SpriteSheet;
+
+
+/* Only the video stream is decoded, audio and subtitles stop before their decoders */
+static gboolean autoplug_continue_cb (GstElement *bin, GstPad *pad, GstCaps *caps, gpointer user_data) {
+  const gchar *type = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+
+  return !g_str_has_prefix (type, "audio/") && !g_str_has_prefix (type, "text/") &&
+      !g_str_has_prefix (type, "subpicture/") && !g_str_has_prefix (type, "subtitle/");
+}
+
+static void pad_added_cb (GstElement *source, GstPad *pad, GstElement *scale) {
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  GstPad *sinkpad = gst_element_get_static_pad (scale, "sink");
+
+  if (caps != NULL && g_str_has_prefix (gst_structure_get_name (gst_caps_get_structure (caps, 0)), "video/x-raw") &&
+      !gst_pad_is_linked (sinkpad))
+    gst_pad_link (pad, sinkpad);
+  if (caps != NULL)
+    gst_caps_unref (caps);
+  gst_object_unref (sinkpad);
+}
+
+/* uridecodebin -> videoscale -> videoconvert -> appsink, downscaled before conversion
+ * so the converter only touches thumbnail sized frames */
+static GstElement *build_pipeline (const gchar *uri, gint width, GstElement **appsink) {
+  GstElement *pipeline, *source, *scale, *scale_filter, *convert;
+  GstCaps *caps;
+
+  pipeline = gst_pipeline_new (NULL);
+  source = gst_element_factory_make ("uridecodebin", NULL);
+  scale = gst_element_factory_make ("videoscale", NULL);
+  scale_filter = gst_element_factory_make ("capsfilter", NULL);
+  convert = gst_element_factory_make ("videoconvert", NULL);
+  *appsink = gst_element_factory_make ("appsink", NULL);
+  if (!pipeline || !source || !scale || !scale_filter || !convert || !*appsink) {
+    g_printerr ("Not all elements could be created.\n");
+    return NULL;
+  }
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT, width,
+      "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1, NULL);
+  g_object_set (scale_filter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+  caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING, "RGB", NULL);
+  g_object_set (*appsink, "caps", caps, "sync", FALSE, "max-buffers", 1, NULL);
+  gst_caps_unref (caps);
+  g_object_set (source, "uri", uri, "expose-all-streams", FALSE, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), source, scale, scale_filter, convert, *appsink, NULL);
+  if (!gst_element_link_many (scale, scale_filter, convert, *appsink, NULL)) {
+    g_printerr ("Thumbnail elements could not be linked.\n");
+    gst_object_unref (pipeline);
+    return NULL;
+  }
+  g_signal_connect (source, "autoplug-continue", G_CALLBACK (autoplug_continue_cb), NULL);
+  g_signal_connect (source, "pad-added", G_CALLBACK (pad_added_cb), scale);
+  return pipeline;
+}
+
+static gboolean wait_preroll (GstElement *pipeline) {
+  return gst_element_get_state (pipeline, NULL, NULL, PREROLL_TIMEOUT) == GST_STATE_CHANGE_SUCCESS;
+}
+
+static void add_frame (SpriteSheet *sheet, GstSample *sample, guint slot, const ThumbnailConfig *config) {
+  GstBuffer *buffer = gst_sample_get_buffer (sample);
+  GstVideoInfo info;
+  GstMapInfo map;
+  GdkPixbuf *frame;
+  GstClockTime time;
+  gint x, y;
+
+  if (!gst_video_info_from_caps (&info, gst_sample_get_caps (sample)) || !gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return;
+
+  /* The first frame decides the cell size, the scaler keeps it for the whole file */
+  if (sheet->pixbuf == NULL) {
+    sheet->frame_width = GST_VIDEO_INFO_WIDTH (&info);
+    sheet->frame_height = GST_VIDEO_INFO_HEIGHT (&info);
+    sheet->pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, sheet->frame_width * sheet->columns,
+        sheet->frame_height * ((config->count + sheet->columns - 1) / sheet->columns));
+    gdk_pixbuf_fill (sheet->pixbuf, 0);
+  }
+
+  x = (slot % sheet->columns) * sheet->frame_width;
+  y = (slot / sheet->columns) * sheet->frame_height;
+  frame = gdk_pixbuf_new_from_data (map.data, GDK_COLORSPACE_RGB, FALSE, 8,
+      MIN (GST_VIDEO_INFO_WIDTH (&info), sheet->frame_width), MIN (GST_VIDEO_INFO_HEIGHT (&info), sheet->frame_height),
+      GST_VIDEO_INFO_PLANE_STRIDE (&info, 0), NULL, NULL);
+  gdk_pixbuf_copy_area (frame, 0, 0, gdk_pixbuf_get_width (frame), gdk_pixbuf_get_height (frame), sheet->pixbuf, x, y);
+  g_object_unref (frame);
+  gst_buffer_unmap (buffer, &map);
+
+  /* Timestamp of the frame actually shown, not of the requested position, in stream time
+   * so it matches the seek positions of a player even when the file does not start at 0 */
+  time = gst_segment_to_stream_time (gst_sample_get_segment (sample), GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+  g_string_append_printf (sheet->index, "%s{\"time_ms\":%" G_GUINT64_FORMAT ",\"x\":%d,\"y\":%d}",
+      sheet->frames > 0 ? "," : "", GST_CLOCK_TIME_IS_VALID (time) ? time / GST_MSECOND : 0, x, y);
+  sheet->frames++;
+}
+
+static gboolean write_sheet (SpriteSheet *sheet, const gchar *uri, const ThumbnailConfig *config) {
+  gchar *filename = g_filename_from_uri (uri, NULL, NULL);
+  gchar *base = g_path_get_basename (filename ? filename : uri);
+  gchar *dot = strrchr (base, '.');
+  gchar *hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, uri, -1);
+  gchar *name, *png, *json, *escaped_uri, *contents;
+  GError *error = NULL;
+  gboolean ok;
+
+  /* Same named files of different directories must not share a sheet, nor race
+   * each other from two workers, so a short hash of the full uri is appended */
+  if (dot != NULL && dot != base)
+    *dot = '\0';
+  name = g_strdup_printf ("%s-%.8s", base, hash);
+  png = g_strdup_printf ("%s/%s.sprite.png", config->output_dir, name);
+  json = g_strdup_printf ("%s/%s.sprite.json", config->output_dir, name);
+
+  ok = gdk_pixbuf_save (sheet->pixbuf, png, "png", &error, NULL);
+  if (ok) {
+    escaped_uri = g_strescape (uri, NULL);
+    contents = g_strdup_printf ("{\"uri\":\"%s\",\"sprite\":\"%s.sprite.png\",\"width\":%d,\"height\":%d,"
+        "\"columns\":%u,\"frames\":[%s]}\n", escaped_uri, name, sheet->frame_width, sheet->frame_height,
+        sheet->columns, sheet->index->str);
+    ok = g_file_set_contents (json, contents, -1, &error);
+    g_free (contents);
+    g_free (escaped_uri);
+  }
+  if (!ok) {
+    g_printerr ("Could not write thumbnails of %s: %s\n", uri, error->message);
+    g_clear_error (&error);
+  } else {
+    g_print ("%s: %u thumbnails in %s\n", uri, sheet->frames, png);
+  }
+
+  g_free (png);
+  g_free (json);
+  g_free (name);
+  g_free (hash);
+  g_free (base);
+  g_free (filename);
+  return ok;
+}
+
+static gboolean extract (const gchar *uri, const ThumbnailConfig *config) {
+  SpriteSheet sheet = { 0 };
+  GstElement *pipeline, *appsink;
+  gint64 duration = -1;
+  gboolean ok = FALSE;
+  guint i;
+
+  pipeline = build_pipeline (uri, config->width, &appsink);
+  if (pipeline == NULL)
+    return FALSE;
+
+  sheet.columns = (guint) ceil (sqrt (config->count));
+  sheet.index = g_string_new (NULL);
+
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  if (!wait_preroll (pipeline)) {
+    g_printerr ("%s could not be prerolled.\n", uri);
+    goto done;
+  }
+  gst_element_query_duration (pipeline, GST_FORMAT_TIME, &duration);
+
+  for (i = 0; i < config->count; i++) {
+    GstSample *sample;
+
+    /* Land on the keyframe nearest to each slot and decode only that frame */
+    if (duration > 0) {
+      gint64 target = gst_util_uint64_scale (duration, 2 * i + 1, 2 * config->count);
+      if (!gst_element_seek_simple (pipeline, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT |
+          GST_SEEK_FLAG_SNAP_NEAREST | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS, target) || !wait_preroll (pipeline))
+        continue;
+    } else if (i > 0) {
+      /* Unknown duration, nothing to spread the thumbnails over */
+      break;
+    }
+
+    sample = gst_app_sink_try_pull_preroll (GST_APP_SINK (appsink), PREROLL_TIMEOUT);
+    if (sample == NULL)
+      continue;
+    add_frame (&sheet, sample, i, config);
+    gst_sample_unref (sample);
+  }
+
+  if (sheet.frames == 0)
+    g_printerr ("No thumbnail could be decoded from %s.\n", uri);
+  else
+    ok = write_sheet (&sheet, uri, config);
+
+done:
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+  if (sheet.pixbuf != NULL)
+    g_object_unref (sheet.pixbuf);
+  g_string_free (sheet.index, TRUE);
+  return ok;
+}
+
+static void worker_cb (gchar *uri, ThumbnailJob *job) {
+  if (!extract (uri, job->config))
+    atomic_fetch_add (&job->failed, 1);
+}
+
+int thumbnails_run (gchar **uris, guint n_uris, const ThumbnailConfig *config) {
+  ThumbnailJob job = { config };
+  GThreadPool *pool;
+  GError *error = NULL;
+  guint i;
+
+  g_mkdir_with_parents (config->output_dir, 0755);
+
+  /* One pipeline per worker, every file gets its own decoding threads */
+  pool = g_thread_pool_new ((GFunc) worker_cb, &job, MAX (config->jobs, 1), TRUE, &error);
+  if (pool == NULL) {
+    g_printerr ("%s\n", error->message);
+    g_clear_error (&error);
+    return 1;
+  }
+  for (i = 0; i < n_uris; i++)
+    g_thread_pool_push (pool, uris[i], NULL);
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  return atomic_load (&job.failed) > 0 ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+#ifndef THUMBNAILS_H
+#define THUMBNAILS_H
+
+#include <gst/gst.h>
+
+typedef struct _ThumbnailConfig {
+  guint count;                  /* thumbnails per file, evenly spaced */
+  gint width;                   /* thumbnail width, height keeps the aspect ratio */
+  guint jobs;                   /* files processed at once */
+  const gchar *output_dir;
+} ThumbnailConfig;
+
+/* Write NAME.sprite.png and NAME.sprite.json for every URI, returns the process exit code */
+int thumbnails_run (gchar **uris, guint n_uris, const ThumbnailConfig *config);
+
+#endif
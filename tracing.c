@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+#include <gst/gst.h>
+
+#include "tracing.h"
+#include "player.h"
+
+/* Deeper push chains are cut, they do not happen in this player */
+#define MAX_DEPTH 64
+
+/* Never registered in the registry, only created by tracing_start() */
+typedef struct _PlayerTracer {
+  GstTracer parent;
+} PlayerTracer;
+
+typedef struct _PlayerTracerClass {
+  GstTracerClass parent_class;
+} PlayerTracerClass;
+
+static GType player_tracer_get_type (void);
+G_DEFINE_TYPE (PlayerTracer, player_tracer, GST_TYPE_TRACER);
+
+typedef struct _Frame {
+  const gchar *name;
+  GstClockTime start;
+  GstClockTime children;
+} Frame;
+
+/* Pushes nest on the thread running them */
+typedef struct _ThreadState {
+  guint32 tid;
+  guint depth;
+  Frame frames[MAX_DEPTH];
+} ThreadState;
+
+static _Thread_local ThreadState thread_state;
+static Tracing *_Atomic active = NULL;
+static GQuark name_quark;
+
+
+static void player_tracer_class_init (PlayerTracerClass *klass) {
+}
+
+static void player_tracer_init (PlayerTracer *tracer) {
+}
+
+/* Interned once per element, the element may be gone when the trace is written */
+static const gchar *element_name (GstObject *object) {
+  const gchar *name;
+
+  /* Internal pads of ghost pads belong to the ghost pad */
+  if (object != NULL && GST_IS_PAD (object))
+    object = GST_OBJECT_PARENT (object);
+  if (object == NULL)
+    return "unlinked";
+
+  name = g_object_get_qdata (G_OBJECT (object), name_quark);
+  if (name == NULL) {
+    gchar *full = GST_IS_PAD (object) ? gst_object_get_path_string (object) : gst_object_get_name (object);
+    name = g_intern_string (full);
+    g_free (full);
+    g_object_set_qdata (G_OBJECT (object), name_quark, (gpointer) name);
+  }
+  return name;
+}
+
+static guint32 thread_id (Tracing *tracing) {
+  char name[16] = "";
+
+  if (thread_state.tid != 0)
+    return thread_state.tid;
+  thread_state.tid = (guint32) syscall (SYS_gettid);
+  prctl (PR_GET_NAME, name);
+  g_mutex_lock (&tracing->threads_lock);
+  g_hash_table_insert (tracing->thread_names, GUINT_TO_POINTER (thread_state.tid), g_strdup (name));
+  g_mutex_unlock (&tracing->threads_lock);
+  return thread_state.tid;
+}
+
+/* Lock-free, the oldest events are overwritten */
+static void record (Tracing *tracing, TracingKind kind, const gchar *name, GstClockTime start,
+    GstClockTime duration, GstClockTime self, GstClockTime pts) {
+  guint64 index = atomic_fetch_add (&tracing->head, 1);
+  TracingEvent *event = &tracing->events[index & (tracing->capacity - 1)];
+
+  atomic_store_explicit (&event->seq, 0, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+  event->kind = kind;
+  event->name = name;
+  event->tid = thread_id (tracing);
+  event->start = start;
+  event->duration = duration;
+  event->self = self;
+  event->pts = pts;
+  atomic_store_explicit (&event->seq, index + 1, memory_order_release);
+}
+
+static void branch_enter (TracingBranch *branch, GstClockTime ts, GstBuffer *buffer) {
+  guint64 index = atomic_fetch_add (&branch->entered, 1) % TRACING_BRANCH_RING;
+
+  branch->entry_pts[index] = GST_BUFFER_PTS (buffer);
+  branch->entry_time[index] = ts;
+}
+
+/* Leaky queues drop buffers, skip entries until the PTS matches */
+static void branch_exit (Tracing *tracing, TracingBranch *branch, GstClockTime ts, GstBuffer *buffer) {
+  guint64 entered = atomic_load (&branch->entered);
+  guint64 index;
+
+  if (entered - branch->exited > TRACING_BRANCH_RING)
+    branch->exited = entered - TRACING_BRANCH_RING;
+  for (; branch->exited < entered; branch->exited++) {
+    index = branch->exited % TRACING_BRANCH_RING;
+    if (branch->entry_pts[index] == GST_BUFFER_PTS (buffer)) {
+      record (tracing, TRACING_BUFFER, branch->name, branch->entry_time[index], ts - branch->entry_time[index],
+          0, GST_BUFFER_PTS (buffer));
+      branch->exited++;
+      return;
+    }
+  }
+}
+
+static void follow_buffer (Tracing *tracing, GstPad *peer, GstClockTime ts, GstBuffer *buffer) {
+  guint i;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return;
+  for (i = 0; i < G_N_ELEMENTS (tracing->branches); i++) {
+    if (peer == tracing->branches[i].entry)
+      branch_enter (&tracing->branches[i], ts, buffer);
+    else if (peer == tracing->branches[i].exit)
+      branch_exit (tracing, &tracing->branches[i], ts, buffer);
+  }
+}
+
+/* The pushed-to or pulled-from element runs inside the call */
+static void slice_begin (GstPad *pad, GstClockTime ts) {
+  GstPad *peer = GST_PAD_PEER (pad);
+  Frame *frame;
+
+  if (thread_state.depth < MAX_DEPTH) {
+    frame = &thread_state.frames[thread_state.depth];
+    frame->name = element_name (peer != NULL ? GST_OBJECT_PARENT (peer) : NULL);
+    frame->start = ts;
+    frame->children = 0;
+  }
+  thread_state.depth++;
+}
+
+static void slice_end (Tracing *tracing, GstClockTime ts) {
+  Frame *frame;
+  GstClockTime duration;
+
+  if (thread_state.depth == 0)
+    return;
+  thread_state.depth--;
+  if (thread_state.depth >= MAX_DEPTH)
+    return;
+
+  frame = &thread_state.frames[thread_state.depth];
+  duration = ts - frame->start;
+  record (tracing, TRACING_SLICE, frame->name, frame->start, duration, duration - MIN (frame->children, duration), 0);
+  if (thread_state.depth > 0 && thread_state.depth - 1 < MAX_DEPTH)
+    thread_state.frames[thread_state.depth - 1].children += duration;
+}
+
+static void push_pre_cb (GObject *tracer, GstClockTime ts, GstPad *pad, GstBuffer *buffer) {
+  Tracing *tracing = atomic_load (&active);
+
+  if (tracing == NULL)
+    return;
+  follow_buffer (tracing, GST_PAD_PEER (pad), ts, buffer);
+  slice_begin (pad, ts);
+}
+
+static void push_list_pre_cb (GObject *tracer, GstClockTime ts, GstPad *pad, GstBufferList *list) {
+  Tracing *tracing = atomic_load (&active);
+  guint i;
+
+  if (tracing == NULL)
+    return;
+  for (i = 0; i < gst_buffer_list_length (list); i++)
+    follow_buffer (tracing, GST_PAD_PEER (pad), ts, gst_buffer_list_get (list, i));
+  slice_begin (pad, ts);
+}
+
+static void pull_range_pre_cb (GObject *tracer, GstClockTime ts, GstPad *pad, guint64 offset, guint size) {
+  if (atomic_load (&active) != NULL)
+    slice_begin (pad, ts);
+}
+
+static void push_post_cb (GObject *tracer, GstClockTime ts, GstPad *pad, GstFlowReturn res) {
+  Tracing *tracing = atomic_load (&active);
+
+  if (tracing != NULL)
+    slice_end (tracing, ts);
+}
+
+static void pull_range_post_cb (GObject *tracer, GstClockTime ts, GstPad *pad, GstBuffer *buffer, GstFlowReturn res) {
+  Tracing *tracing = atomic_load (&active);
+
+  if (tracing != NULL)
+    slice_end (tracing, ts);
+}
+
+Tracing *tracing_start (guint capacity, const gchar *path) {
+  Tracing *tracing = g_new0 (Tracing, 1);
+  GstTracer *tracer;
+
+  tracing->path = g_strdup (path);
+  tracing->capacity = 1;
+  while (tracing->capacity < MAX (capacity, 1024))
+    tracing->capacity <<= 1;
+  tracing->events = g_new0 (TracingEvent, tracing->capacity);
+  tracing->branches[0].name = "video";
+  tracing->branches[1].name = "audio";
+  g_mutex_init (&tracing->threads_lock);
+  tracing->thread_names = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  name_quark = g_quark_from_static_string ("open-pipe-trace-name");
+
+  tracer = g_object_new (player_tracer_get_type (), NULL);
+  tracing->tracer = gst_object_ref_sink (tracer);
+  gst_tracing_register_hook (tracer, "pad-push-pre", G_CALLBACK (push_pre_cb));
+  gst_tracing_register_hook (tracer, "pad-push-post", G_CALLBACK (push_post_cb));
+  gst_tracing_register_hook (tracer, "pad-push-list-pre", G_CALLBACK (push_list_pre_cb));
+  gst_tracing_register_hook (tracer, "pad-push-list-post", G_CALLBACK (push_post_cb));
+  gst_tracing_register_hook (tracer, "pad-pull-range-pre", G_CALLBACK (pull_range_pre_cb));
+  gst_tracing_register_hook (tracer, "pad-pull-range-post", G_CALLBACK (pull_range_post_cb));
+  atomic_store (&active, tracing);
+  g_print ("Tracing %" G_GUINT64_FORMAT " events into %s\n", tracing->capacity, path);
+  return tracing;
+}
+
+void tracing_free (Tracing *tracing) {
+  if (tracing == NULL)
+    return;
+
+  /* The hooks stay registered for the tracer's lifetime, they only check this */
+  atomic_store (&active, NULL);
+  g_free (tracing->path);
+  g_free (tracing->events);
+  g_mutex_clear (&tracing->threads_lock);
+  g_hash_table_unref (tracing->thread_names);
+  g_free (tracing);
+}
+
+static void attach_branch (TracingBranch *branch, GstElement *queue, GstElement *sink) {
+  /* Compared by address from the hooks, the pipeline keeps them alive */
+  branch->entry = gst_element_get_static_pad (queue, "sink");
+  branch->exit = gst_element_get_static_pad (sink, "sink");
+  gst_object_unref (branch->entry);
+  gst_object_unref (branch->exit);
+}
+
+void tracing_attach (Tracing *tracing, CustomData *data) {
+  if (tracing == NULL)
+    return;
+  attach_branch (&tracing->branches[0], data->video_queue, data->videosink);
+  attach_branch (&tracing->branches[1], data->audio_queue, data->asink);
+}
+
+/* Chrome wants microseconds, printed without going through the locale */
+static void print_us (FILE *file, const gchar *key, GstClockTime ns) {
+  fprintf (file, ",\"%s\":%" G_GUINT64_FORMAT ".%03u", key, ns / 1000, (guint) (ns % 1000));
+}
+
+static void write_event (FILE *file, const TracingEvent *event, guint64 id, gboolean *first) {
+  gchar *name = g_strescape (event->name, NULL);
+
+  if (event->kind == TRACING_SLICE) {
+    fprintf (file, "%s\n{\"name\":\"%s\",\"cat\":\"element\",\"ph\":\"X\",\"pid\":1,\"tid\":%u",
+        *first ? "" : ",", name, event->tid);
+    print_us (file, "ts", event->start);
+    print_us (file, "dur", event->duration);
+    fprintf (file, ",\"args\":{\"self_us\":%" G_GUINT64_FORMAT "}}", event->self / 1000);
+  } else {
+    /* One async track per branch, each buffer a begin/end pair */
+    fprintf (file, "%s\n{\"name\":\"%s\",\"cat\":\"buffer\",\"ph\":\"b\",\"id\":%" G_GUINT64_FORMAT ",\"pid\":1,\"tid\":%u",
+        *first ? "" : ",", name, id, event->tid);
+    print_us (file, "ts", event->start);
+    fprintf (file, ",\"args\":{\"pts_ms\":%" G_GUINT64_FORMAT ",\"latency_us\":%" G_GUINT64_FORMAT "}}",
+        event->pts / GST_MSECOND, event->duration / 1000);
+    fprintf (file, ",\n{\"name\":\"%s\",\"cat\":\"buffer\",\"ph\":\"e\",\"id\":%" G_GUINT64_FORMAT ",\"pid\":1,\"tid\":%u",
+        name, id, event->tid);
+    print_us (file, "ts", event->start + event->duration);
+    fprintf (file, "}");
+  }
+  *first = FALSE;
+  g_free (name);
+}
+
+gboolean tracing_dump (Tracing *tracing) {
+  guint64 head, index;
+  gboolean first = TRUE;
+  GHashTableIter iter;
+  gpointer tid, thread_name;
+  guint64 written = 0;
+  FILE *file;
+
+  if (tracing == NULL)
+    return FALSE;
+
+  file = fopen (tracing->path, "w");
+  if (file == NULL) {
+    g_printerr ("Could not write the trace to %s.\n", tracing->path);
+    return FALSE;
+  }
+
+  fprintf (file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  g_mutex_lock (&tracing->threads_lock);
+  g_hash_table_iter_init (&iter, tracing->thread_names);
+  while (g_hash_table_iter_next (&iter, &tid, &thread_name)) {
+    gchar *escaped = g_strescape (thread_name, NULL);
+    fprintf (file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+        first ? "" : ",", GPOINTER_TO_UINT (tid), escaped);
+    first = FALSE;
+    g_free (escaped);
+  }
+  g_mutex_unlock (&tracing->threads_lock);
+
+  /* Slots rewritten while we read are skipped, everything else is consistent */
+  head = atomic_load (&tracing->head);
+  for (index = head > tracing->capacity ? head - tracing->capacity : 0; index < head; index++) {
+    TracingEvent *slot = &tracing->events[index & (tracing->capacity - 1)];
+    TracingEvent event;
+
+    if (atomic_load_explicit (&slot->seq, memory_order_acquire) != index + 1)
+      continue;
+    event.kind = slot->kind;
+    event.name = slot->name;
+    event.tid = slot->tid;
+    event.start = slot->start;
+    event.duration = slot->duration;
+    event.self = slot->self;
+    event.pts = slot->pts;
+    atomic_thread_fence (memory_order_acquire);
+    if (atomic_load_explicit (&slot->seq, memory_order_acquire) != index + 1)
+      continue;
+    write_event (file, &event, index, &first);
+    written++;
+  }
+  fprintf (file, "\n]}\n");
+  fclose (file);
+
+  g_print ("\nWrote %" G_GUINT64_FORMAT " trace events to %s (%" G_GUINT64_FORMAT " recorded)\n",
+      written, tracing->path, head);
+  return TRUE;
+}
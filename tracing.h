@@ -0,0 +1,60 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <stdatomic.h>
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+typedef enum {
+  TRACING_SLICE,                /* time spent in an element's chain or getrange */
+  TRACING_BUFFER                /* one buffer from its branch queue to its sink */
+} TracingKind;
+
+typedef struct _TracingEvent {
+  atomic_uint_fast64_t seq;     /* event index + 1 once the slot is written */
+  TracingKind kind;
+  const gchar *name;            /* interned element or branch name */
+  guint32 tid;
+  GstClockTime start;
+  GstClockTime duration;
+  GstClockTime self;            /* slices: without the elements it pushed into */
+  GstClockTime pts;             /* buffers */
+} TracingEvent;
+
+/* Buffers entered a branch, in queue order, matched by PTS at the sink */
+#define TRACING_BRANCH_RING 1024
+
+typedef struct _TracingBranch {
+  const gchar *name;
+  GstPad *entry;                /* queue sink pad */
+  GstPad *exit;                 /* sink pad */
+  atomic_uint_fast64_t entered;
+  GstClockTime entry_pts[TRACING_BRANCH_RING];
+  GstClockTime entry_time[TRACING_BRANCH_RING];
+  guint64 exited;               /* sink streaming thread only */
+} TracingBranch;
+
+typedef struct _Tracing {
+  gchar *path;
+  TracingEvent *events;
+  guint64 capacity;             /* power of two */
+  atomic_uint_fast64_t head;
+  TracingBranch branches[2];
+  GMutex threads_lock;
+  GHashTable *thread_names;     /* tid -> name */
+  GstObject *tracer;
+} Tracing;
+
+/* Install the pad push and pull hooks, the pipeline must not be running yet.
+ * Without it GStreamer skips the hooks entirely */
+Tracing *tracing_start (guint capacity, const gchar *path);
+/* Stop recording, call once no pipeline runs anymore */
+void tracing_free (Tracing *tracing);
+
+/* Follow buffers through the audio and video branches of the built pipeline */
+void tracing_attach (Tracing *tracing, CustomData *data);
+/* Write the ring as Chrome trace JSON, any thread, recording goes on */
+gboolean tracing_dump (Tracing *tracing);
+
+#endif
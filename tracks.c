@@ -0,0 +1,119 @@
+#include <gst/gst.h>
+
+#include "tracks.h"
+#include "player.h"
+
+
+Tracks *tracks_new (gint audio_track) {
+  Tracks *tracks = g_new0 (Tracks, 1);
+
+  tracks->audio_track = audio_track;
+  return tracks;
+}
+
+void tracks_free (Tracks *tracks) {
+  if (tracks == NULL)
+    return;
+  if (tracks->collection != NULL)
+    gst_object_unref (tracks->collection);
+  g_free (tracks);
+}
+
+static void print_stream (guint index, GstStream *stream) {
+  GstTagList *tags = gst_stream_get_tags (stream);
+  GstCaps *caps = gst_stream_get_caps (stream);
+  gchar *language = NULL, *codec = NULL;
+
+  if (tags != NULL) {
+    gst_tag_list_get_string (tags, GST_TAG_LANGUAGE_CODE, &language);
+    if (!gst_tag_list_get_string (tags, GST_TAG_AUDIO_CODEC, &codec))
+      gst_tag_list_get_string (tags, GST_TAG_VIDEO_CODEC, &codec);
+  }
+  if (codec == NULL && caps != NULL && !gst_caps_is_empty (caps))
+    codec = g_strdup (gst_structure_get_name (gst_caps_get_structure (caps, 0)));
+
+  g_print ("  Track %u: %s %s%s%s\n", index, gst_stream_type_get_name (gst_stream_get_stream_type (stream)),
+      codec ? codec : "unknown", language ? ", " : "", language ? language : "");
+
+  g_free (language);
+  g_free (codec);
+  if (tags != NULL)
+    gst_tag_list_unref (tags);
+  if (caps != NULL)
+    gst_caps_unref (caps);
+}
+
+/* First video stream and the chosen audio stream. Subtitles have no branch to go to,
+ * leaving them out keeps their parsers and decoders from running at all */
+static void select_streams (Tracks *tracks, CustomData *data) {
+  GList *ids = NULL;
+  gboolean have_video = FALSE;
+  guint i, n, audio = 0;
+
+  n = gst_stream_collection_get_size (tracks->collection);
+  for (i = 0; i < n; i++) {
+    GstStream *stream = gst_stream_collection_get_stream (tracks->collection, i);
+    GstStreamType type = gst_stream_get_stream_type (stream);
+
+    if ((type & GST_STREAM_TYPE_VIDEO) && !have_video) {
+      ids = g_list_append (ids, (gchar *) gst_stream_get_stream_id (stream));
+      have_video = TRUE;
+    } else if (type & GST_STREAM_TYPE_AUDIO) {
+      if ((gint) audio == tracks->audio_track)
+        ids = g_list_append (ids, (gchar *) gst_stream_get_stream_id (stream));
+      audio++;
+    }
+  }
+
+  if (ids != NULL)
+    gst_element_send_event (data->source, gst_event_new_select_streams (ids));
+  g_list_free (ids);
+}
+
+void tracks_handle_collection (Tracks *tracks, CustomData *data, GstMessage *msg) {
+  GstStreamCollection *collection = NULL;
+  guint i, n;
+
+  gst_message_parse_stream_collection (msg, &collection);
+  if (collection == NULL)
+    return;
+  if (tracks->collection != NULL)
+    gst_object_unref (tracks->collection);
+  tracks->collection = collection;
+
+  n = gst_stream_collection_get_size (collection);
+  tracks->n_audio = 0;
+  g_print ("%u tracks:\n", n);
+  for (i = 0; i < n; i++) {
+    GstStream *stream = gst_stream_collection_get_stream (collection, i);
+    print_stream (i, stream);
+    if (gst_stream_get_stream_type (stream) & GST_STREAM_TYPE_AUDIO)
+      tracks->n_audio++;
+  }
+  if (tracks->audio_track >= (gint) tracks->n_audio)
+    tracks->audio_track = tracks->n_audio > 0 ? 0 : -1;
+
+  select_streams (tracks, data);
+}
+
+void tracks_handle_selected (GstMessage *msg) {
+  guint i, n = gst_message_streams_selected_get_size (msg);
+
+  g_print ("Decoding:");
+  for (i = 0; i < n; i++) {
+    GstStream *stream = gst_message_streams_selected_get_stream (msg, i);
+    g_print (" %s", gst_stream_get_stream_id (stream));
+    gst_object_unref (stream);
+  }
+  g_print ("\n");
+}
+
+void tracks_next_audio (Tracks *tracks, CustomData *data) {
+  if (tracks == NULL || tracks->collection == NULL || tracks->n_audio < 2)
+    return;
+
+  /* decodebin3 keeps the audio pad and swaps the stream behind it, nothing is relinked */
+  tracks->audio_track = (tracks->audio_track + 1) % tracks->n_audio;
+  g_print ("Switching to audio track %d\n", tracks->audio_track);
+  select_streams (tracks, data);
+}
@@ -0,0 +1,25 @@
+#ifndef TRACKS_H
+#define TRACKS_H
+
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+/* Stream selection on uridecodebin3, only the selected tracks get a decoder */
+typedef struct _Tracks {
+  GstStreamCollection *collection;  /* control thread only */
+  gint audio_track;             /* index among the audio streams, -1 for no audio */
+  guint n_audio;
+} Tracks;
+
+Tracks *tracks_new (gint audio_track);
+void tracks_free (Tracks *tracks);
+
+/* Control thread: a new collection was posted, list it and select the wanted tracks */
+void tracks_handle_collection (Tracks *tracks, CustomData *data, GstMessage *msg);
+/* Control thread: print what decodebin3 actually selected */
+void tracks_handle_selected (GstMessage *msg);
+/* Control thread: switch to the next audio track without touching the rest of the pipeline */
+void tracks_next_audio (Tracks *tracks, CustomData *data);
+
+#endif
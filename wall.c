@@ -0,0 +1,350 @@
+#include <math.h>
+
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+
+#include "wall.h"
+#include "player.h"
+#include "pipeline.h"
+
+/* At most one drop line per tile this often */
+#define DROP_REPORT_INTERVAL_US G_USEC_PER_SEC
+
+typedef struct _TileLink {
+  Wall *wall;
+  WallTile *tile;
+} TileLink;
+
+
+static GstPadProbeReturn count_decoded_cb (GstPad *pad, GstPadProbeInfo *info, WallTile *tile) {
+  atomic_fetch_add (&tile->decoded, 1);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Last element of a chain gets a ghost pad on the tile bin */
+static GstPad *add_ghost (WallTile *tile, GstElement *last, const gchar *name) {
+  GstPad *target = gst_element_get_static_pad (last, "src");
+  GstPad *ghost = gst_ghost_pad_new (name, target);
+
+  gst_object_unref (target);
+  gst_pad_set_active (ghost, TRUE);
+  gst_element_add_pad (tile->bin, ghost);
+  return ghost;
+}
+
+static void link_to_mixer (Wall *wall, WallTile *tile, GstPad *ghost, GstElement *mixer, GstPad **mixer_pad) {
+  *mixer_pad = gst_element_request_pad_simple (mixer, "sink_%u");
+  if (mixer == wall->compositor) {
+    g_object_set (*mixer_pad, "xpos", (gint) (tile->index % wall->columns) * wall->tile_width,
+        "ypos", (gint) (tile->index / wall->columns) * wall->tile_height, NULL);
+  } else {
+    gint audio_tile = atomic_load (&wall->audio_tile);
+    g_object_set (*mixer_pad, "mute", audio_tile != WALL_AUDIO_MIX && audio_tile != (gint) tile->index, NULL);
+  }
+  if (GST_PAD_LINK_FAILED (gst_pad_link (ghost, *mixer_pad)))
+    g_printerr ("Tile %u could not be linked to %s.\n", tile->index, GST_ELEMENT_NAME (mixer));
+}
+
+static void tile_pad_added_cb (GstElement *source, GstPad *new_pad, TileLink *link) {
+  WallTile *tile = link->tile;
+  GstCaps *caps = gst_pad_get_current_caps (new_pad);
+  const gchar *type;
+  GstElement *queue = NULL;
+  GstPad *sinkpad, *ghost;
+
+  if (caps == NULL)
+    return;
+  type = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+  if (g_str_has_prefix (type, "video/x-raw") && tile->mixer_pad == NULL)
+    queue = tile->video_queue;
+  else if (g_str_has_prefix (type, "audio/x-raw") && tile->amixer_pad == NULL)
+    queue = tile->audio_queue;
+  gst_caps_unref (caps);
+  if (queue == NULL)
+    return;
+
+  sinkpad = gst_element_get_static_pad (queue, "sink");
+  if (GST_PAD_LINK_FAILED (gst_pad_link (new_pad, sinkpad))) {
+    g_printerr ("Tile %u: type '%s' but link failed.\n", tile->index, type);
+    gst_object_unref (sinkpad);
+    return;
+  }
+  gst_object_unref (sinkpad);
+
+  /* Mixer pads are only requested for streams that exist, the aggregators would wait on empty ones */
+  if (queue == tile->video_queue) {
+    ghost = gst_element_get_static_pad (tile->bin, "video");
+    link_to_mixer (link->wall, tile, ghost, link->wall->compositor, &tile->mixer_pad);
+  } else {
+    ghost = gst_element_get_static_pad (tile->bin, "audio");
+    link_to_mixer (link->wall, tile, ghost, link->wall->amixer, &tile->amixer_pad);
+  }
+  gst_object_unref (ghost);
+}
+
+/* A mixer nobody feeds never produces anything, end its branch so the sink can preroll */
+static void end_unfed_branch (GstElement *mixer) {
+  GstPad *srcpad, *peer;
+
+  if (mixer->numsinkpads > 0)
+    return;
+  srcpad = gst_element_get_static_pad (mixer, "src");
+  peer = gst_pad_get_peer (srcpad);
+  gst_object_unref (srcpad);
+  if (peer == NULL)
+    return;
+  gst_pad_send_event (peer, gst_event_new_eos ());
+  gst_object_unref (peer);
+}
+
+static void tile_no_more_pads_cb (GstElement *source, TileLink *link) {
+  if (atomic_fetch_sub (&link->wall->pending_tiles, 1) != 1)
+    return;
+  end_unfed_branch (link->wall->compositor);
+  end_unfed_branch (link->wall->amixer);
+}
+
+static gboolean build_tile (Wall *wall, WallTile *tile, GstBin *pipeline, guint convert_threads) {
+  GstElement *vconvert, *vscale, *vfilter, *aconvert, *resample;
+  GstCaps *caps;
+  GstPad *pad;
+  TileLink *link;
+  gchar *name;
+
+  name = g_strdup_printf ("tile%u", tile->index);
+  tile->bin = gst_bin_new (name);
+  g_free (name);
+  tile->source = gst_element_factory_make ("uridecodebin", NULL);
+  tile->video_queue = gst_element_factory_make ("queue", NULL);
+  vconvert = gst_element_factory_make ("videoconvert", NULL);
+  vscale = gst_element_factory_make ("videoscale", NULL);
+  vfilter = gst_element_factory_make ("capsfilter", NULL);
+  tile->audio_queue = gst_element_factory_make ("queue", NULL);
+  aconvert = gst_element_factory_make ("audioconvert", NULL);
+  resample = gst_element_factory_make ("audioresample", NULL);
+  if (!tile->source || !tile->video_queue || !vconvert || !vscale || !vfilter || !tile->audio_queue || !aconvert || !resample)
+    return FALSE;
+
+  /* Conversion to the blending format and scaling run in the tile's own queue
+   * thread, the compositor thread only blits */
+  pipeline_set_threads (vconvert, convert_threads);
+  pipeline_set_threads (vscale, convert_threads);
+  caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING, "AYUV",
+      "width", G_TYPE_INT, wall->tile_width, "height", G_TYPE_INT, wall->tile_height,
+      "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1, NULL);
+  g_object_set (vfilter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_object_set (tile->source, "uri", tile->uri, NULL);
+
+  gst_bin_add_many (GST_BIN (tile->bin), tile->source, tile->video_queue, vconvert, vscale, vfilter,
+      tile->audio_queue, aconvert, resample, NULL);
+  if (!gst_element_link_many (tile->video_queue, vconvert, vscale, vfilter, NULL) ||
+      !gst_element_link_many (tile->audio_queue, aconvert, resample, NULL))
+    return FALSE;
+  gst_object_unref (add_ghost (tile, vfilter, "video"));
+  gst_object_unref (add_ghost (tile, resample, "audio"));
+  gst_bin_add (pipeline, tile->bin);
+
+  pad = gst_element_get_static_pad (tile->video_queue, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) count_decoded_cb, tile, NULL);
+  gst_object_unref (pad);
+
+  link = g_new0 (TileLink, 1);
+  link->wall = wall;
+  link->tile = tile;
+  g_signal_connect_data (tile->source, "pad-added", G_CALLBACK (tile_pad_added_cb), link, (GClosureNotify) g_free, 0);
+  g_signal_connect (tile->source, "no-more-pads", G_CALLBACK (tile_no_more_pads_cb), link);
+  return TRUE;
+}
+
+Wall *wall_build (CustomData *data, const gchar * const *uris, guint n_uris,
+    gint canvas_width, gint canvas_height, guint convert_threads, gint audio_tile) {
+  Wall *wall = g_new0 (Wall, 1);
+  GstElement *canvas_filter;
+  GstCaps *caps;
+  guint i;
+
+  wall->n_tiles = n_uris;
+  wall->sink = data->videosink;
+  wall->columns = (guint) ceil (sqrt (n_uris));
+  wall->rows = (n_uris + wall->columns - 1) / wall->columns;
+  /* Even sizes keep 4:2:0 output formats happy */
+  wall->tile_width = (canvas_width / wall->columns) & ~1;
+  wall->tile_height = (canvas_height / wall->rows) & ~1;
+  atomic_init (&wall->audio_tile, audio_tile < (gint) n_uris ? audio_tile : WALL_AUDIO_MIX);
+  atomic_init (&wall->pending_tiles, n_uris);
+
+  wall->compositor = gst_element_factory_make ("compositor", "wall-compositor");
+  canvas_filter = gst_element_factory_make ("capsfilter", "wall-canvas");
+  wall->amixer = gst_element_factory_make ("audiomixer", "wall-audiomixer");
+  if (!wall->compositor || !canvas_filter || !wall->amixer) {
+    g_printerr ("Video wall needs compositor and audiomixer.\n");
+    wall_free (wall);
+    return NULL;
+  }
+
+  /* Fixed canvas, tiles that start late do not renegotiate the output size */
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT, wall->tile_width * (gint) wall->columns,
+      "height", G_TYPE_INT, wall->tile_height * (gint) wall->rows, NULL);
+  g_object_set (canvas_filter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+
+  gst_bin_add_many (GST_BIN (data->pipeline), wall->compositor, canvas_filter, wall->amixer, NULL);
+  if (!gst_element_link_many (wall->compositor, canvas_filter, data->video_queue, NULL) ||
+      !gst_element_link (wall->amixer, data->audio_queue)) {
+    g_printerr ("Video wall mixers could not be linked.\n");
+    wall_free (wall);
+    return NULL;
+  }
+
+  wall->tiles = g_new0 (WallTile, n_uris);
+  for (i = 0; i < n_uris; i++) {
+    wall->tiles[i].index = i;
+    wall->tiles[i].uri = uris[i];
+    if (!build_tile (wall, &wall->tiles[i], GST_BIN (data->pipeline), convert_threads)) {
+      g_printerr ("Tile %u could not be created.\n", i);
+      wall_free (wall);
+      return NULL;
+    }
+  }
+
+  g_print ("Video wall: %u tiles in a %ux%u grid of %dx%d\n", n_uris, wall->columns, wall->rows,
+      wall->tile_width, wall->tile_height);
+  return wall;
+}
+
+void wall_free (Wall *wall) {
+  guint i;
+
+  if (wall == NULL)
+    return;
+  for (i = 0; wall->tiles != NULL && i < wall->n_tiles; i++) {
+    if (wall->tiles[i].mixer_pad != NULL)
+      gst_object_unref (wall->tiles[i].mixer_pad);
+    if (wall->tiles[i].amixer_pad != NULL)
+      gst_object_unref (wall->tiles[i].amixer_pad);
+  }
+  g_free (wall->tiles);
+  g_free (wall);
+}
+
+static gboolean is_from (GstObject *src, GstObject *object) {
+  return object != NULL && (src == object || gst_object_has_as_ancestor (src, object));
+}
+
+/* Own drops plus the canvases that never reached the screen */
+static guint64 tile_dropped (Wall *wall, WallTile *tile) {
+  return tile->dropped + (tile->mixer_pad != NULL ? wall->canvas_dropped : 0);
+}
+
+static void report_drops (Wall *wall, WallTile *tile) {
+  gint64 now = g_get_monotonic_time ();
+
+  if (now - tile->last_drop_report >= DROP_REPORT_INTERVAL_US) {
+    tile->last_drop_report = now;
+    g_print ("Tile %u dropping frames (%" G_GUINT64_FORMAT " so far)\n", tile->index, tile_dropped (wall, tile));
+  }
+}
+
+void wall_handle_qos (Wall *wall, GstMessage *msg) {
+  GstObject *src;
+  GstFormat format;
+  guint64 processed, dropped;
+  guint i;
+
+  if (wall == NULL || wall->tiles == NULL)
+    return;
+
+  src = GST_MESSAGE_SRC (msg);
+  gst_message_parse_qos_stats (msg, &format, &processed, &dropped);
+  if (format != GST_FORMAT_BUFFERS || dropped == (guint64) -1)
+    return;
+
+  /* Inside a tile bin or from the mixer pad the tile feeds */
+  for (i = 0; i < wall->n_tiles; i++) {
+    WallTile *tile = &wall->tiles[i];
+
+    if (!is_from (src, GST_OBJECT (tile->bin)) && !is_from (src, GST_OBJECT (tile->mixer_pad)) &&
+        !is_from (src, GST_OBJECT (tile->amixer_pad)))
+      continue;
+    tile->dropped = MAX (tile->dropped, dropped);
+    report_drops (wall, tile);
+    return;
+  }
+
+  /* The compositor output or the sink dropped a whole canvas, every visible tile lost it */
+  if (src == GST_OBJECT (wall->compositor) || is_from (src, GST_OBJECT (wall->sink))) {
+    wall->canvas_dropped = MAX (wall->canvas_dropped, dropped);
+    for (i = 0; i < wall->n_tiles; i++) {
+      if (wall->tiles[i].mixer_pad != NULL)
+        report_drops (wall, &wall->tiles[i]);
+    }
+  }
+}
+
+void wall_select_audio (Wall *wall, gint tile) {
+  guint i;
+
+  if (wall == NULL)
+    return;
+
+  if (tile < 0 || tile >= (gint) wall->n_tiles)
+    tile = WALL_AUDIO_MIX;
+  atomic_store (&wall->audio_tile, tile);
+  for (i = 0; i < wall->n_tiles; i++) {
+    if (wall->tiles[i].amixer_pad != NULL)
+      g_object_set (wall->tiles[i].amixer_pad, "mute", tile != WALL_AUDIO_MIX && tile != (gint) i, NULL);
+  }
+  if (tile == WALL_AUDIO_MIX)
+    g_print ("Wall audio: all tiles mixed\n");
+  else
+    g_print ("Wall audio: tile %d\n", tile);
+}
+
+void wall_report (Wall *wall) {
+  guint i;
+
+  if (wall == NULL)
+    return;
+
+  for (i = 0; i < wall->n_tiles; i++) {
+    WallTile *tile = &wall->tiles[i];
+    g_print ("Tile %u %s: %" G_GUINT64_FORMAT " frames decoded, %" G_GUINT64_FORMAT " dropped\n",
+        i, tile->uri, (guint64) atomic_load (&tile->decoded), tile_dropped (wall, tile));
+  }
+}
+
+
+/* The sink letterboxes the canvas into the widget, undo that to find the tile */
+static gboolean widget_button_press_cb (GtkWidget *widget, GdkEventButton *event, CustomData *data) {
+  Wall *wall = data->wall;
+  gdouble width = gtk_widget_get_allocated_width (widget);
+  gdouble height = gtk_widget_get_allocated_height (widget);
+  gdouble canvas_width = wall->tile_width * (gdouble) wall->columns;
+  gdouble canvas_height = wall->tile_height * (gdouble) wall->rows;
+  gdouble scale = MIN (width / canvas_width, height / canvas_height);
+  gdouble x = (event->x - (width - canvas_width * scale) / 2) / scale;
+  gdouble y = (event->y - (height - canvas_height * scale) / 2) / scale;
+  gint column, row, tile;
+
+  if (event->type != GDK_BUTTON_PRESS || event->button != GDK_BUTTON_PRIMARY)
+    return FALSE;
+  if (x < 0 || y < 0 || x >= canvas_width || y >= canvas_height)
+    return FALSE;
+
+  column = (gint) (x / wall->tile_width);
+  row = (gint) (y / wall->tile_height);
+  tile = row * (gint) wall->columns + column;
+  if (tile >= (gint) wall->n_tiles)
+    return FALSE;
+
+  control_send (data, CONTROL_CMD_SELECT_AUDIO, tile == atomic_load (&wall->audio_tile) ? WALL_AUDIO_MIX : tile);
+  return TRUE;
+}
+
+void wall_connect_widget (CustomData *data) {
+  if (data->wall == NULL || data->sink_widget == NULL)
+    return;
+  gtk_widget_add_events (data->sink_widget, GDK_BUTTON_PRESS_MASK);
+  g_signal_connect (data->sink_widget, "button-press-event", G_CALLBACK (widget_button_press_cb), data);
+}
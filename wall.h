@@ -0,0 +1,59 @@
+#ifndef WALL_H
+#define WALL_H
+
+#include <stdatomic.h>
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+
+typedef struct _CustomData CustomData;
+
+/* Mix the audio of every tile */
+#define WALL_AUDIO_MIX -1
+
+typedef struct _WallTile {
+  guint index;
+  const gchar *uri;
+  GstElement *bin;              /* uridecodebin and the per-tile branches */
+  GstElement *source;
+  GstElement *video_queue;
+  GstElement *audio_queue;
+  GstPad *mixer_pad;            /* compositor pad, NULL until video shows up */
+  GstPad *amixer_pad;           /* audiomixer pad, NULL until audio shows up */
+
+  atomic_uint_fast64_t decoded;
+  guint64 dropped;              /* control thread only */
+  gint64 last_drop_report;
+} WallTile;
+
+typedef struct _Wall {
+  WallTile *tiles;
+  guint n_tiles;
+  guint columns;
+  guint rows;
+  gint tile_width;
+  gint tile_height;
+  GstElement *compositor;
+  GstElement *amixer;
+  GstElement *sink;             /* video sink the canvas ends in */
+  guint64 canvas_dropped;       /* whole canvases dropped downstream, every tile lost them, control thread only */
+  atomic_int audio_tile;        /* WALL_AUDIO_MIX or the only audible tile, written by the control thread */
+  atomic_uint pending_tiles;    /* tiles that have not exposed all their pads yet */
+} Wall;
+
+/* Each URI gets its own uridecodebin, queues and scaler inside a bin, all feeding
+ * one compositor (into video_queue) and one audiomixer (into audio_queue) */
+Wall *wall_build (CustomData *data, const gchar * const *uris, guint n_uris,
+    gint canvas_width, gint canvas_height, guint convert_threads, gint audio_tile);
+void wall_free (Wall *wall);
+
+/* Control thread: account QoS drops to the tile that posted them */
+void wall_handle_qos (Wall *wall, GstMessage *msg);
+/* Control thread: WALL_AUDIO_MIX or a tile index */
+void wall_select_audio (Wall *wall, gint tile);
+/* Print per-tile decoded and dropped frames */
+void wall_report (Wall *wall);
+
+/* UI: clicking a tile solos its audio, clicking it again goes back to the mix */
+void wall_connect_widget (CustomData *data);
+
+#endif